@@ -3,6 +3,9 @@
 #import "MemoryManager.h"
 #import "MemoryProfiler.h"
 #include "ort_genai_c.h"
+#include "conversation_manager.h"
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <cstdint>
 #include <unistd.h>
@@ -11,6 +14,7 @@
 extern "C" {
     int test_phi3_main(const char *);
     void cancelPhi3Generation();
+    void resetPhi3Conversation();
 }
 
 std::string generatePhi3ResponseStreaming(const char* user_input, const char* model_path, 
@@ -321,6 +325,11 @@ extern "C" void cancelPhi3Generation() {
     self.shouldStopGeneration = NO;
     self.lastUserInput = nil;
     
+    // Forget the conversation history and its KV cache (on the inference queue, after any running generation)
+    dispatch_async(self.inferenceQueue, ^{
+        resetPhi3Conversation();
+    });
+    
     // Disable continue button
     self.navigationItem.leftBarButtonItem.enabled = NO;
     
@@ -591,7 +600,7 @@ extern "C" void cancelPhi3Generation() {
 
 // ... [REST OF YOUR EXISTING METHODS REMAIN UNCHANGED] ...
 // sendMessage, processNewMessage, startStreamingGeneration, handleNewToken, 
-// updateCurrentResponse, shouldStopGenerationWithToken, isNaturalStoppingPoint,
+// updateCurrentResponse, shouldStopGenerationWithToken,
 // isGeneratingPoorContent, scheduleAutoScroll, stopGeneration, finishGeneration,
 // shouldOfferContinuation, continueGeneration, forceStopGeneration, removeLastMessage,
 // settingsButtonTapped, settingsDidChange, textFieldShouldReturn
@@ -669,6 +678,8 @@ extern "C" void cancelPhi3Generation() {
     
     NSLog(@"📺 Initial chat content: %@", self.chatTextView.text);
     
+    int contextTokens = (int)[SettingsViewController sharedSettings].maxLength;
+    
     dispatch_async(self.inferenceQueue, ^{
         __weak ChatViewController *weakSelf = self;
         
@@ -679,7 +690,7 @@ extern "C" void cancelPhi3Generation() {
             [userInput UTF8String], 
             [self.modelPath UTF8String],
             self.maxResponseTokens,
-            512, // Hard limit for total context
+            contextTokens, // Context budget shared by the packed history and the response
             ^(const char* token, bool isComplete) {
                 dispatch_async(dispatch_get_main_queue(), ^{
                     ChatViewController *strongSelf = weakSelf;
@@ -785,12 +796,6 @@ extern "C" void cancelPhi3Generation() {
         return YES;
     }
     
-    // Only check for natural stopping points after generating a reasonable amount
-    if (self.totalTokensGenerated >= 20 && [self isNaturalStoppingPoint:token]) {
-        NSLog(@"🛑 Stopping generation - reached natural stopping point at %ld tokens", (long)self.totalTokensGenerated);
-        return YES;
-    }
-    
     // Quality control - but only after minimum content
     if (self.totalTokensGenerated >= 30 && [self isGeneratingPoorContent:token]) {
         NSLog(@"🛑 Stopping generation - quality control at %ld tokens", (long)self.totalTokensGenerated);
@@ -806,39 +811,6 @@ extern "C" void cancelPhi3Generation() {
     return NO;
 }
 
-- (BOOL)isNaturalStoppingPoint:(NSString *)token {
-    // Check for sentence endings with sufficient content
-    if ([token containsString:@"."] || [token containsString:@"!"] || [token containsString:@"?"]) {
-        // Only consider natural stopping if we have substantial content
-        if (self.totalTokensGenerated >= 40) {
-            return YES;
-        }
-    }
-    
-    // Check for paragraph breaks (double newlines) with good content
-    if ([token containsString:@"\n\n"] && self.totalTokensGenerated >= 50) {
-        return YES;
-    }
-    
-    // Check for conversation enders - but only with sufficient content
-    if (self.totalTokensGenerated >= 30) {
-        NSArray *endPhrases = @[@"Hope this helps", @"Let me know", @"Feel free", 
-                               @"Any questions", @"That should", @"In summary"];
-        for (NSString *phrase in endPhrases) {
-            if ([self.fullResponse.lowercaseString containsString:phrase.lowercaseString]) {
-                return YES;
-            }
-        }
-    }
-    
-    // Check for complete code blocks
-    if ([token containsString:@"```"] && [self.fullResponse componentsSeparatedByString:@"```"].count >= 3) {
-        return YES;
-    }
-    
-    return NO;
-}
-
 - (BOOL)isGeneratingPoorContent:(NSString *)token {
     // Check for repetition
     if (token.length > 0) {
@@ -1091,6 +1063,90 @@ extern "C" void cancelPhi3Generation() {
 
 @end
 
+// The model stays loaded between messages and the conversation keeps its KV cache, so a new message only
+// prefills its own tokens unless the history has to be repacked into the context budget.
+struct Phi3ChatSession {
+    std::string model_path;
+    size_t context_tokens{};
+    size_t response_tokens{};
+    OgaModelPtr model;
+    OgaTokenizerPtr tokenizer;
+    OgaTokenizerStreamPtr tokenizer_stream;
+    std::unique_ptr<ConversationManager> conversation;
+};
+
+static Phi3ChatSession g_chat_session;
+
+// Load the model on first use and rebuild the conversation when the context settings change
+static ConversationManager& getPhi3Conversation(const char* model_path, int target_tokens, int max_total_tokens) {
+    auto& session = g_chat_session;
+    if (!session.model || session.model_path != model_path) {
+        session.conversation.reset();
+        session = Phi3ChatSession{};
+        OgaModel* model = nullptr;
+        OgaThrowIfFailed(OgaCreateModel(model_path, &model));
+        session.model.reset(model);
+        OgaTokenizer* tokenizer = nullptr;
+        OgaThrowIfFailed(OgaCreateTokenizer(model, &tokenizer));
+        session.tokenizer.reset(tokenizer);
+        session.model_path = model_path;
+    }
+
+    size_t context_tokens = static_cast<size_t>(std::max(max_total_tokens, 128));
+    size_t response_tokens = std::min(static_cast<size_t>(std::max(target_tokens, 1)), context_tokens / 2);
+    if (!session.conversation || session.context_tokens != context_tokens || session.response_tokens != response_tokens) {
+        ConversationOptions options;
+        options.context_tokens = context_tokens;
+        options.response_tokens = response_tokens;
+        // Greedy decoding, as before conversations were packed; temperature and top_p only apply with do_sample
+        options.temperature = 0.7;
+        options.top_p = 0.9;
+        // The repetition controls stay off: an n-gram ban breaks code, tables and quoted text
+        session.conversation = std::make_unique<ConversationManager>(session.model.get(), session.tokenizer.get(), options);
+        session.context_tokens = context_tokens;
+        session.response_tokens = response_tokens;
+    }
+    return *session.conversation;
+}
+
+// Generate the current response, decoding every token through a fresh tokenizer stream
+static std::string streamPhi3Response(ConversationManager& conversation, void(^tokenCallback)(const char* token, bool isComplete)) {
+    OgaTokenizerStream* tokenizer_stream = nullptr;
+    OgaThrowIfFailed(OgaCreateTokenizerStream(g_chat_session.tokenizer.get(), &tokenizer_stream));
+    g_chat_session.tokenizer_stream.reset(tokenizer_stream);
+
+    std::string full_response;
+    int32_t token = 0;
+    while (!g_should_cancel_generation && conversation.GenerateNextToken(token)) {
+        const char* token_text = nullptr;
+        OgaThrowIfFailed(OgaTokenizerStreamDecode(tokenizer_stream, token, &token_text));
+        full_response += token_text;
+
+        // Stream callback for real-time updates
+        if (tokenCallback && !g_should_cancel_generation) {
+            tokenCallback(token_text, false);
+        }
+
+        // Reduced delay for smooth streaming
+        if (!g_should_cancel_generation) {
+            usleep(5000); // 5ms delay
+        }
+    }
+    conversation.EndResponse();
+
+    const auto& stats = conversation.GetStats();
+    NSLog(@"💬 Conversation: %zu/%zu turns packed, %zu cached tokens, %zu appends, %zu repacks, %zu tokens reused, %zu prefilled",
+          stats.packed_turns, stats.turns, stats.cached_tokens, stats.appends, stats.repacks,
+          stats.reused_tokens, stats.prefilled_tokens);
+    return full_response;
+}
+
+extern "C" void resetPhi3Conversation() {
+    if (g_chat_session.conversation) {
+        g_chat_session.conversation->Clear();
+    }
+}
+
 // Enhanced C++ streaming function with proper cancellation
 std::string generatePhi3ResponseStreaming(const char* user_input, const char* model_path, 
                                         int target_tokens, int max_total_tokens,
@@ -1100,279 +1156,36 @@ std::string generatePhi3ResponseStreaming(const char* user_input, const char* mo
     g_should_cancel_generation = false;
     
     try {
-        // Create model
-        OgaModel* model = nullptr;
-        if (OgaCreateModel(model_path, &model) != nullptr) {
-            return "❌ Failed to load model";
-        }
-        
-        // Create tokenizer
-        OgaTokenizer* tokenizer = nullptr;
-        if (OgaCreateTokenizer(model, &tokenizer) != nullptr) {
-            OgaDestroyModel(model);
-            return "❌ Failed to create tokenizer";
-        }
-        
-        // Create tokenizer stream
-        OgaTokenizerStream* tokenizer_stream = nullptr;
-        if (OgaCreateTokenizerStream(tokenizer, &tokenizer_stream) != nullptr) {
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create tokenizer stream";
-        }
-        
-        // Format with chat template
-        std::string chat_template = "<|user|>\n";
-        chat_template += user_input;
-        chat_template += " <|end|>\n<|assistant|>";
-        
-        // Encode
-        OgaSequences* input_sequences = nullptr;
-        if (OgaCreateSequences(&input_sequences) != nullptr) {
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create sequences";
-        }
-        
-        if (OgaTokenizerEncode(tokenizer, chat_template.c_str(), input_sequences) != nullptr) {
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to encode prompt";
-        }
-        
-        // Create generator with custom parameters
-        OgaGeneratorParams* params = nullptr;
-        if (OgaCreateGeneratorParams(model, &params) != nullptr) {
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create generator params";
-        }
-        
-        // Optimized settings for streaming
-        OgaGeneratorParamsSetSearchNumber(params, "max_length", (double)max_total_tokens);
-        OgaGeneratorParamsSetSearchNumber(params, "temperature", 0.7);
-        OgaGeneratorParamsSetSearchNumber(params, "top_p", 0.9);
-        
-        OgaGenerator* generator = nullptr;
-        if (OgaCreateGenerator(model, params, &generator) != nullptr) {
-            OgaDestroyGeneratorParams(params);
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create generator";
-        }
-        
-        if (OgaGenerator_AppendTokenSequences(generator, input_sequences) != nullptr) {
-            OgaDestroyGenerator(generator);
-            OgaDestroyGeneratorParams(params);
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to append tokens";
-        }
-        
-        // Streaming generation loop with cancellation checks
-        std::string full_response;
-        int token_count = 0;
-        
-        while (!OgaGenerator_IsDone(generator) && token_count < target_tokens && !g_should_cancel_generation) {
-            if (OgaGenerator_GenerateNextToken(generator) != nullptr || g_should_cancel_generation) {
-                break;
-            }
-            
-            const int32_t* tokens = nullptr;
-            size_t token_count_batch = 0;
-            
-            if (OgaGenerator_GetNextTokens(generator, &tokens, &token_count_batch) != nullptr || g_should_cancel_generation) {
-                break;
-            }
-            
-            if (token_count_batch > 0 && !g_should_cancel_generation) {
-                int32_t new_token = tokens[token_count_batch - 1];
-                
-                const char* token_text = nullptr;
-                if (OgaTokenizerStreamDecode(tokenizer_stream, new_token, &token_text) == nullptr && !g_should_cancel_generation) {
-                    std::string token_str(token_text);
-                    
-                    if (token_str.find("<|end|>") != std::string::npos) {
-                        break;
-                    }
-                    
-                    full_response += token_str;
-                    
-                    // Stream callback for real-time updates
-                    if (tokenCallback && !g_should_cancel_generation) {
-                        tokenCallback(token_text, false);
-                    }
-                }
-            }
-            
-            token_count++;
-            
-            // Reduced delay for smooth streaming
-            if (!g_should_cancel_generation) {
-                usleep(5000); // 5ms delay
-            }
-        }
+        ConversationManager& conversation = getPhi3Conversation(model_path, target_tokens, max_total_tokens);
+        conversation.BeginResponse(user_input);
+        std::string full_response = streamPhi3Response(conversation, tokenCallback);
         
         // Final callback only if not cancelled
         if (tokenCallback && !g_should_cancel_generation) {
             tokenCallback("", true);
         }
         
-        // Cleanup
-        OgaDestroyGenerator(generator);
-        OgaDestroyGeneratorParams(params);
-        OgaDestroySequences(input_sequences);
-        OgaDestroyTokenizerStream(tokenizer_stream);
-        OgaDestroyTokenizer(tokenizer);
-        OgaDestroyModel(model);
-        
         return g_should_cancel_generation ? "Generation cancelled" : full_response;
         
-    } catch (...) {
+    } catch (const std::exception& e) {
+        NSLog(@"❌ Streaming generation failed: %s", e.what());
         return "❌ An error occurred during streaming generation";
     }
 }
 
-// C++ function for continuation (builds on previous response)
+// C++ function for continuation: reopens the last response and keeps generating from its cached KV
 std::string generatePhi3ResponseContinuation(const char* user_input, const char* previous_response, const char* model_path, int max_tokens) {
+    g_should_cancel_generation = false;
+
     try {
-        // Create model
-        OgaModel* model = nullptr;
-        if (OgaCreateModel(model_path, &model) != nullptr) {
-            return "❌ Failed to load model";
-        }
-        
-        // Create tokenizer
-        OgaTokenizer* tokenizer = nullptr;
-        if (OgaCreateTokenizer(model, &tokenizer) != nullptr) {
-            OgaDestroyModel(model);
-            return "❌ Failed to create tokenizer";
-        }
-        
-        // Create tokenizer stream
-        OgaTokenizerStream* tokenizer_stream = nullptr;
-        if (OgaCreateTokenizerStream(tokenizer, &tokenizer_stream) != nullptr) {
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create tokenizer stream";
-        }
-        
-        // Build continuation prompt
-        std::string chat_template = "<|user|>\n";
-        chat_template += user_input;
-        chat_template += " <|end|>\n<|assistant|>";
-        chat_template += previous_response;
-        // Don't add <|end|> - let it continue naturally
-        
-        // Encode
-        OgaSequences* input_sequences = nullptr;
-        if (OgaCreateSequences(&input_sequences) != nullptr) {
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create sequences";
-        }
-        
-        if (OgaTokenizerEncode(tokenizer, chat_template.c_str(), input_sequences) != nullptr) {
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to encode prompt";
-        }
-        
-        // Create generator
-        OgaGeneratorParams* params = nullptr;
-        if (OgaCreateGeneratorParams(model, &params) != nullptr) {
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create generator params";
+        if (!g_chat_session.conversation || !g_chat_session.conversation->ContinueResponse()) {
+            return "That's all I have to add for now.";
         }
-        
-        OgaGeneratorParamsSetSearchNumber(params, "max_length", 512.0);
-        OgaGeneratorParamsSetSearchNumber(params, "temperature", 0.7);
-        OgaGeneratorParamsSetSearchNumber(params, "top_p", 0.9);
-        
-        OgaGenerator* generator = nullptr;
-        if (OgaCreateGenerator(model, params, &generator) != nullptr) {
-            OgaDestroyGeneratorParams(params);
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to create generator";
-        }
-        
-        if (OgaGenerator_AppendTokenSequences(generator, input_sequences) != nullptr) {
-            OgaDestroyGenerator(generator);
-            OgaDestroyGeneratorParams(params);
-            OgaDestroySequences(input_sequences);
-            OgaDestroyTokenizerStream(tokenizer_stream);
-            OgaDestroyTokenizer(tokenizer);
-            OgaDestroyModel(model);
-            return "❌ Failed to append tokens";
-        }
-        
-        // Generate continuation
-        std::string response;
-        int token_count = 0;
-        
-        while (!OgaGenerator_IsDone(generator) && token_count < max_tokens) {
-            if (OgaGenerator_GenerateNextToken(generator) != nullptr) {
-                break;
-            }
-            
-            const int32_t* tokens = nullptr;
-            size_t token_count_batch = 0;
-            
-            if (OgaGenerator_GetNextTokens(generator, &tokens, &token_count_batch) != nullptr) {
-                break;
-            }
-            
-            if (token_count_batch > 0) {
-                int32_t new_token = tokens[token_count_batch - 1];
-                
-                const char* token_text = nullptr;
-                if (OgaTokenizerStreamDecode(tokenizer_stream, new_token, &token_text) == nullptr) {
-                    response += token_text;
-                    
-                    if (std::string(token_text).find("<|end|>") != std::string::npos) {
-                        break;
-                    }
-                }
-            }
-            
-            token_count++;
-        }
-        
-        // Cleanup
-        OgaDestroyGenerator(generator);
-        OgaDestroyGeneratorParams(params);
-        OgaDestroySequences(input_sequences);
-        OgaDestroyTokenizerStream(tokenizer_stream);
-        OgaDestroyTokenizer(tokenizer);
-        OgaDestroyModel(model);
-        
-        // Clean up response
-        size_t end_pos = response.find("<|end|>");
-        if (end_pos != std::string::npos) {
-            response = response.substr(0, end_pos);
-        }
-        
+        std::string response = streamPhi3Response(*g_chat_session.conversation, nil);
         return response.empty() ? "That's all I have to add for now." : response;
         
-    } catch (...) {
+    } catch (const std::exception& e) {
+        NSLog(@"❌ Continuation failed: %s", e.what());
         return "❌ An error occurred while generating continuation";
     }
 }
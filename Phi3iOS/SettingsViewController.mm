@@ -129,7 +129,7 @@ static SettingsViewController *sharedInstance = nil;
 
 - (void)resetToDefaults {
     self.maxTokens = 100;
-    self.maxLength = 512;
+    self.maxLength = 1024;
     self.temperature = 0.7;
     self.topP = 0.9;
     self.repetitionPenalty = 1.1;
@@ -177,7 +177,7 @@ static SettingsViewController *sharedInstance = nil;
 
 - (NSString *)tableView:(UITableView *)tableView titleForFooterInSection:(NSInteger)section {
     if (section == 0) {
-        return @"Max Tokens: Maximum number of tokens to generate per response\nMax Length: Maximum total sequence length";
+        return @"Max Tokens: Maximum number of tokens to generate per response\nMax Length: Context budget for the conversation history plus the response";
     } else {
         return @"Temperature: Controls randomness (0.0 = deterministic, 1.0 = very random)\nTop P: Nucleus sampling threshold\nRepetition Penalty: Reduces repetitive text";
     }
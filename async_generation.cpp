@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <stdexcept>
+
+#include "async_generation.h"
+#include "generator_extensions.h"
+#include "models/model.h"
+
+namespace Generators {
+
+AsyncGeneration::AsyncGeneration(ExtendedGenerator& generator, TokenizerStream* stream, TokenCallback on_tokens)
+    : generator_{generator},
+      stream_{stream},
+      on_tokens_{std::move(on_tokens)} {
+  // Held until Run ends, so the caller can't use the generator while the worker does
+  if (!generator_.TryClaim())
+    throw std::runtime_error("The generator is in use by another thread or an asynchronous generation");
+  try {
+    thread_ = std::thread{&AsyncGeneration::Run, this};
+  } catch (...) {
+    generator_.Release();
+    throw;
+  }
+}
+
+AsyncGeneration::~AsyncGeneration() {
+  Cancel();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void AsyncGeneration::Run() {
+  try {
+    while (!cancelled_ && !generator_.IsDone()) {
+      generator_.GenerateNextToken();
+      auto tokens = generator_.GetLastStepTokens();
+      text_.clear();
+      if (stream_) {
+        for (int32_t token : tokens)
+          text_ += stream_->Decode(token);
+      }
+      if (on_tokens_ && !on_tokens_(tokens, text_))
+        break;
+    }
+  } catch (const std::exception& e) {
+    error_ = e.what();
+  }
+  generator_.Release();
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    done_ = true;
+  }
+  done_changed_.notify_all();
+}
+
+void AsyncGeneration::Join() {
+  std::thread worker;
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    if (std::this_thread::get_id() == thread_.get_id())
+      throw std::runtime_error("Join can't be called from the generation's own callback");
+    done_changed_.wait(lock, [this] { return done_.load(); });
+    worker = std::move(thread_);  // Whoever joins first takes it
+  }
+  // Joined without the lock, the worker still takes it on its way out
+  if (worker.joinable())
+    worker.join();  // Done, the worker only has to return
+  if (!error_.empty())
+    throw std::runtime_error(error_);
+}
+
+}  // namespace Generators
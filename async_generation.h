@@ -0,0 +1,61 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Generation on a worker thread of its own, with the tokens of every step handed to a callback as they come, so
+// drivers don't each write their own blocking loop and threading around the generator. Any number of generators can
+// run at once, each on its own thread; their model's sessions run concurrently.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace Generators {
+
+struct ExtendedGenerator;
+struct TokenizerStream;
+
+struct AsyncGeneration {
+  // Called on the worker thread with the tokens of each step and their text (empty without a stream). Return false to
+  // stop generating. The generator is still claimed, so C API calls on it fail from here.
+  using TokenCallback = std::function<bool(std::span<const int32_t> tokens, std::string_view text)>;
+
+  // Starts generating right away. generator and stream (null for no text) must not be used elsewhere until Join
+  // returns, and have to outlive the AsyncGeneration. The generator is claimed until then (see
+  // ExtendedGenerator::TryClaim), the constructor throws if it is already.
+  AsyncGeneration(ExtendedGenerator& generator, TokenizerStream* stream, TokenCallback on_tokens);
+  // Cancels and joins
+  ~AsyncGeneration();
+
+  AsyncGeneration(const AsyncGeneration&) = delete;
+  AsyncGeneration& operator=(const AsyncGeneration&) = delete;
+
+  // Stop after the step in progress. Any thread, returns right away.
+  void Cancel() { cancelled_ = true; }
+  // Wait until generation has ended: the generator is done, the callback returned false, Cancel or an error. Any
+  // thread but the worker's own (from the callback), any number of times. Throws the error generation ended with.
+  void Join();
+  bool IsDone() const { return done_; }
+
+ private:
+  void Run();
+
+  ExtendedGenerator& generator_;
+  TokenizerStream* stream_;
+  TokenCallback on_tokens_;
+  std::string text_;  // Text of the current step
+
+  std::atomic<bool> cancelled_{};
+  std::atomic<bool> done_{};
+  std::string error_;  // Set before done_
+  std::mutex mutex_;
+  std::condition_variable done_changed_;
+  std::thread thread_;
+};
+
+}  // namespace Generators
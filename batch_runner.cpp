@@ -0,0 +1,278 @@
+// batch_runner.cpp - Offline JSONL batch generation for Phi-3
+//
+// Reads one JSON object per line ({"id": ..., "prompt": "..."} or {"id": ..., "messages": [...]}), sorts the
+// prompts by tokenized length, runs them in batch_size > 1 generators and writes one result per line in input
+// order. Sorting keeps similar lengths together so PadInputs adds as little padding as possible.
+//
+// Usage: batch_runner <model_path> <input.jsonl> <output.jsonl> [--batch-size 8] [--max-tokens 256]
+//                     [--max-length-spread 32]
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "oga_utils.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+struct BatchOptions {
+    std::string model_path;
+    std::string input_path;
+    std::string output_path;
+    size_t batch_size{8};
+    int max_new_tokens{256};
+    // A batch is closed early once its longest prompt exceeds its shortest by more than this many tokens
+    size_t max_length_spread{32};
+};
+
+struct PromptItem {
+    json id;
+    std::vector<int32_t> tokens;
+    std::vector<int32_t> output;
+    std::string finish_reason{"length"};
+};
+
+struct BatchStats {
+    size_t batches{};
+    size_t prompt_tokens{};
+    size_t prompt_padding{};     // Pad tokens added by PadInputs during prefill
+    size_t generated_tokens{};
+    size_t decode_slots{};       // Batch rows computed during decode, including rows that already finished
+    size_t useful_slots{};       // Rows that were still generating (their token was kept or stopped them)
+    double elapsed_ms{};
+};
+
+std::string BuildPrompt(const json& line) {
+    if (line.contains("prompt")) {
+        return "<|user|>\n" + line.at("prompt").get<std::string>() + " <|end|>\n<|assistant|>";
+    }
+    std::string prompt;
+    for (const auto& message : line.at("messages")) {
+        prompt += "<|" + message.at("role").get<std::string>() + "|>\n" + message.at("content").get<std::string>() +
+                  " <|end|>\n";
+    }
+    return prompt + "<|assistant|>";
+}
+
+std::vector<int32_t> Encode(OgaTokenizer* tokenizer, const std::string& prompt) {
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr owned{sequences};
+    OgaThrowIfFailed(OgaTokenizerEncode(tokenizer, prompt.c_str(), sequences));
+    const int32_t* data = OgaSequencesGetSequenceData(sequences, 0);
+    return {data, data + OgaSequencesGetSequenceCount(sequences, 0)};
+}
+
+std::string Decode(OgaTokenizer* tokenizer, const std::vector<int32_t>& tokens) {
+    std::string text;
+    OgaDecodeInto(tokenizer, tokens.data(), tokens.size(), text);
+    return text;
+}
+
+// Group prompt indices into batches: sorted by length, at most batch_size each, bounded length spread
+std::vector<std::vector<size_t>> BucketByLength(const std::vector<PromptItem>& items, const BatchOptions& options) {
+    std::vector<size_t> order(items.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&items](size_t a, size_t b) {
+        return items[a].tokens.size() < items[b].tokens.size();
+    });
+
+    std::vector<std::vector<size_t>> batches;
+    for (size_t index : order) {
+        if (batches.empty() || batches.back().size() >= options.batch_size ||
+            items[index].tokens.size() - items[batches.back().front()].tokens.size() > options.max_length_spread) {
+            batches.emplace_back();
+        }
+        batches.back().push_back(index);
+    }
+    return batches;
+}
+
+void RunBatch(OgaModel* model, std::vector<PromptItem>& items, const std::vector<size_t>& batch,
+              const std::vector<int32_t>& stop_token_ids, const BatchOptions& options, BatchStats& stats) {
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr sequences_owner{sequences};
+
+    size_t longest = 0;
+    for (size_t index : batch) {
+        const auto& tokens = items[index].tokens;
+        OgaThrowIfFailed(OgaAppendTokenSequence(tokens.data(), tokens.size(), sequences));
+        longest = std::max(longest, tokens.size());
+        stats.prompt_tokens += tokens.size();
+    }
+    for (size_t index : batch) {
+        stats.prompt_padding += longest - items[index].tokens.size();
+    }
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "batch_size", static_cast<double>(batch.size())));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(longest + options.max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+    OgaThrowIfFailed(OgaGenerator_AppendTokenSequences(generator, sequences));
+
+    std::vector<bool> finished(batch.size(), false);
+    size_t finished_count = 0;
+    for (int step = 0; step < options.max_new_tokens && finished_count < batch.size(); step++) {
+        if (OgaGenerator_IsDone(generator)) {
+            break;
+        }
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+
+        const int32_t* next_tokens = nullptr;
+        size_t next_token_count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &next_tokens, &next_token_count));
+        stats.decode_slots += batch.size();
+
+        for (size_t row = 0; row < batch.size() && row < next_token_count; row++) {
+            if (finished[row]) {
+                continue;
+            }
+            stats.useful_slots++;
+            auto& item = items[batch[row]];
+            int32_t token = next_tokens[row];
+            if (std::find(stop_token_ids.begin(), stop_token_ids.end(), token) != stop_token_ids.end()) {
+                finished[row] = true;
+                finished_count++;
+                item.finish_reason = "stop";
+                continue;
+            }
+            item.output.push_back(token);
+            stats.generated_tokens++;
+        }
+    }
+    stats.batches++;
+}
+
+// The whole of text as an integer of at least 1
+bool ParsePositive(const char* text, int& value) {
+    const char* end = text + std::strlen(text);
+    auto [parsed_end, error] = std::from_chars(text, end, value);
+    return error == std::errc{} && parsed_end == end && value >= 1;
+}
+
+bool ParseArguments(int argc, char* argv[], BatchOptions& options) {
+    if (argc < 4) {
+        return false;
+    }
+    options.model_path = argv[1];
+    options.input_path = argv[2];
+    options.output_path = argv[3];
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        int value = 0;
+        if (!ParsePositive(argv[i + 1], value)) {
+            return false;
+        }
+        if (flag == "--batch-size") {
+            options.batch_size = static_cast<size_t>(value);
+        } else if (flag == "--max-tokens") {
+            options.max_new_tokens = value;
+        } else if (flag == "--max-length-spread") {
+            options.max_length_spread = static_cast<size_t>(value);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    BatchOptions options;
+    if (!ParseArguments(argc, argv, options)) {
+        std::cout << "Usage: " << argv[0] << " <model_path> <input.jsonl> <output.jsonl> [--batch-size 8]"
+                  << " [--max-tokens 256] [--max-length-spread 32]\n";
+        return 1;
+    }
+
+    try {
+        std::cout << "📚 Loading model from: " << options.model_path << "\n";
+        OgaModel* model = nullptr;
+        OgaThrowIfFailed(OgaCreateModel(options.model_path.c_str(), &model));
+        OgaModelPtr model_owner{model};
+
+        OgaTokenizer* tokenizer = nullptr;
+        OgaThrowIfFailed(OgaCreateTokenizer(model, &tokenizer));
+        OgaTokenizerPtr tokenizer_owner{tokenizer};
+
+        std::vector<int32_t> stop_token_ids;
+        for (const char* stop : {"<|end|>", "<|endoftext|>"}) {
+            int32_t id = -1;
+            OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer, stop, &id));
+            stop_token_ids.push_back(id);
+        }
+
+        std::ifstream input(options.input_path);
+        if (!input) {
+            throw std::runtime_error("Cannot open " + options.input_path);
+        }
+        std::vector<PromptItem> items;
+        std::string line;
+        while (std::getline(input, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            json parsed = json::parse(line);
+            PromptItem item;
+            item.id = parsed.contains("id") ? parsed["id"] : json(items.size());
+            item.tokens = Encode(tokenizer, BuildPrompt(parsed));
+            items.push_back(std::move(item));
+        }
+        std::cout << "🔢 Tokenized " << items.size() << " prompts\n";
+
+        auto batches = BucketByLength(items, options);
+        BatchStats stats;
+        auto start = OgaClock::now();
+        for (size_t i = 0; i < batches.size(); i++) {
+            RunBatch(model, items, batches[i], stop_token_ids, options, stats);
+            std::cout << "\r🧠 Batch " << (i + 1) << "/" << batches.size() << std::flush;
+        }
+        stats.elapsed_ms = OgaMillisecondsSince(start);
+        std::cout << "\n";
+
+        std::ofstream output(options.output_path);
+        for (const auto& item : items) {
+            json result = {{"id", item.id},
+                           {"text", Decode(tokenizer, item.output)},
+                           {"prompt_tokens", item.tokens.size()},
+                           {"completion_tokens", item.output.size()},
+                           {"finish_reason", item.finish_reason}};
+            output << result.dump() << "\n";
+        }
+
+        double seconds = stats.elapsed_ms / 1000.0;
+        double prefill_waste = 100.0 * stats.prompt_padding / std::max<size_t>(1, stats.prompt_tokens + stats.prompt_padding);
+        double decode_waste = 100.0 * (stats.decode_slots - stats.useful_slots) / std::max<size_t>(1, stats.decode_slots);
+        std::cout << "🏆 Batch results:\n"
+                  << "  prompts: " << items.size() << " in " << stats.batches << " batches (batch size "
+                  << options.batch_size << ")\n"
+                  << "  generated: " << stats.generated_tokens << " tokens in " << seconds << "s = "
+                  << (stats.generated_tokens / seconds) << " tokens/s\n"
+                  << "  prompt throughput: " << (stats.prompt_tokens / seconds) << " tokens/s\n"
+                  << "  prefill padding waste: " << stats.prompt_padding << " pad tokens (" << prefill_waste << "%)\n"
+                  << "  decode waste: " << (stats.decode_slots - stats.useful_slots) << " finished-row slots ("
+                  << decode_waste << "%)\n"
+                  << "📄 Results written to " << options.output_path << "\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "❌ Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
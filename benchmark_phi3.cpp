@@ -0,0 +1,1432 @@
+// benchmark_phi3.cpp - Performance benchmarks for the Phi-3 runtime
+//
+// Usage: benchmark_phi3 <model_path> <mode> [options]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <sys/resource.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "conversation_manager.h"
+#include "generation_scheduler.h"
+#include "oga_utils.h"
+#include "ort_genai_c_ext.h"
+
+namespace {
+
+const char* kBackgroundPrompts[] = {
+    "Write a detailed summary of the history of computing, from mechanical calculators to modern processors.",
+    "Explain in depth how a compiler turns source code into machine code, covering every stage.",
+    "Describe the water cycle and its effect on climate in as much detail as you can.",
+};
+
+const char* kInteractivePrompts[] = {
+    "What is the capital of France?",
+    "Give me one tip for better sleep.",
+    "What is 12 times 7?",
+    "Name a primary colour.",
+};
+
+std::vector<int32_t> EncodeChat(OgaTokenizer* tokenizer, const std::string& user_input) {
+    std::string chat_template = "<|user|>\n" + user_input + " <|end|>\n<|assistant|>";
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr owned{sequences};
+    OgaThrowIfFailed(OgaTokenizerEncode(tokenizer, chat_template.c_str(), sequences));
+    const int32_t* data = OgaSequencesGetSequenceData(sequences, 0);
+    return {data, data + OgaSequencesGetSequenceCount(sequences, 0)};
+}
+
+void PrintClassStats(const std::array<PriorityClassStats, kGenerationPriorityCount>& stats) {
+    for (size_t i = 0; i < kGenerationPriorityCount; i++) {
+        const auto& s = stats[i];
+        if (s.completed == 0) {
+            continue;
+        }
+        std::cout << "  " << GenerationPriorityName(static_cast<GenerationPriority>(i))
+                  << ": " << s.completed << " requests, first token mean " << s.mean_first_token_ms
+                  << "ms p50 " << s.p50_first_token_ms << "ms p95 " << s.p95_first_token_ms
+                  << "ms max " << s.max_first_token_ms << "ms, " << s.generated_tokens << " tokens, "
+                  << s.preemptions << " preemptions, " << s.spills << " spills\n";
+    }
+}
+
+// Interactive latency with long background generations in flight, with and without preemption.
+// Every request is greedy, so each one must produce the same tokens it produces when run alone.
+int RunMixedLoad(OgaModel* model, OgaTokenizer* tokenizer, int background_tokens, int interactive_count) {
+    std::vector<std::vector<int32_t>> background_prompts;
+    for (const char* prompt : kBackgroundPrompts) {
+        background_prompts.push_back(EncodeChat(tokenizer, prompt));
+    }
+    std::vector<std::vector<int32_t>> interactive_prompts;
+    for (const char* prompt : kInteractivePrompts) {
+        interactive_prompts.push_back(EncodeChat(tokenizer, prompt));
+    }
+    const int interactive_tokens = 32;
+
+    // Reference outputs, each request alone on an idle scheduler
+    std::vector<std::vector<int32_t>> expected_background, expected_interactive;
+    {
+        GenerationScheduler scheduler(model);
+        auto run_alone = [&scheduler](const std::vector<int32_t>& prompt, int max_new_tokens) {
+            std::vector<int32_t> tokens;
+            GenerationRequest request;
+            request.prompt_tokens = prompt;
+            request.max_new_tokens = max_new_tokens;
+            request.on_complete = [&tokens](const GenerationResult& result) { tokens = result.tokens; };
+            scheduler.Submit(std::move(request));
+            scheduler.WaitIdle();
+            return tokens;
+        };
+        for (auto& prompt : background_prompts) {
+            expected_background.push_back(run_alone(prompt, background_tokens));
+        }
+        for (auto& prompt : interactive_prompts) {
+            expected_interactive.push_back(run_alone(prompt, interactive_tokens));
+        }
+    }
+
+    struct Config {
+        const char* name;
+        SchedulerOptions options;
+    };
+    std::vector<Config> configs(3);
+    configs[0] = {"fifo (no preemption)", {}};
+    configs[0].options.preemptive = false;
+    configs[1] = {"preemptive, keep KV resident", {}};
+    configs[2] = {"preemptive, spill paused KV", {}};
+    configs[2].options.pause_policy = PausePolicy::Spill;
+    configs[2].options.max_resident_paused = 0;
+
+    int mismatches = 0;
+    for (auto& config : configs) {
+        std::cout << "\n⏱️  Mixed load: " << config.name << "\n";
+        std::mutex results_mutex;
+        std::vector<GenerationResult> results;
+        GenerationScheduler scheduler(model, config.options);
+
+        auto submit = [&](const std::vector<int32_t>& prompt, int max_new_tokens, GenerationPriority priority) {
+            GenerationRequest request;
+            request.prompt_tokens = prompt;
+            request.max_new_tokens = max_new_tokens;
+            request.priority = priority;
+            request.on_complete = [&](const GenerationResult& result) {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                results.push_back(result);
+            };
+            return scheduler.Submit(std::move(request));
+        };
+
+        auto start = OgaClock::now();
+        std::vector<uint64_t> background_ids;
+        for (auto& prompt : background_prompts) {
+            background_ids.push_back(submit(prompt, background_tokens, GenerationPriority::Background));
+        }
+        std::vector<uint64_t> interactive_ids;
+        for (int i = 0; i < interactive_count; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            interactive_ids.push_back(submit(interactive_prompts[i % interactive_prompts.size()], interactive_tokens,
+                                             GenerationPriority::Interactive));
+        }
+        scheduler.WaitIdle();
+        double elapsed_ms = OgaMillisecondsSince(start);
+
+        for (const auto& result : results) {
+            const std::vector<int32_t>* expected = nullptr;
+            for (size_t i = 0; i < background_ids.size(); i++) {
+                if (background_ids[i] == result.id) {
+                    expected = &expected_background[i];
+                }
+            }
+            for (size_t i = 0; i < interactive_ids.size(); i++) {
+                if (interactive_ids[i] == result.id) {
+                    expected = &expected_interactive[i % interactive_prompts.size()];
+                }
+            }
+            if (!result.error.empty()) {
+                std::cerr << "❌ Request " << result.id << " failed: " << result.error << "\n";
+                mismatches++;
+            } else if (expected && result.tokens != *expected) {
+                std::cerr << "❌ Request " << result.id << " output differs from the solo run\n";
+                mismatches++;
+            }
+        }
+
+        auto stats = scheduler.GetStats();
+        size_t total_tokens = 0;
+        for (const auto& s : stats) {
+            total_tokens += s.generated_tokens;
+        }
+        PrintClassStats(stats);
+        std::cout << "  throughput: " << (total_tokens * 1000.0 / elapsed_ms) << " tokens/s over "
+                  << elapsed_ms << "ms\n";
+    }
+
+    if (mismatches == 0) {
+        std::cout << "\n✅ All outputs identical to their solo runs\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+// A long chat through ConversationManager: how often a new message is appended to the cached KV versus
+// repacked, and how many prompt tokens that saves over re-prefilling the whole history every turn
+int RunConversation(OgaModel* model, OgaTokenizer* tokenizer, int context_tokens, int turns) {
+    ConversationOptions options;
+    options.context_tokens = static_cast<size_t>(context_tokens);
+    options.response_tokens = 96;
+    options.do_sample = false;
+    options.system_prompt = "You are a helpful assistant. Keep answers short.";
+    ConversationManager conversation(model, tokenizer, options);
+
+    const char* messages[] = {
+        "Tell me about the history of computing.",
+        "What came after mechanical calculators?",
+        "Who designed the first stored-program computer?",
+        "How did transistors change things?",
+        "Summarise what we discussed so far.",
+    };
+
+    size_t full_history_tokens = 0;  // What re-prefilling the packed history every turn would have cost
+    double prefill_ms = 0;
+    for (int i = 0; i < turns; i++) {
+        auto start = OgaClock::now();
+        conversation.BeginResponse(messages[i % std::size(messages)]);
+        prefill_ms += OgaMillisecondsSince(start);
+        full_history_tokens += conversation.GetStats().cached_tokens;
+
+        int32_t token;
+        while (conversation.GenerateNextToken(token)) {
+        }
+        conversation.EndResponse();
+    }
+
+    const auto& stats = conversation.GetStats();
+    std::cout << "🏆 Conversation, " << turns << " turns in a " << context_tokens << " token context:\n"
+              << "  " << stats.appends << " appends, " << stats.repacks << " repacks, " << stats.packed_turns << "/"
+              << stats.turns << " turns packed at the end\n"
+              << "  prompt tokens prefilled: " << stats.prefilled_tokens << " (reused from KV: " << stats.reused_tokens
+              << ", full re-prefill every turn: " << full_history_tokens << ")\n"
+              << "  mean prefill time per turn: " << (prefill_ms / std::max(1, turns)) << "ms\n";
+    return 0;
+}
+
+struct DecodeRun {
+    std::vector<int32_t> tokens;
+    OgaDecodingStats stats{};
+    double elapsed_ms{};
+};
+
+using ParamsSetup = std::function<void(OgaGeneratorParams*)>;
+
+// Greedy decode of prompt, setup enables a decoding mode on the params (standard decoding when empty)
+DecodeRun DecodeGreedy(OgaModel* model, const ParamsSetup& setup, const std::vector<int32_t>& prompt, int max_new_tokens,
+                       const std::vector<int32_t>& stop_token_ids) {
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+    if (setup) {
+        setup(params);
+    }
+
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+
+    DecodeRun run;
+    auto start = OgaClock::now();
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+    bool stopped = false;
+    while (!stopped && !OgaGenerator_IsDone(generator)) {
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        const int32_t* tokens = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetLastStepTokens(generator, &tokens, &count));
+        for (size_t i = 0; i < count && !stopped; i++) {
+            stopped = std::find(stop_token_ids.begin(), stop_token_ids.end(), tokens[i]) != stop_token_ids.end();
+            if (!stopped) {
+                run.tokens.push_back(tokens[i]);
+            }
+        }
+    }
+    run.elapsed_ms = OgaMillisecondsSince(start);
+    OgaThrowIfFailed(OgaGenerator_GetDecodingStats(generator, &run.stats));
+    return run;
+}
+
+std::vector<int32_t> GetStopTokenIds(OgaTokenizer* tokenizer) {
+    std::vector<int32_t> stop_token_ids;
+    for (const char* stop : {"<|end|>", "<|endoftext|>"}) {
+        int32_t id = -1;
+        OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer, stop, &id));
+        stop_token_ids.push_back(id);
+    }
+    return stop_token_ids;
+}
+
+// Greedy decoding of every prompt with and without a multi-token decoding mode: output must be identical. Reports
+// draft acceptance rate, tokens per target forward pass and decode tokens/s.
+int CompareWithGreedy(OgaModel* model, OgaTokenizer* tokenizer, const std::vector<std::string>& prompts,
+                      int max_new_tokens, const char* name, const ParamsSetup& setup) {
+    auto stop_token_ids = GetStopTokenIds(tokenizer);
+
+    int mismatches = 0;
+    double baseline_ms = 0, mode_ms = 0;
+    size_t baseline_tokens = 0, mode_tokens = 0, proposed = 0, accepted = 0, target_runs = 0;
+    for (const auto& prompt_text : prompts) {
+        auto prompt = EncodeChat(tokenizer, prompt_text);
+        auto baseline = DecodeGreedy(model, {}, prompt, max_new_tokens, stop_token_ids);
+        auto run = DecodeGreedy(model, setup, prompt, max_new_tokens, stop_token_ids);
+        if (run.tokens != baseline.tokens) {
+            std::cerr << "❌ " << name << " output differs from greedy decoding for: " << prompt_text.substr(0, 60) << "\n";
+            mismatches++;
+        }
+
+        baseline_ms += baseline.stats.decode_ms;
+        baseline_tokens += baseline.stats.generated_tokens;
+        mode_ms += run.stats.decode_ms;
+        mode_tokens += run.stats.generated_tokens;
+        proposed += run.stats.proposed_tokens;
+        accepted += run.stats.accepted_tokens;
+        target_runs += run.stats.target_runs;
+    }
+
+    double baseline_rate = baseline_tokens * 1000.0 / std::max(1.0, baseline_ms);
+    double mode_rate = mode_tokens * 1000.0 / std::max(1.0, mode_ms);
+    std::cout << "🏆 " << name << ", " << prompts.size() << " prompts:\n"
+              << "  acceptance rate: " << (100.0 * accepted / std::max<size_t>(1, proposed)) << "% (" << accepted << "/"
+              << proposed << " draft tokens)\n"
+              << "  tokens per target forward pass: " << (double(mode_tokens) / std::max<size_t>(1, target_runs)) << "\n"
+              << "  decode: " << baseline_rate << " tokens/s standard, " << mode_rate << " tokens/s " << name << " ("
+              << (mode_rate / std::max(1e-9, baseline_rate)) << "x)\n";
+    if (mismatches == 0) {
+        std::cout << "✅ Output identical to greedy decoding\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+int RunSpeculative(OgaModel* model, OgaTokenizer* tokenizer, const std::string& draft_path, int num_draft_tokens,
+                   int max_new_tokens) {
+    std::cout << "📚 Loading draft model from: " << draft_path << "\n";
+    OgaModel* draft_model = nullptr;
+    OgaThrowIfFailed(OgaCreateDraftModel(model, draft_path.c_str(), &draft_model));
+    OgaModelPtr draft_owner{draft_model};
+
+    std::vector<std::string> prompts(std::begin(kBackgroundPrompts), std::end(kBackgroundPrompts));
+    return CompareWithGreedy(model, tokenizer, prompts, max_new_tokens, "speculative", [&](OgaGeneratorParams* params) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetDraftModel(params, draft_model, num_draft_tokens));
+    });
+}
+
+int RunLookahead(OgaModel* model, OgaTokenizer* tokenizer, int window_size, int ngram_size, int max_new_tokens) {
+    std::vector<std::string> prompts(std::begin(kBackgroundPrompts), std::end(kBackgroundPrompts));
+    return CompareWithGreedy(model, tokenizer, prompts, max_new_tokens, "lookahead", [&](OgaGeneratorParams* params) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetLookahead(params, window_size, ngram_size));
+    });
+}
+
+const char* kCopySource =
+    "def load_settings(path):\n"
+    "    settings = {}\n"
+    "    with open(path) as f:\n"
+    "        for line in f:\n"
+    "            line = line.strip()\n"
+    "            if not line or line.startswith('#'):\n"
+    "                continue\n"
+    "            key, value = line.split('=', 1)\n"
+    "            settings[key.strip()] = value.strip()\n"
+    "    return settings\n";
+
+const char* kCopyArticle =
+    "The city council met on Tuesday to discuss the new public library. The library will open next spring on Main "
+    "Street, next to the old post office. It will have a children's reading room, a cafe and forty computers for "
+    "public use. The council approved a budget of two million dollars for the building and one hundred thousand "
+    "dollars a year for new books. Construction starts in March and is expected to take nine months.";
+
+// Prompt lookup decoding on outputs that copy from their prompt: code edits, quoting and summaries
+int RunPromptLookup(OgaModel* model, OgaTokenizer* tokenizer, int max_ngram_size, int num_draft_tokens, int max_new_tokens) {
+    std::vector<std::string> prompts = {
+        std::string("Rename the variable settings to config in this code and print the whole function:\n") + kCopySource,
+        std::string("Add type hints to this function and print the whole function:\n") + kCopySource,
+        std::string("Repeat the following text exactly:\n") + kCopyArticle,
+        std::string("Summarize this article in three sentences:\n") + kCopyArticle,
+    };
+    return CompareWithGreedy(model, tokenizer, prompts, max_new_tokens, "prompt lookup", [&](OgaGeneratorParams* params) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetPromptLookup(params, max_ngram_size, num_draft_tokens));
+    });
+}
+
+// Decoders that commit a token without running it: every step after the first runs the previous step's token, which
+// is in the sequence but not in the KV cache. Each of them has to decode several steps with the same output as
+// standard greedy decoding, which the upstream search does, and no more than one forward pass per step.
+int RunPendingSteps(OgaModel* model, OgaTokenizer* tokenizer, int max_new_tokens) {
+    struct Mode {
+        const char* name;
+        ParamsSetup setup;
+    };
+    const Mode modes[] = {
+        {"prompt lookup, one draft", [](OgaGeneratorParams* params) {
+             OgaThrowIfFailed(OgaGeneratorParamsSetPromptLookup(params, 3, 1));
+         }},
+        {"prompt lookup", [](OgaGeneratorParams* params) {
+             OgaThrowIfFailed(OgaGeneratorParamsSetPromptLookup(params, 3, 4));
+         }},
+        {"lookahead", [](OgaGeneratorParams* params) {
+             OgaThrowIfFailed(OgaGeneratorParamsSetLookahead(params, 4, 3));
+         }},
+        {"cpu token selection", [](OgaGeneratorParams* params) {
+             OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "cpu_token_selection", true));
+         }},
+    };
+
+    auto stop_token_ids = GetStopTokenIds(tokenizer);
+    auto prompt = EncodeChat(tokenizer, std::string("Repeat the following text exactly:\n") + kCopyArticle);
+    auto baseline = DecodeGreedy(model, {}, prompt, max_new_tokens, stop_token_ids);
+
+    int failures = 0;
+    for (const auto& mode : modes) {
+        auto run = DecodeGreedy(model, mode.setup, prompt, max_new_tokens, stop_token_ids);
+        std::cout << "  " << mode.name << ": " << run.stats.steps << " steps, " << run.stats.target_runs
+                  << " forward passes, " << run.tokens.size() << " tokens\n";
+        if (run.stats.steps < 2) {
+            std::cerr << "❌ " << mode.name << " stopped after " << run.stats.steps << " step\n";
+            failures++;
+        } else if (run.tokens != baseline.tokens) {
+            std::cerr << "❌ " << mode.name << " output differs from greedy decoding\n";
+            failures++;
+        } else if (run.stats.target_runs > run.stats.steps) {
+            std::cerr << "❌ " << mode.name << " ran the model more than once per step\n";
+            failures++;
+        }
+    }
+    if (failures == 0) {
+        std::cout << "✅ Pending tokens run once, output identical to greedy decoding\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Sample until a stop token or max_length, the generator continues from wherever it is
+std::vector<int32_t> SampleCompletion(OgaGenerator* generator, const std::vector<int32_t>& stop_token_ids) {
+    std::vector<int32_t> completion;
+    while (!OgaGenerator_IsDone(generator)) {
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        const int32_t* tokens = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetLastStepTokens(generator, &tokens, &count));
+        for (size_t i = 0; i < count; i++) {
+            if (std::find(stop_token_ids.begin(), stop_token_ids.end(), tokens[i]) != stop_token_ids.end()) {
+                return completion;
+            }
+            completion.push_back(tokens[i]);
+        }
+    }
+    return completion;
+}
+
+// n sampled answers to one long prompt: n generators that each prefill it vs one generator with num_completions n
+int RunCompletions(OgaModel* model, OgaTokenizer* tokenizer, int num_completions, int max_new_tokens) {
+    auto stop_token_ids = GetStopTokenIds(tokenizer);
+    auto prompt = EncodeChat(tokenizer, std::string("Write a one-line headline for this article:\n") + kCopyArticle + "\n" +
+                                            kCopyArticle);
+
+    auto create_generator = [&](int completions) {
+        OgaGeneratorParams* params = nullptr;
+        OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+        OgaGeneratorParamsPtr params_owner{params};
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + max_new_tokens)));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", true));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "temperature", 0.8));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "top_p", 0.9));
+        OgaThrowIfFailed(OgaGeneratorParamsSetNumCompletions(params, completions));
+
+        OgaGenerator* generator = nullptr;
+        OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+        return OgaGeneratorPtr{generator};
+    };
+
+    std::set<std::vector<int32_t>> separate_answers, shared_answers;
+    double separate_prefill_ms = 0;
+    auto start = OgaClock::now();
+    for (int i = 0; i < num_completions; i++) {
+        auto generator = create_generator(1);
+        auto prefill_start = OgaClock::now();
+        OgaThrowIfFailed(OgaGenerator_AppendTokens(generator.get(), prompt.data(), prompt.size()));
+        separate_prefill_ms += OgaMillisecondsSince(prefill_start);
+        separate_answers.insert(SampleCompletion(generator.get(), stop_token_ids));
+    }
+    double separate_ms = OgaMillisecondsSince(start);
+
+    start = OgaClock::now();
+    auto generator = create_generator(num_completions);
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator.get(), prompt.data(), prompt.size()));
+    double shared_prefill_ms = OgaMillisecondsSince(start);
+    bool more = true;
+    while (more) {
+        shared_answers.insert(SampleCompletion(generator.get(), stop_token_ids));
+        OgaThrowIfFailed(OgaGenerator_StartNextCompletion(generator.get(), &more));
+    }
+    double shared_ms = OgaMillisecondsSince(start);
+
+    std::cout << "🏆 " << num_completions << " completions of a " << prompt.size() << " token prompt:\n"
+              << "  separate generators: " << separate_ms << "ms (prefill " << separate_prefill_ms << "ms), "
+              << separate_answers.size() << " distinct answers\n"
+              << "  shared prefill:      " << shared_ms << "ms (prefill " << shared_prefill_ms << "ms), "
+              << shared_answers.size() << " distinct answers\n"
+              << "  speedup: " << (separate_ms / std::max(1e-9, shared_ms)) << "x\n";
+    return 0;
+}
+
+void BanTokens(float* logits, size_t row_count, size_t vocab_size, const std::vector<int32_t>& banned) {
+    for (size_t row = 0; row < row_count; row++) {
+        for (int32_t token : banned) {
+            logits[row * vocab_size + token] = std::numeric_limits<float>::lowest();
+        }
+    }
+}
+
+// Greedy decode of prompt with the banned tokens masked out of every step's logits, either through a logits callback
+// or the way it had to be done before: OgaGenerator_GetLogits, edit the copy, OgaGenerator_SetLogits. With
+// cpu_token_selection a decoder of the generator's own picks the tokens instead of the search.
+DecodeRun DecodeBiased(OgaModel* model, const std::vector<int32_t>& prompt, int max_new_tokens,
+                       const std::vector<int32_t>& stop_token_ids, const std::vector<int32_t>& banned, bool use_callback,
+                       bool cpu_token_selection, double& bias_ms) {
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "cpu_token_selection", cpu_token_selection));
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+
+    struct CallbackState {
+        const std::vector<int32_t>* banned;
+        double* ms;
+    } state{&banned, &bias_ms};
+    if (use_callback) {
+        OgaThrowIfFailed(OgaGenerator_SetLogitsCallback(generator, [](void* user_data, float* logits, size_t row_count, size_t vocab_size) {
+            auto& state = *static_cast<CallbackState*>(user_data);
+            auto start = OgaClock::now();
+            BanTokens(logits, row_count, vocab_size, *state.banned);
+            *state.ms += OgaMillisecondsSince(start);
+        }, &state));
+    }
+
+    DecodeRun run;
+    auto start = OgaClock::now();
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+    while (!OgaGenerator_IsDone(generator)) {
+        if (!use_callback) {
+            // Computing the logits is part of the step either way, only the copies count
+            OgaTensorView view{};
+            OgaThrowIfFailed(OgaGenerator_GetLogitsView(generator, &view));
+            auto bias_start = OgaClock::now();
+            OgaTensor* tensor = nullptr;
+            OgaThrowIfFailed(OgaGenerator_GetLogits(generator, &tensor));
+            OgaTensorPtr tensor_owner{tensor};
+            int64_t shape[3] = {};
+            OgaThrowIfFailed(OgaTensorGetShape(tensor, shape, 3));
+            void* data = nullptr;
+            OgaThrowIfFailed(OgaTensorGetData(tensor, &data));
+            BanTokens(static_cast<float*>(data), static_cast<size_t>(shape[0] * shape[1]), static_cast<size_t>(shape[2]), banned);
+            OgaThrowIfFailed(OgaGenerator_SetLogits(generator, tensor));
+            bias_ms += OgaMillisecondsSince(bias_start);
+        }
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        const int32_t* tokens = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetLastStepTokens(generator, &tokens, &count));
+        if (std::find(stop_token_ids.begin(), stop_token_ids.end(), tokens[0]) != stop_token_ids.end()) {
+            break;
+        }
+        run.tokens.push_back(tokens[0]);
+    }
+    run.elapsed_ms = OgaMillisecondsSince(start);
+    return run;
+}
+
+// Masking tokens out of every step: logits callback vs the GetLogits / SetLogits round trip, same output expected
+int RunLogitsBias(OgaModel* model, OgaTokenizer* tokenizer, int max_new_tokens) {
+    auto stop_token_ids = GetStopTokenIds(tokenizer);
+    std::vector<int32_t> banned;
+    for (const char* word : {" the", " The", " a"}) {
+        int32_t id = -1;
+        OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer, word, &id));
+        if (id >= 0) {
+            banned.push_back(id);
+        }
+    }
+
+    int mismatches = 0;
+    size_t tokens = 0;
+    double round_trip_ms = 0, callback_ms = 0, round_trip_bias_ms = 0, callback_bias_ms = 0, decoder_bias_ms = 0;
+    for (const char* prompt_text : kBackgroundPrompts) {
+        auto prompt = EncodeChat(tokenizer, prompt_text);
+        auto round_trip = DecodeBiased(model, prompt, max_new_tokens, stop_token_ids, banned, false, false, round_trip_bias_ms);
+        auto callback = DecodeBiased(model, prompt, max_new_tokens, stop_token_ids, banned, true, false, callback_bias_ms);
+        // SetLogits has to reach the generator's decoder as well as the search
+        auto decoder = DecodeBiased(model, prompt, max_new_tokens, stop_token_ids, banned, false, true, decoder_bias_ms);
+        mismatches += round_trip.tokens != callback.tokens;
+        if (decoder.tokens != round_trip.tokens) {
+            std::cerr << "❌ SetLogits with cpu_token_selection differs from the search for: " << prompt_text << "\n";
+            mismatches++;
+        }
+        for (int32_t token : callback.tokens) {
+            mismatches += std::find(banned.begin(), banned.end(), token) != banned.end();
+        }
+        tokens += callback.tokens.size();
+        round_trip_ms += round_trip.elapsed_ms;
+        callback_ms += callback.elapsed_ms;
+    }
+
+    std::cout << "🏆 " << banned.size() << " tokens banned, " << tokens << " tokens generated:\n"
+              << "  GetLogits / SetLogits: " << (round_trip_bias_ms * 1000.0 / std::max<size_t>(1, tokens))
+              << "us per token in the round trip, " << round_trip_ms << "ms in all\n"
+              << "  logits callback:       " << (callback_bias_ms * 1000.0 / std::max<size_t>(1, tokens))
+              << "us per token in the callback, " << callback_ms << "ms in all\n";
+    if (mismatches == 0) {
+        std::cout << "✅ Same output with the search and a CPU decoder, no banned token generated\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+struct StreamRun {
+    std::vector<int32_t> tokens;
+    std::string text;
+    double elapsed_ms{};
+    double decode_ms{};  // In GenerateNextToken, the rest is API and detokenization overhead
+};
+
+// Greedy generation with decoded text, either one token per round trip the way the drivers did it, or
+// OgaGenerator_GenerateTokens in chunks of chunk_tokens
+StreamRun StreamGreedy(OgaModel* model, OgaTokenizer* tokenizer, const std::vector<int32_t>& prompt, int max_new_tokens,
+                       size_t chunk_tokens) {
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+    OgaTokenizerStream* stream = nullptr;
+    OgaThrowIfFailed(OgaCreateTokenizerStream(tokenizer, &stream));
+    OgaTokenizerStreamPtr stream_owner{stream};
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+
+    StreamRun run;
+    auto start = OgaClock::now();
+    if (chunk_tokens == 0) {
+        while (!OgaGenerator_IsDone(generator)) {
+            OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+            const int32_t* tokens = nullptr;
+            size_t count = 0;
+            OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &tokens, &count));
+            const char* text = nullptr;
+            OgaThrowIfFailed(OgaTokenizerStreamDecode(stream, tokens[0], &text));
+            run.tokens.push_back(tokens[0]);
+            run.text += text;
+        }
+    } else {
+        std::vector<int32_t> tokens(chunk_tokens);
+        std::vector<char> text(chunk_tokens * 16 + 1);
+        for (bool done = false; !done;) {
+            size_t count = 0, length = 0;
+            OgaThrowIfFailed(OgaGenerator_GenerateTokens(generator, tokens.size(), stream, tokens.data(), &count, text.data(),
+                                                         text.size(), &length, &done));
+            run.tokens.insert(run.tokens.end(), tokens.begin(), tokens.begin() + count);
+            run.text.append(text.data(), length);
+        }
+    }
+    run.elapsed_ms = OgaMillisecondsSince(start);
+
+    OgaDecodingStats stats{};
+    OgaThrowIfFailed(OgaGenerator_GetDecodingStats(generator, &stats));
+    run.decode_ms = stats.decode_ms;
+    return run;
+}
+
+// Per-token overhead of the C API loop: one round trip per token vs OgaGenerator_GenerateTokens
+int RunBulk(OgaModel* model, OgaTokenizer* tokenizer, int max_new_tokens, int chunk_tokens) {
+    int mismatches = 0;
+    size_t tokens = 0;
+    double loop_overhead_ms = 0, bulk_overhead_ms = 0, loop_ms = 0, bulk_ms = 0;
+    for (const char* prompt_text : kBackgroundPrompts) {
+        auto prompt = EncodeChat(tokenizer, prompt_text);
+        auto loop = StreamGreedy(model, tokenizer, prompt, max_new_tokens, 0);
+        auto bulk = StreamGreedy(model, tokenizer, prompt, max_new_tokens, static_cast<size_t>(std::max(chunk_tokens, 1)));
+        mismatches += loop.tokens != bulk.tokens || loop.text != bulk.text;
+        tokens += loop.tokens.size();
+        loop_ms += loop.elapsed_ms;
+        bulk_ms += bulk.elapsed_ms;
+        loop_overhead_ms += loop.elapsed_ms - loop.decode_ms;
+        bulk_overhead_ms += bulk.elapsed_ms - bulk.decode_ms;
+    }
+
+    const double per_token = 1000.0 / std::max<size_t>(1, tokens);
+    std::cout << "🏆 " << tokens << " tokens with text:\n"
+              << "  per-token round trips:       " << loop_ms << "ms, " << (loop_overhead_ms * per_token)
+              << "us per token outside GenerateNextToken\n"
+              << "  GenerateTokens, " << chunk_tokens << " at a time: " << bulk_ms << "ms, "
+              << (bulk_overhead_ms * per_token) << "us per token outside GenerateNextToken\n";
+    if (mismatches == 0) {
+        std::cout << "✅ Same tokens and text\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+struct AsyncOutput {
+    std::vector<int32_t> tokens;
+    std::string text;
+};
+
+bool OGA_API_CALL CollectTokens(void* user_data, const int32_t* tokens, size_t token_count, const char* text) {
+    auto* output = static_cast<AsyncOutput*>(user_data);
+    output->tokens.insert(output->tokens.end(), tokens, tokens + token_count);
+    output->text += text;
+    return true;
+}
+
+// Concurrent generators on library threads with OgaGenerator_StartAsync vs the same generations one after another
+int RunAsync(OgaModel* model, OgaTokenizer* tokenizer, int generator_count, int max_new_tokens) {
+    const size_t count = static_cast<size_t>(std::max(generator_count, 1));
+    std::vector<std::vector<int32_t>> prompts;
+    for (size_t i = 0; i < count; i++) {
+        prompts.push_back(EncodeChat(tokenizer, kBackgroundPrompts[i % std::size(kBackgroundPrompts)]));
+    }
+
+    std::vector<StreamRun> sequential;
+    auto sequential_start = OgaClock::now();
+    for (const auto& prompt : prompts) {
+        sequential.push_back(StreamGreedy(model, tokenizer, prompt, max_new_tokens, 0));
+    }
+    const double sequential_ms = OgaMillisecondsSince(sequential_start);
+
+    std::vector<OgaGeneratorParamsPtr> params(count);
+    std::vector<OgaGeneratorPtr> generators(count);
+    std::vector<OgaTokenizerStreamPtr> streams(count);
+    for (size_t i = 0; i < count; i++) {
+        OgaGeneratorParams* p = nullptr;
+        OgaThrowIfFailed(OgaCreateGeneratorParams(model, &p));
+        params[i].reset(p);
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(p, "max_length", static_cast<double>(prompts[i].size() + max_new_tokens)));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(p, "do_sample", false));
+        OgaGenerator* generator = nullptr;
+        OgaThrowIfFailed(OgaCreateGenerator(model, p, &generator));
+        generators[i].reset(generator);
+        OgaTokenizerStream* stream = nullptr;
+        OgaThrowIfFailed(OgaCreateTokenizerStream(tokenizer, &stream));
+        streams[i].reset(stream);
+        OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompts[i].data(), prompts[i].size()));
+    }
+
+    std::vector<AsyncOutput> outputs(count);
+    std::vector<OgaAsyncGenerationPtr> generations(count);
+    auto async_start = OgaClock::now();
+    for (size_t i = 0; i < count; i++) {
+        OgaAsyncGeneration* generation = nullptr;
+        OgaThrowIfFailed(OgaGenerator_StartAsync(generators[i].get(), streams[i].get(), CollectTokens, &outputs[i], &generation));
+        generations[i].reset(generation);
+    }
+    for (auto& generation : generations) {
+        OgaThrowIfFailed(OgaAsyncGeneration_Join(generation.get()));
+    }
+    const double async_ms = OgaMillisecondsSince(async_start);
+
+    int mismatches = 0;
+    size_t tokens = 0;
+    for (size_t i = 0; i < count; i++) {
+        mismatches += sequential[i].tokens != outputs[i].tokens || sequential[i].text != outputs[i].text;
+        tokens += outputs[i].tokens.size();
+    }
+
+    std::cout << "🏆 " << count << " generations, " << tokens << " tokens:\n"
+              << "  one after another:     " << sequential_ms << "ms, " << (tokens * 1000.0 / std::max(sequential_ms, 1e-9))
+              << " tokens/s\n"
+              << "  concurrent StartAsync: " << async_ms << "ms, " << (tokens * 1000.0 / std::max(async_ms, 1e-9))
+              << " tokens/s\n";
+    if (mismatches == 0) {
+        std::cout << "✅ Same tokens and text\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+std::vector<int32_t> Encode(OgaTokenizer* tokenizer, const std::string& text) {
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr owned{sequences};
+    OgaThrowIfFailed(OgaTokenizerEncode(tokenizer, text.c_str(), sequences));
+    const int32_t* data = OgaSequencesGetSequenceData(sequences, 0);
+    return {data, data + OgaSequencesGetSequenceCount(sequences, 0)};
+}
+
+// Log-probabilities of continuation the way it had to be done before OgaScoreSequence: one forward pass per token and
+// a copy of the vocabulary logits each time
+std::vector<float> ScoreByStepping(OgaModel* model, const std::vector<int32_t>& prompt, const std::vector<int32_t>& continuation) {
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + continuation.size() + 1)));
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+
+    std::vector<float> logprobs;
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+    for (int32_t token : continuation) {
+        OgaTensor* tensor = nullptr;
+        OgaThrowIfFailed(OgaGenerator_GetLogits(generator, &tensor));
+        OgaTensorPtr tensor_owner{tensor};
+        int64_t shape[3] = {};
+        OgaThrowIfFailed(OgaTensorGetShape(tensor, shape, 3));
+        void* data = nullptr;
+        OgaThrowIfFailed(OgaTensorGetData(tensor, &data));
+        std::vector<float> logits(static_cast<const float*>(data), static_cast<const float*>(data) + shape[2]);
+
+        double max_logit = *std::max_element(logits.begin(), logits.end());
+        double sum = 0;
+        for (float logit : logits) {
+            sum += std::exp(logit - max_logit);
+        }
+        logprobs.push_back(static_cast<float>(logits[token] - max_logit - std::log(sum)));
+        OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, &token, 1));
+    }
+    return logprobs;
+}
+
+// Scoring answers to the interactive prompts: token-by-token stepping vs OgaScoreSequence vs one OgaScoreSequences batch
+int RunScoring(OgaModel* model, OgaTokenizer* tokenizer, int top_k) {
+    const char* answers[] = {
+        "The capital of France is Paris.",
+        "Keep a regular schedule and go to bed at the same time every night.",
+        "12 times 7 is 84.",
+        "Red is a primary colour.",
+    };
+    std::vector<std::vector<int32_t>> prompts, continuations;
+    for (size_t i = 0; i < std::size(kInteractivePrompts); i++) {
+        prompts.push_back(EncodeChat(tokenizer, kInteractivePrompts[i]));
+        continuations.push_back(Encode(tokenizer, answers[i]));
+    }
+
+    double stepping_ms = 0, single_ms = 0, max_difference = 0;
+    for (size_t i = 0; i < prompts.size(); i++) {
+        auto start = OgaClock::now();
+        auto expected = ScoreByStepping(model, prompts[i], continuations[i]);
+        stepping_ms += OgaMillisecondsSince(start);
+
+        start = OgaClock::now();
+        OgaSequenceScores* scores = nullptr;
+        OgaThrowIfFailed(OgaScoreSequence(model, prompts[i].data(), prompts[i].size(), continuations[i].data(),
+                                          continuations[i].size(), static_cast<size_t>(top_k), &scores));
+        OgaSequenceScoresPtr scores_owner{scores};
+        single_ms += OgaMillisecondsSince(start);
+
+        const float* logprobs = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaSequenceScores_GetLogProbs(scores, 0, &logprobs, &count));
+        for (size_t j = 0; j < count; j++) {
+            max_difference = std::max(max_difference, static_cast<double>(std::fabs(logprobs[j] - expected[j])));
+        }
+    }
+
+    OgaSequences* prompt_sequences = nullptr;
+    OgaSequences* continuation_sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&prompt_sequences));
+    OgaSequencesPtr prompts_owner{prompt_sequences};
+    OgaThrowIfFailed(OgaCreateSequences(&continuation_sequences));
+    OgaSequencesPtr continuations_owner{continuation_sequences};
+    for (size_t i = 0; i < prompts.size(); i++) {
+        OgaThrowIfFailed(OgaAppendTokenSequence(prompts[i].data(), prompts[i].size(), prompt_sequences));
+        OgaThrowIfFailed(OgaAppendTokenSequence(continuations[i].data(), continuations[i].size(), continuation_sequences));
+    }
+
+    auto start = OgaClock::now();
+    OgaSequenceScores* batch_scores = nullptr;
+    OgaThrowIfFailed(OgaScoreSequences(model, prompt_sequences, continuation_sequences, static_cast<size_t>(top_k), &batch_scores));
+    OgaSequenceScoresPtr batch_owner{batch_scores};
+    double batch_ms = OgaMillisecondsSince(start);
+
+    std::cout << "🏆 Scoring " << prompts.size() << " continuations:\n"
+              << "  token-by-token stepping: " << stepping_ms << "ms\n"
+              << "  OgaScoreSequence:        " << single_ms << "ms (" << (stepping_ms / std::max(1e-9, single_ms)) << "x)\n"
+              << "  OgaScoreSequences batch: " << batch_ms << "ms (" << (stepping_ms / std::max(1e-9, batch_ms)) << "x)\n"
+              << "  largest log-prob difference to stepping: " << max_difference << "\n";
+    if (max_difference > 1e-2) {
+        std::cerr << "❌ Scores differ from token-by-token log-probabilities\n";
+        return 1;
+    }
+    std::cout << "✅ Scores match token-by-token log-probabilities\n";
+    return 0;
+}
+
+// Peak resident set size of the process so far in MB (ru_maxrss is KB on Linux, bytes on macOS)
+double PeakRssMb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+// Prefill of a long prompt in chunks vs in one forward pass: time, logits output size and peak memory. The chunked
+// run goes first because the peak only grows.
+int RunPrefill(OgaModel* model, OgaTokenizer* tokenizer, int prompt_tokens, int chunk_size) {
+    std::string text = "Summarize these notes:\n";
+    std::vector<int32_t> prompt;
+    while (prompt.size() < static_cast<size_t>(prompt_tokens)) {
+        text += kCopyArticle;
+        text += "\n";
+        prompt = EncodeChat(tokenizer, text);
+    }
+    prompt.resize(prompt_tokens);
+
+    int32_t first_tokens[2] = {};
+    for (int run = 0; run < 2; run++) {
+        const int run_chunk_size = run == 0 ? chunk_size : 0;
+        OgaGeneratorParams* params = nullptr;
+        OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+        OgaGeneratorParamsPtr params_owner{params};
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + 1)));
+        OgaThrowIfFailed(OgaGeneratorParamsSetPrefillChunkSize(params, run_chunk_size));
+        OgaGenerator* generator = nullptr;
+        OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+        OgaGeneratorPtr generator_owner{generator};
+
+        double rss_before = PeakRssMb();
+        auto start = OgaClock::now();
+        OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+        double prefill_ms = OgaMillisecondsSince(start);
+
+        // A view: copying the output just for its shape would add a whole logits tensor to the peak
+        OgaTensorView logits{};
+        OgaThrowIfFailed(OgaGenerator_GetOutputView(generator, "logits", &logits));
+        const std::vector<int64_t> shape(logits.shape, logits.shape + logits.shape_rank);
+
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        const int32_t* next_tokens = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &next_tokens, &count));
+        first_tokens[run] = next_tokens[0];
+
+        std::cout << (run_chunk_size > 0 ? "  chunks of " + std::to_string(run_chunk_size) : std::string("  one pass")) << ": "
+                  << prefill_ms << "ms, logits output [" << shape[0] << ", " << shape[1] << ", " << shape[2] << "] "
+                  << (shape[0] * shape[1] * shape[2] * 4 / (1024.0 * 1024.0)) << "MB as fp32, peak RSS +"
+                  << (PeakRssMb() - rss_before) << "MB\n";
+    }
+
+    if (first_tokens[0] != first_tokens[1]) {
+        std::cerr << "❌ Chunked prefill predicts a different first token\n";
+        return 1;
+    }
+    std::cout << "✅ Same first token after " << prompt.size() << " prompt tokens\n";
+    return 0;
+}
+
+// A client keeping its own copy of the sequence after every step: whole sequence vs only the new tokens
+int RunSequencePolling(OgaModel* model, OgaTokenizer* tokenizer, int prompt_tokens, int max_new_tokens) {
+    std::string text = "Summarize these notes:\n";
+    std::vector<int32_t> prompt;
+    while (prompt.size() < static_cast<size_t>(prompt_tokens)) {
+        text += kCopyArticle;
+        text += "\n";
+        prompt = EncodeChat(tokenizer, text);
+    }
+    prompt.resize(prompt_tokens);
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt.size() + max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+
+    std::vector<int32_t> copied, read;
+    size_t cursor = 0, steps = 0;
+    double copy_ms = 0, cursor_ms = 0;
+    while (!OgaGenerator_IsDone(generator)) {
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        steps++;
+
+        auto start = OgaClock::now();
+        const size_t count = OgaGenerator_GetSequenceCount(generator, 0);
+        const int32_t* data = OgaGenerator_GetSequenceData(generator, 0);
+        copied.assign(data, data + count);
+        copy_ms += OgaMillisecondsSince(start);
+
+        start = OgaClock::now();
+        const int32_t* tokens = nullptr;
+        size_t token_count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetSequenceSince(generator, 0, &cursor, &tokens, &token_count));
+        read.insert(read.end(), tokens, tokens + token_count);
+        cursor_ms += OgaMillisecondsSince(start);
+    }
+
+    const double per_step = 1000.0 / std::max<size_t>(1, steps);
+    std::cout << "🏆 " << steps << " steps after " << prompt.size() << " prompt tokens, sequence of " << read.size() << ":\n"
+              << "  whole sequence:   " << (copy_ms * per_step) << "us per step\n"
+              << "  GetSequenceSince: " << (cursor_ms * per_step) << "us per step\n";
+    if (copied != read) {
+        std::cout << "❌ The sequences differ\n";
+        return 1;
+    }
+    std::cout << "✅ Same sequence\n";
+    return 0;
+}
+
+// A pool of one generator serving requests: a new generator per request vs OgaGenerator_Reset, greedy and seeded sampling
+int RunGeneratorReuse(OgaModel* model, OgaTokenizer* tokenizer, int request_count, int max_new_tokens) {
+    const auto stop_token_ids = GetStopTokenIds(tokenizer);
+    std::vector<std::vector<int32_t>> prompts;
+    size_t max_prompt = 0;
+    for (int i = 0; i < request_count; i++) {
+        prompts.push_back(EncodeChat(tokenizer, kInteractivePrompts[i % std::size(kInteractivePrompts)]));
+        max_prompt = std::max(max_prompt, prompts.back().size());
+    }
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(max_prompt + max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+
+    auto generate = [&](OgaGenerator* generator, const std::vector<int32_t>& prompt) {
+        std::vector<int32_t> tokens;
+        OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+        while (tokens.size() < static_cast<size_t>(max_new_tokens) && !OgaGenerator_IsDone(generator)) {
+            OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+            const int32_t* next = nullptr;
+            size_t count = 0;
+            OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &next, &count));
+            if (std::find(stop_token_ids.begin(), stop_token_ids.end(), next[0]) != stop_token_ids.end()) {
+                break;
+            }
+            tokens.push_back(next[0]);
+        }
+        return tokens;
+    };
+
+    std::vector<std::vector<int32_t>> created_outputs, reset_outputs;
+    double create_ms = 0, reset_ms = 0, created_total_ms = 0, reset_total_ms = 0;
+    for (const auto& prompt : prompts) {
+        auto start = OgaClock::now();
+        OgaGenerator* generator = nullptr;
+        OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+        OgaGeneratorPtr generator_owner{generator};
+        create_ms += OgaMillisecondsSince(start);
+        created_outputs.push_back(generate(generator, prompt));
+        generator_owner.reset();
+        created_total_ms += OgaMillisecondsSince(start);
+    }
+
+    OgaGenerator* pooled = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &pooled));
+    OgaGeneratorPtr pooled_owner{pooled};
+    for (const auto& prompt : prompts) {
+        auto start = OgaClock::now();
+        OgaThrowIfFailed(OgaGenerator_Reset(pooled, nullptr));
+        reset_ms += OgaMillisecondsSince(start);
+        reset_outputs.push_back(generate(pooled, prompt));
+        reset_total_ms += OgaMillisecondsSince(start);
+    }
+
+    const double per_request = 1.0 / std::max(request_count, 1);
+    std::cout << "🏆 " << request_count << " requests of up to " << max_new_tokens << " tokens:\n"
+              << "  new generator each: " << (create_ms * per_request) << "ms setup, "
+              << (created_total_ms * per_request) << "ms per request\n"
+              << "  OgaGenerator_Reset: " << (reset_ms * per_request) << "ms setup, "
+              << (reset_total_ms * per_request) << "ms per request\n";
+    if (created_outputs != reset_outputs) {
+        std::cout << "❌ Outputs differ\n";
+        return 1;
+    }
+    std::cout << "✅ Same outputs\n";
+
+    // Seeded sampling starts over from random_seed on every reset, like a new generator sampling on CPU
+    auto create_sampling_params = [&](bool cpu_token_selection) {
+        OgaGeneratorParams* sampling = nullptr;
+        OgaThrowIfFailed(OgaCreateGeneratorParams(model, &sampling));
+        OgaGeneratorParamsPtr sampling_owner{sampling};
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(sampling, "max_length", static_cast<double>(max_prompt + max_new_tokens)));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(sampling, "do_sample", true));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(sampling, "temperature", 0.7));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(sampling, "top_p", 0.9));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(sampling, "random_seed", 42));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(sampling, "cpu_token_selection", cpu_token_selection));
+        return sampling_owner;
+    };
+    auto cpu_sampling = create_sampling_params(true);
+    auto search_sampling = create_sampling_params(false);
+
+    OgaGenerator* sampler = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, search_sampling.get(), &sampler));
+    OgaGeneratorPtr sampler_owner{sampler};
+    int sampled_mismatches = 0;
+    for (const auto& prompt : prompts) {
+        OgaGenerator* generator = nullptr;
+        OgaThrowIfFailed(OgaCreateGenerator(model, cpu_sampling.get(), &generator));
+        OgaGeneratorPtr generator_owner{generator};
+        auto created = generate(generator, prompt);
+        OgaThrowIfFailed(OgaGenerator_Reset(sampler, nullptr));
+        if (generate(sampler, prompt) != created) {
+            sampled_mismatches++;
+        }
+    }
+    if (sampled_mismatches > 0) {
+        std::cout << "❌ Seeded sampling after a reset differs from a new generator for " << sampled_mismatches << " of "
+                  << prompts.size() << " requests\n";
+        return 1;
+    }
+    std::cout << "✅ Same seeded samples after a reset\n";
+    return 0;
+}
+
+// Greedy answer to prompt with its text, on a generator reset for the request
+AsyncOutput AnswerRequest(OgaGenerator* generator, OgaTokenizer* tokenizer, const std::string& prompt_text, int max_new_tokens,
+                          const std::vector<int32_t>& stop_token_ids) {
+    auto prompt = EncodeChat(tokenizer, prompt_text);
+    OgaThrowIfFailed(OgaGenerator_Reset(generator, nullptr));
+    OgaTokenizerStream* stream = nullptr;
+    OgaThrowIfFailed(OgaCreateTokenizerStream(tokenizer, &stream));
+    OgaTokenizerStreamPtr stream_owner{stream};
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+
+    AsyncOutput output;
+    while (output.tokens.size() < static_cast<size_t>(max_new_tokens) && !OgaGenerator_IsDone(generator)) {
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        const int32_t* next = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &next, &count));
+        if (std::find(stop_token_ids.begin(), stop_token_ids.end(), next[0]) != stop_token_ids.end()) {
+            break;
+        }
+        const char* text = nullptr;
+        OgaThrowIfFailed(OgaTokenizerStreamDecode(stream, next[0], &text));
+        output.tokens.push_back(next[0]);
+        output.text += text;
+    }
+    return output;
+}
+
+// Threads serving requests from one model, tokenizer and params, each with its own generator and tokenizer streams:
+// throughput as the thread count doubles, every answer checked against a single-threaded run
+int RunConcurrencyStress(OgaModel* model, OgaTokenizer* tokenizer, int max_threads, int requests_per_thread, int max_new_tokens) {
+    const auto stop_token_ids = GetStopTokenIds(tokenizer);
+    std::vector<std::string> prompts(std::begin(kInteractivePrompts), std::end(kInteractivePrompts));
+    prompts.insert(prompts.end(), std::begin(kBackgroundPrompts), std::end(kBackgroundPrompts));
+    size_t max_prompt = 0;
+    for (const auto& prompt : prompts) {
+        max_prompt = std::max(max_prompt, EncodeChat(tokenizer, prompt).size());
+    }
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(max_prompt + max_new_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", false));
+
+    std::vector<AsyncOutput> expected;
+    {
+        OgaGenerator* generator = nullptr;
+        OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+        OgaGeneratorPtr generator_owner{generator};
+        for (const auto& prompt : prompts) {
+            expected.push_back(AnswerRequest(generator, tokenizer, prompt, max_new_tokens, stop_token_ids));
+        }
+    }
+
+    int failures = 0;
+    double single_thread_rate = 0;
+    std::cout << "🏆 " << requests_per_thread << " requests per thread of up to " << max_new_tokens << " tokens:\n";
+    for (int thread_count = 1; thread_count <= std::max(max_threads, 1); thread_count *= 2) {
+        std::atomic<size_t> tokens{0};
+        std::atomic<int> mismatches{0};
+        std::mutex errors_mutex;
+        std::vector<std::string> errors;
+        std::vector<std::thread> threads;
+        auto start = OgaClock::now();
+        for (int t = 0; t < thread_count; t++) {
+            threads.emplace_back([&, t] {
+                try {
+                    OgaGenerator* generator = nullptr;
+                    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+                    OgaGeneratorPtr generator_owner{generator};
+                    for (int r = 0; r < requests_per_thread; r++) {
+                        const size_t index = static_cast<size_t>(t + r) % prompts.size();
+                        auto output = AnswerRequest(generator, tokenizer, prompts[index], max_new_tokens, stop_token_ids);
+                        tokens += output.tokens.size();
+                        mismatches += output.tokens != expected[index].tokens || output.text != expected[index].text;
+                    }
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock{errors_mutex};
+                    errors.push_back(e.what());
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const double elapsed_ms = OgaMillisecondsSince(start);
+        const double rate = tokens * 1000.0 / std::max(elapsed_ms, 1e-9);
+        if (thread_count == 1) {
+            single_thread_rate = rate;
+        }
+
+        std::cout << "  " << thread_count << " threads: " << elapsed_ms << "ms, " << rate << " tokens/s ("
+                  << (rate / std::max(single_thread_rate, 1e-9)) << "x), " << mismatches << " mismatched answers\n";
+        for (const auto& error : errors) {
+            std::cout << "    ❌ " << error << "\n";
+        }
+        failures += mismatches + static_cast<int>(errors.size());
+    }
+
+    // A generator is used by one thread at a time: a second caller gets an error while an async generation holds it,
+    // whether it changes the generator or only reads it
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+    auto prompt = EncodeChat(tokenizer, prompts.back());
+    const int32_t* tokens = nullptr;
+    size_t count = 0, cursor = 0;
+    OgaDecodingStats stats{};
+    const std::pair<const char*, std::function<OgaResult*()>> calls[] = {
+        {"GenerateNextToken", [&] { return OgaGenerator_GenerateNextToken(generator); }},
+        {"GetNextTokens", [&] { return OgaGenerator_GetNextTokens(generator, &tokens, &count); }},
+        {"GetLastStepTokens", [&] { return OgaGenerator_GetLastStepTokens(generator, &tokens, &count); }},
+        {"GetSequenceSince", [&] { return OgaGenerator_GetSequenceSince(generator, 0, &cursor, &tokens, &count); }},
+        {"GetDecodingStats", [&] { return OgaGenerator_GetDecodingStats(generator, &stats); }},
+    };
+    for (const auto& [name, call] : calls) {
+        OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, prompt.data(), prompt.size()));
+        AsyncOutput output;
+        OgaAsyncGeneration* generation = nullptr;
+        OgaThrowIfFailed(OgaGenerator_StartAsync(generator, nullptr, CollectTokens, &output, &generation));
+        OgaAsyncGenerationPtr generation_owner{generation};
+        OgaResult* result = call();
+        const bool done_hidden = !OgaGenerator_IsDone(generator);
+        const bool rejected = (result != nullptr && done_hidden) || OgaAsyncGeneration_IsDone(generation);
+        if (result) {
+            OgaDestroyResult(result);
+        }
+        OgaAsyncGeneration_Cancel(generation);
+        OgaThrowIfFailed(OgaAsyncGeneration_Join(generation));
+        std::cout << (rejected ? "  ✅ " : "  ❌ ") << name << " during an async generation "
+                  << (rejected ? "rejected" : "not detected") << "\n";
+        failures += !rejected;
+        OgaThrowIfFailed(OgaGenerator_Reset(generator, nullptr));
+        cursor = 0;
+    }
+
+    if (failures == 0) {
+        std::cout << "✅ Every answer matches the single-threaded run\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Decoding the same tokens over and over: a string allocated and destroyed per call vs one caller buffer
+int RunDecodeInto(OgaTokenizer* tokenizer, int token_count, int iterations) {
+    std::vector<int32_t> tokens;
+    for (std::string text = kCopyArticle; tokens.size() < static_cast<size_t>(token_count); text += kCopyArticle) {
+        tokens = Encode(tokenizer, text);
+    }
+    tokens.resize(token_count);
+
+    std::string allocated;
+    auto start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        const char* text = nullptr;
+        OgaThrowIfFailed(OgaTokenizerDecode(tokenizer, tokens.data(), tokens.size(), &text));
+        if (i == 0) {
+            allocated = text;
+        }
+        OgaDestroyString(text);
+    }
+    const double allocated_ms = OgaMillisecondsSince(start);
+
+    std::string buffer;
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        OgaDecodeInto(tokenizer, tokens.data(), tokens.size(), buffer);
+    }
+    const double into_ms = OgaMillisecondsSince(start);
+
+    const double per_call = 1000.0 / std::max(iterations, 1);
+    std::cout << "🏆 " << iterations << " decodes of " << tokens.size() << " tokens:\n"
+              << "  OgaTokenizerDecode + OgaDestroyString: " << (allocated_ms * per_call) << "us per call\n"
+              << "  OgaTokenizerDecodeInto:                " << (into_ms * per_call) << "us per call\n";
+    if (allocated != buffer) {
+        std::cout << "❌ Different text\n";
+        return 1;
+    }
+    std::cout << "✅ Same text\n";
+    return 0;
+}
+
+void PrintUsage(const char* program) {
+    std::cout << "Usage: " << program << " <model_path> <mode> [options]\n"
+              << "\nModes:\n"
+              << "  mixed [background_tokens] [interactive_count]\n"
+              << "      Interactive first-token latency under long background generations,\n"
+              << "      FIFO vs preemptive scheduling, with output equivalence check\n"
+              << "  conversation [context_tokens] [turns]\n"
+              << "      Multi-turn chat history packing: KV appends vs repacks and prefilled tokens\n"
+              << "  speculative <draft_model_path> [num_draft_tokens] [max_tokens]\n"
+              << "      Greedy speculative decoding with a draft model vs standard decoding:\n"
+              << "      acceptance rate, tokens per forward pass and tokens/s, with output equivalence check\n"
+              << "  lookup [max_ngram_size] [num_draft_tokens] [max_tokens]\n"
+              << "      Prompt lookup decoding vs standard decoding on copy-heavy prompts (code edits, quotes)\n"
+              << "  lookahead [window_size] [ngram_size] [max_tokens]\n"
+              << "      Lookahead (Jacobi) decoding vs standard greedy decoding, same report as speculative\n"
+              << "  steps [max_tokens]\n"
+              << "      Multi-step decoding with the last token of every step left pending, against greedy decoding\n"
+              << "  completions [n] [max_tokens]\n"
+              << "      n sampled answers to one prompt: n generators vs one prefill shared by n completions\n"
+              << "  score [top_k]\n"
+              << "      Continuation log-probs: token-by-token stepping vs OgaScoreSequence and batched OgaScoreSequences\n"
+              << "  prefill [prompt_tokens] [chunk_size]\n"
+              << "      Long prompt prefill in chunks vs one pass: time, logits output size and peak memory\n"
+              << "  bulk [max_tokens] [chunk_tokens]\n"
+              << "      C API overhead per token: a round trip per token vs OgaGenerator_GenerateTokens\n"
+              << "  bias [max_tokens]\n"
+              << "      Banning tokens every step: logits callback vs GetLogits / SetLogits copies, same output,\n"
+              << "      also with cpu_token_selection\n"
+              << "  async [generators] [max_tokens]\n"
+              << "      Concurrent OgaGenerator_StartAsync generations vs one after another: wall time and tokens/s\n"
+              << "  poll [prompt_tokens] [max_tokens]\n"
+              << "      Reading the sequence after every step: whole sequence copies vs OgaGenerator_GetSequenceSince\n"
+              << "  reset [requests] [max_tokens]\n"
+              << "      Short requests on a new generator each vs one generator reused with OgaGenerator_Reset,\n"
+              << "      and seeded sampling after a reset vs a new generator\n"
+              << "  concurrent [max_threads] [requests_per_thread] [max_tokens]\n"
+              << "      Threads sharing one model and tokenizer, 1 to max_threads: tokens/s and answers checked\n"
+              << "  decode [tokens] [iterations]\n"
+              << "      OgaTokenizerDecode with a string per call vs OgaTokenizerDecodeInto into one buffer\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    const std::string model_path = argv[1];
+    const std::string mode = argv[2];
+
+    try {
+        std::cout << "📚 Loading model from: " << model_path << "\n";
+        OgaModel* model = nullptr;
+        OgaThrowIfFailed(OgaCreateModel(model_path.c_str(), &model));
+        OgaModelPtr model_owner{model};
+
+        OgaTokenizer* tokenizer = nullptr;
+        OgaThrowIfFailed(OgaCreateTokenizer(model, &tokenizer));
+        OgaTokenizerPtr tokenizer_owner{tokenizer};
+
+        if (mode == "mixed") {
+            int background_tokens = argc > 3 ? std::atoi(argv[3]) : 200;
+            int interactive_count = argc > 4 ? std::atoi(argv[4]) : 8;
+            return RunMixedLoad(model, tokenizer, background_tokens, interactive_count);
+        }
+        if (mode == "conversation") {
+            int context_tokens = argc > 3 ? std::atoi(argv[3]) : 1024;
+            int turns = argc > 4 ? std::atoi(argv[4]) : 20;
+            return RunConversation(model, tokenizer, context_tokens, turns);
+        }
+        if (mode == "speculative" && argc > 3) {
+            int num_draft_tokens = argc > 4 ? std::atoi(argv[4]) : 4;
+            int max_tokens = argc > 5 ? std::atoi(argv[5]) : 128;
+            return RunSpeculative(model, tokenizer, argv[3], num_draft_tokens, max_tokens);
+        }
+        if (mode == "lookup") {
+            int max_ngram_size = argc > 3 ? std::atoi(argv[3]) : 3;
+            int num_draft_tokens = argc > 4 ? std::atoi(argv[4]) : 8;
+            int max_tokens = argc > 5 ? std::atoi(argv[5]) : 256;
+            return RunPromptLookup(model, tokenizer, max_ngram_size, num_draft_tokens, max_tokens);
+        }
+        if (mode == "lookahead") {
+            int window_size = argc > 3 ? std::atoi(argv[3]) : 6;
+            int ngram_size = argc > 4 ? std::atoi(argv[4]) : 4;
+            int max_tokens = argc > 5 ? std::atoi(argv[5]) : 128;
+            return RunLookahead(model, tokenizer, window_size, ngram_size, max_tokens);
+        }
+        if (mode == "steps") {
+            int max_tokens = argc > 3 ? std::atoi(argv[3]) : 32;
+            return RunPendingSteps(model, tokenizer, max_tokens);
+        }
+        if (mode == "completions") {
+            int num_completions = argc > 3 ? std::atoi(argv[3]) : 4;
+            int max_tokens = argc > 4 ? std::atoi(argv[4]) : 32;
+            return RunCompletions(model, tokenizer, num_completions, max_tokens);
+        }
+        if (mode == "score") {
+            int top_k = argc > 3 ? std::atoi(argv[3]) : 5;
+            return RunScoring(model, tokenizer, top_k);
+        }
+        if (mode == "prefill") {
+            int prompt_tokens = argc > 3 ? std::atoi(argv[3]) : 2048;
+            int chunk_size = argc > 4 ? std::atoi(argv[4]) : 256;
+            return RunPrefill(model, tokenizer, prompt_tokens, chunk_size);
+        }
+        if (mode == "bulk") {
+            int max_tokens = argc > 3 ? std::atoi(argv[3]) : 128;
+            int chunk_tokens = argc > 4 ? std::atoi(argv[4]) : 16;
+            return RunBulk(model, tokenizer, max_tokens, chunk_tokens);
+        }
+        if (mode == "bias") {
+            int max_tokens = argc > 3 ? std::atoi(argv[3]) : 128;
+            return RunLogitsBias(model, tokenizer, max_tokens);
+        }
+        if (mode == "async") {
+            int generators = argc > 3 ? std::atoi(argv[3]) : 3;
+            int max_tokens = argc > 4 ? std::atoi(argv[4]) : 128;
+            return RunAsync(model, tokenizer, generators, max_tokens);
+        }
+        if (mode == "poll") {
+            int prompt_tokens = argc > 3 ? std::atoi(argv[3]) : 2048;
+            int max_tokens = argc > 4 ? std::atoi(argv[4]) : 128;
+            return RunSequencePolling(model, tokenizer, prompt_tokens, max_tokens);
+        }
+        if (mode == "reset") {
+            int requests = argc > 3 ? std::atoi(argv[3]) : 16;
+            int max_tokens = argc > 4 ? std::atoi(argv[4]) : 16;
+            return RunGeneratorReuse(model, tokenizer, requests, max_tokens);
+        }
+        if (mode == "concurrent") {
+            int max_threads = argc > 3 ? std::atoi(argv[3]) : 8;
+            int requests_per_thread = argc > 4 ? std::atoi(argv[4]) : 4;
+            int max_tokens = argc > 5 ? std::atoi(argv[5]) : 64;
+            return RunConcurrencyStress(model, tokenizer, max_threads, requests_per_thread, max_tokens);
+        }
+        if (mode == "decode") {
+            int tokens = argc > 3 ? std::atoi(argv[3]) : 64;
+            int iterations = argc > 4 ? std::atoi(argv[4]) : 10000;
+            return RunDecodeInto(tokenizer, tokens, iterations);
+        }
+
+        PrintUsage(argv[0]);
+        return 1;
+    } catch (const std::exception& e) {
+        std::cerr << "❌ Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
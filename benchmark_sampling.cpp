@@ -0,0 +1,597 @@
+// benchmark_sampling.cpp - Microbenchmark of the CPU top-k / top-p sampling kernel (sampling_cpu.cpp)
+//
+// Usage: benchmark_sampling [iterations]
+//
+// Times SampleToken and ComputeSamplingProbs against the sort-based scalar implementation they replaced, on
+// synthetic 32064-entry logits rows, and checks that both give the same distribution: the same tokens in the cut
+// with the same probabilities, and sample frequencies that match them. The same for each chain of logits processors,
+// fused into one pass against one pass each, and for greedy search's argmax. Then JSON grammar masks: cached against
+// computed per token, and what the mask-and-fill adds to the pipeline. Last, the per-token cost of keeping the
+// repetition controls' token history up to date, against rebuilding it from the sequence every step.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "grammar_constraint.h"
+#include "oga_utils.h"
+#include "sampling_cpu.h"
+#include "token_history.h"
+
+namespace {
+
+constexpr size_t kVocabSize = 32064;
+
+// The previous ComputeSamplingProbs: scalar exp and a partial sort of the whole vocabulary
+void ReferenceSamplingProbs(std::span<const float> logits, const Generators::Config::Search& search, std::span<float> probs) {
+    const float temperature = search.temperature > 0.0f ? search.temperature : 1.0f;
+    const float max_logit = *std::max_element(logits.begin(), logits.end());
+    for (size_t i = 0; i < logits.size(); i++) {
+        probs[i] = std::exp((logits[i] - max_logit) / temperature);
+    }
+
+    const size_t vocab_size = logits.size();
+    const bool use_top_k = search.top_k > 0 && static_cast<size_t>(search.top_k) < vocab_size;
+    const bool use_top_p = search.top_p > 0.0f && search.top_p < 1.0f;
+    if (use_top_k || use_top_p) {
+        std::vector<int32_t> order(vocab_size);
+        std::iota(order.begin(), order.end(), 0);
+        auto by_prob = [&probs](int32_t a, int32_t b) { return probs[a] > probs[b]; };
+        size_t kept = use_top_k ? static_cast<size_t>(search.top_k) : vocab_size;
+        std::partial_sort(order.begin(), order.begin() + kept, order.end(), by_prob);
+
+        if (use_top_p) {
+            float kept_mass = 0.0f;
+            for (size_t i = 0; i < kept; i++) {
+                kept_mass += probs[order[i]];
+            }
+            float threshold = search.top_p * kept_mass;
+            float cumulative = 0.0f;
+            for (size_t i = 0; i < kept; i++) {
+                cumulative += probs[order[i]];
+                if (cumulative >= threshold) {
+                    kept = i + 1;
+                    break;
+                }
+            }
+        }
+
+        for (size_t i = kept; i < vocab_size; i++) {
+            probs[order[i]] = 0.0f;
+        }
+    }
+
+    float sum = std::accumulate(probs.begin(), probs.end(), 0.0f);
+    for (auto& p : probs) {
+        p /= sum;
+    }
+}
+
+// Language-model-like rows: a broad normal background with a handful of strong candidates
+std::vector<std::vector<float>> MakeLogits(size_t rows, std::mt19937& engine) {
+    std::normal_distribution<float> background(0.0f, 2.5f);
+    std::uniform_int_distribution<size_t> token(0, kVocabSize - 1);
+    std::uniform_real_distribution<float> peak(8.0f, 14.0f);
+
+    std::vector<std::vector<float>> logits(rows, std::vector<float>(kVocabSize));
+    for (auto& row : logits) {
+        for (auto& logit : row) {
+            logit = background(engine);
+        }
+        for (int i = 0; i < 12; i++) {
+            row[token(engine)] = peak(engine);
+        }
+    }
+    return logits;
+}
+
+struct Setting {
+    const char* name;
+    float temperature;
+    int top_k;
+    float top_p;
+};
+
+Generators::Config::Search MakeSearch(const Setting& setting) {
+    Generators::Config::Search search;
+    search.do_sample = true;
+    search.temperature = setting.temperature;
+    search.top_k = setting.top_k;
+    search.top_p = setting.top_p;
+    return search;
+}
+
+struct SampleCheck {
+    double chi_square{};
+    size_t bins{};
+    double z_score{};
+};
+
+// Pearson chi-square of drawn token frequencies against the expected distribution. Tokens expected fewer than 5 times
+// share one bin, and a statistic within 5 standard deviations of its mean passes.
+SampleCheck CheckSamples(std::span<const float> expected, const std::function<int32_t()>& draw) {
+    constexpr size_t kSamples = 200000;
+    std::vector<size_t> counts(expected.size());
+    for (size_t i = 0; i < kSamples; i++) {
+        counts[draw()]++;
+    }
+
+    SampleCheck check;
+    double rest_expected = 0, rest_observed = 0;
+    for (size_t i = 0; i < expected.size(); i++) {
+        const double expected_count = static_cast<double>(expected[i]) * kSamples;
+        if (expected_count < 5) {
+            rest_expected += expected_count;
+            rest_observed += counts[i];
+            continue;
+        }
+        check.chi_square += (counts[i] - expected_count) * (counts[i] - expected_count) / expected_count;
+        check.bins++;
+    }
+    if (rest_expected >= 5) {
+        check.chi_square += (rest_observed - rest_expected) * (rest_observed - rest_expected) / rest_expected;
+        check.bins++;
+    } else {
+        // Tokens the reference (nearly) never draws must not be drawn much either
+        check.chi_square += rest_observed > 5 ? rest_observed : 0;
+    }
+    const double degrees = check.bins > 1 ? static_cast<double>(check.bins - 1) : 1.0;
+    check.z_score = (check.chi_square - degrees) / std::sqrt(2 * degrees);
+    return check;
+}
+
+// Same support and probabilities as the reference on every row, then sampled frequencies within noise of them
+bool CheckEquivalence(const Setting& setting, const std::vector<std::vector<float>>& logits, std::mt19937& engine) {
+    auto search = MakeSearch(setting);
+    std::vector<float> expected(kVocabSize), actual(kVocabSize);
+    double max_difference = 0;
+    size_t support_mismatches = 0;
+    for (const auto& row : logits) {
+        ReferenceSamplingProbs(row, search, expected);
+        Generators::ComputeSamplingProbs(row, search, actual);
+        for (size_t i = 0; i < kVocabSize; i++) {
+            max_difference = std::max(max_difference, static_cast<double>(std::fabs(expected[i] - actual[i])));
+            support_mismatches += (expected[i] > 0.0f) != (actual[i] > 0.0f);
+        }
+    }
+
+    ReferenceSamplingProbs(logits.front(), search, expected);
+    std::vector<float> scratch;
+    auto check = CheckSamples(expected, [&] { return Generators::SampleToken(logits.front(), search, engine, scratch); });
+
+    const bool ok = support_mismatches == 0 && max_difference < 1e-4 && check.z_score < 5;
+    std::cout << "  " << (ok ? "✅ " : "❌ ") << "largest probability difference " << max_difference << ", "
+              << support_mismatches << " tokens in only one cut, sampled chi-square " << check.chi_square << " over "
+              << check.bins << " bins (z " << check.z_score << ")\n";
+    return ok;
+}
+
+void RunTimings(const Setting& setting, const std::vector<std::vector<float>>& logits, int iterations, std::mt19937& engine) {
+    auto search = MakeSearch(setting);
+    std::vector<float> probs(kVocabSize);
+    size_t checksum = 0;
+
+    auto start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        const auto& row = logits[i % logits.size()];
+        ReferenceSamplingProbs(row, search, probs);
+        checksum += Generators::SampleFromProbs(probs, engine);
+    }
+    double reference_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        const auto& row = logits[i % logits.size()];
+        Generators::ComputeSamplingProbs(row, search, probs);
+        checksum += Generators::SampleFromProbs(probs, engine);
+    }
+    double dense_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    std::vector<float> scratch;
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        checksum += Generators::SampleToken(logits[i % logits.size()], search, engine, scratch);
+    }
+    double sample_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    std::cout << "  per token: sort-based " << reference_us << "us, ComputeSamplingProbs " << dense_us << "us ("
+              << (reference_us / dense_us) << "x), SampleToken " << sample_us << "us (" << (reference_us / sample_us)
+              << "x)  [checksum " << checksum % 1000 << "]\n";
+}
+
+// Logits processor chains (logits_pipeline_cpu.h), on top of the chat sampling settings
+
+constexpr int32_t kEosTokenIds[] = {32000, 32007};
+
+// Tokens of the chain's sequence that are prompt, the rest is generated
+constexpr size_t kPromptLength = 1000;
+
+struct Chain {
+    const char* name;
+    float repetition_penalty;
+    int min_length;
+    float frequency_penalty;
+    float presence_penalty;
+    int no_repeat_ngram_size;
+};
+
+// The tokens that would repeat an n-gram of output if they came next, found by scanning all of it
+std::vector<int32_t> ReferenceBannedTokens(std::span<const int32_t> output, size_t ngram_size) {
+    std::vector<int32_t> banned;
+    if (ngram_size == 0 || output.size() < ngram_size) {
+        return banned;
+    }
+    const auto suffix = output.subspan(output.size() - (ngram_size - 1));
+    for (size_t start = 0; start + ngram_size <= output.size(); start++) {
+        if (std::equal(suffix.begin(), suffix.end(), output.begin() + start)) {
+            banned.push_back(output[start + ngram_size - 1]);
+        }
+    }
+    return banned;
+}
+
+// The processors one pass each, the way the search applies them, counting the tokens again every step
+void ReferenceProcessLogits(std::span<const float> logits, const Generators::Config::Search& search, const Chain& chain,
+                            std::span<const int32_t> sequence, std::vector<float>& out) {
+    out.assign(logits.begin(), logits.end());
+    if (search.repetition_penalty != 1.0f) {
+        std::unordered_set<int32_t> tokens(sequence.begin(), sequence.end());
+        for (int32_t token : tokens) {
+            float& logit = out[token];
+            logit = logit < 0.0f ? logit * search.repetition_penalty : logit / search.repetition_penalty;
+        }
+    }
+    const auto output = sequence.subspan(std::min(kPromptLength, sequence.size()));
+    if (chain.frequency_penalty != 0.0f || chain.presence_penalty != 0.0f) {
+        std::unordered_map<int32_t, uint32_t> counts;
+        for (int32_t token : output) {
+            counts[token]++;
+        }
+        for (auto [token, count] : counts) {
+            out[token] -= static_cast<float>(count) * chain.frequency_penalty + chain.presence_penalty;
+        }
+    }
+    for (int32_t token : ReferenceBannedTokens(output, static_cast<size_t>(chain.no_repeat_ngram_size))) {
+        out[token] = std::numeric_limits<float>::lowest();
+    }
+    if (sequence.size() < static_cast<size_t>(search.min_length)) {
+        for (int32_t token : kEosTokenIds) {
+            out[token] = std::numeric_limits<float>::lowest();
+        }
+    }
+}
+
+bool RunChain(const Chain& chain, const std::vector<std::vector<float>>& logits, std::span<const int32_t> sequence,
+              int iterations, std::mt19937& engine) {
+    auto search = MakeSearch({"", 0.7f, 0, 0.9f});
+    search.repetition_penalty = chain.repetition_penalty;
+    search.min_length = chain.min_length;
+    search.no_repeat_ngram_size = chain.no_repeat_ngram_size;
+    Generators::TokenHistory history{chain.no_repeat_ngram_size};
+    history.Reset(sequence.subspan(0, kPromptLength));
+    for (int32_t token : sequence.subspan(kPromptLength)) {
+        history.Add(token);
+    }
+    const Generators::LogitsProcessorInputs inputs{&history, kEosTokenIds, {}, chain.frequency_penalty, chain.presence_penalty};
+
+    // The fused pass must give exactly the logits of the separate ones, and sampling after it their distribution
+    std::vector<float> processed, fused(kVocabSize), expected(kVocabSize), scratch;
+    size_t mismatches = 0;
+    for (const auto& row : logits) {
+        ReferenceProcessLogits(row, search, chain, sequence, processed);
+        Generators::ProcessLogits(row, search, inputs, fused);
+        mismatches += !std::equal(processed.begin(), processed.end(), fused.begin());
+    }
+    ReferenceProcessLogits(logits.front(), search, chain, sequence, processed);
+    ReferenceSamplingProbs(processed, search, expected);
+    auto check = CheckSamples(expected, [&] { return Generators::SampleToken(logits.front(), search, inputs, engine, scratch); });
+    const bool ok = mismatches == 0 && check.z_score < 5 &&
+                    (chain.no_repeat_ngram_size == 0 || !history.BannedTokens().empty());
+
+    size_t checksum = 0;
+    auto start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        ReferenceProcessLogits(logits[i % logits.size()], search, chain, sequence, processed);
+        ReferenceSamplingProbs(processed, search, expected);
+        checksum += Generators::SampleFromProbs(expected, engine);
+    }
+    double reference_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        checksum += Generators::SampleToken(logits[i % logits.size()], search, inputs, engine, scratch);
+    }
+    double fused_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    std::cout << "🔗 " << chain.name << "\n"
+              << "  " << (ok ? "✅ " : "❌ ") << mismatches << " rows processed differently, sampled chi-square "
+              << check.chi_square << " over " << check.bins << " bins (z " << check.z_score << ")\n"
+              << "  per token: separate passes " << reference_us << "us, fused " << fused_us << "us ("
+              << (reference_us / fused_us) << "x)  [checksum " << checksum % 1000 << "]\n";
+    return ok;
+}
+
+// Greedy search: the argmax is all the selection there is
+
+bool RunGreedy(std::vector<std::vector<float>> logits, int iterations) {
+    // Ties at the maximum, the first one must win
+    for (size_t r = 0; r < logits.size(); r += 4) {
+        auto& row = logits[r];
+        const float max = *std::max_element(row.begin(), row.end());
+        row[(r * 7919) % kVocabSize] = max;
+        row[(r * 104729) % kVocabSize] = max;
+    }
+
+    size_t mismatches = 0;
+    for (const auto& row : logits) {
+        mismatches += Generators::ArgMax(row) != std::max_element(row.begin(), row.end()) - row.begin();
+    }
+
+    size_t checksum = 0;
+    auto start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        const auto& row = logits[i % logits.size()];
+        checksum += std::max_element(row.begin(), row.end()) - row.begin();
+    }
+    double scalar_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        checksum += Generators::ArgMax(logits[i % logits.size()]);
+    }
+    double vector_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    // The one-hot row the generator hands the search per token: filled once, then only the hot entry moves
+    std::vector<float> one_hot(kVocabSize, std::numeric_limits<float>::lowest());
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        std::fill(one_hot.begin(), one_hot.end(), std::numeric_limits<float>::lowest());
+        one_hot[i % kVocabSize] = 0.0f;
+    }
+    double fill_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+    checksum += static_cast<size_t>(one_hot[0]);
+
+    const bool ok = mismatches == 0;
+    std::cout << "🎯 greedy\n"
+              << "  " << (ok ? "✅ " : "❌ ") << mismatches << " rows where ArgMax and std::max_element disagree\n"
+              << "  per token: std::max_element " << scalar_us << "us, ArgMax " << vector_us << "us ("
+              << (scalar_us / vector_us) << "x); one-hot refill avoided " << fill_us << "us  [checksum "
+              << checksum % 1000 << "]\n"
+              << "  at 20 tokens/s (a 50 ms decode step) ArgMax is " << (vector_us / 50000.0 * 100.0) << "% of a step\n";
+    return ok;
+}
+
+// Grammar masks (grammar_constraint.h): JSON output over a synthetic vocabulary
+
+// Single bytes, JSON punctuation runs and words with and without a leading space, like a BPE vocabulary
+Generators::TokenVocabulary MakeVocabulary(std::mt19937& engine) {
+    Generators::TokenVocabulary vocabulary;
+    vocabulary.texts.resize(kVocabSize);
+    for (size_t t = 32; t < 127; t++) {
+        vocabulary.texts[t] = std::string(1, static_cast<char>(t));
+    }
+    const char* punctuation[] = {"{\"", "\":", "\",", "\"}", "},", "}]", "]}", "}}", "],", "\": \"", "\", \"",
+                                 ": [", "[{", "null", "true", "false", "\n", "  ", "    ", "\n  ", "0.", "00", "e-"};
+    size_t next = 128;
+    for (const char* text : punctuation) {
+        vocabulary.texts[next++] = text;
+    }
+    std::uniform_int_distribution<int> letter('a', 'z'), length(2, 8);
+    for (; next < kVocabSize - 64; next++) {  // The last 64 ids are special tokens, no text
+        std::string word = next % 2 ? " " : "";
+        for (int i = length(engine); i > 0; i--) {
+            word += static_cast<char>(letter(engine));
+        }
+        vocabulary.texts[next] = word;
+    }
+    return vocabulary;
+}
+
+// Whether token is allowed by mask
+bool IsAllowed(std::span<const uint32_t> mask, int32_t token) {
+    return mask[token / 32] >> (token % 32) & 1;
+}
+
+bool IsEos(int32_t token) {
+    return std::find(std::begin(kEosTokenIds), std::end(kEosTokenIds), token) != std::end(kEosTokenIds);
+}
+
+bool RunGrammar(const std::vector<std::vector<float>>& logits, int iterations, std::mt19937& engine) {
+    auto vocabulary = std::make_shared<const Generators::TokenVocabulary>(MakeVocabulary(engine));
+    const auto& texts = vocabulary->texts;
+    const Generators::Config::Search search = MakeSearch({"", 1.0f, 0, 1.0f});
+    size_t mismatches = 0;
+
+    // A document written with the longest matching tokens: every token has to be allowed on the way, EOS only at the
+    // end, when the object is complete
+    const std::string document = "{\"name\": \"phi\", \"tags\": [\"a\", {\"b\": []}], \"n\": -1.5e3, \"ok\": true, \"x\": null}";
+    Generators::GrammarConstraint grammar{vocabulary, "json_object", kEosTokenIds};
+    size_t document_tokens = 0;
+    for (size_t offset = 0; offset < document.size(); document_tokens++) {
+        int32_t token = -1;
+        for (size_t t = 0; t < texts.size(); t++) {
+            if (!texts[t].empty() && document.compare(offset, texts[t].size(), texts[t]) == 0 &&
+                (token < 0 || texts[t].size() > texts[token].size())) {
+                token = static_cast<int32_t>(t);
+            }
+        }
+        auto allowed = grammar.AllowedTokens();
+        mismatches += !IsAllowed(allowed, token) || IsAllowed(allowed, kEosTokenIds[0]);
+        grammar.Advance(token);
+        offset += texts[token].size();
+    }
+    mismatches += !IsAllowed(grammar.AllowedTokens(), kEosTokenIds[0]);
+
+    // Greedy decoding of random logits through the mask: every token it picks has to be accepted, and the masked row
+    // must be the row with exactly the disallowed tokens set to lowest
+    Generators::GrammarConstraint walk{vocabulary, "json", kEosTokenIds};
+    std::vector<float> masked(kVocabSize);
+    size_t steps = 0;
+    for (; steps < 256; steps++) {
+        const auto& row = logits[steps % logits.size()];
+        const Generators::LogitsProcessorInputs inputs{nullptr, kEosTokenIds, walk.AllowedTokens(), 0.0f, 0.0f};
+        Generators::ProcessLogits(row, search, inputs, masked);
+        for (size_t t = 0; t < kVocabSize; t++) {
+            mismatches += masked[t] != (IsAllowed(inputs.allowed_tokens, static_cast<int32_t>(t)) ? row[t] : std::numeric_limits<float>::lowest());
+        }
+        const int32_t token = Generators::ArgMax(masked);
+        if (IsEos(token)) {
+            break;
+        }
+        try {
+            walk.Advance(token);
+        } catch (const std::exception&) {
+            mismatches++;
+            break;
+        }
+    }
+
+    // Per token: the mask of a state seen before, the first mask of a state, and the pipeline pass with and without
+    // the mask-and-fill, in a state that allows few tokens
+    size_t checksum = 0;
+    auto start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        checksum += walk.AllowedTokens()[i % 64];
+    }
+    double cached_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    const int uncached_iterations = std::max(1, iterations / 100);
+    start = OgaClock::now();
+    for (int i = 0; i < uncached_iterations; i++) {
+        Generators::GrammarConstraint fresh{vocabulary, "json", kEosTokenIds};
+        checksum += fresh.AllowedTokens()[i % 64];
+    }
+    double uncached_us = OgaMillisecondsSince(start) * 1000.0 / uncached_iterations;
+
+    Generators::GrammarConstraint object_start{vocabulary, "json_object", kEosTokenIds};
+    object_start.Advance('{');
+    const Generators::LogitsProcessorInputs mask_inputs{nullptr, kEosTokenIds, object_start.AllowedTokens(), 0.0f, 0.0f};
+    const Generators::LogitsProcessorInputs plain_inputs{nullptr, kEosTokenIds, {}, 0.0f, 0.0f};
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        checksum += static_cast<size_t>(Generators::ProcessLogits(logits[i % logits.size()], search, plain_inputs, masked));
+    }
+    double plain_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+    start = OgaClock::now();
+    for (int i = 0; i < iterations; i++) {
+        checksum += static_cast<size_t>(Generators::ProcessLogits(logits[i % logits.size()], search, mask_inputs, masked));
+    }
+    double mask_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+    const bool ok = mismatches == 0;
+    std::cout << "🧩 JSON grammar\n"
+              << "  " << (ok ? "✅ " : "❌ ") << mismatches << " mismatches over a " << document_tokens
+              << " token document and " << steps << " greedy tokens, " << grammar.CachedMaskCount() + walk.CachedMaskCount()
+              << " masks cached\n"
+              << "  per token: AllowedTokens cached " << cached_us << "us, uncached " << uncached_us << "us ("
+              << (uncached_us / cached_us) << "x); pipeline pass " << plain_us << "us, with the mask " << mask_us
+              << "us  [checksum " << checksum % 1000 << "]\n";
+    return ok;
+}
+
+// Token history (token_history.h): what the repetition controls need, kept up to date one token at a time
+
+void RunHistory(int iterations, std::mt19937& engine) {
+    constexpr int kNGramSize = 3;
+    std::uniform_int_distribution<int32_t> token(0, static_cast<int32_t>(kVocabSize) - 1);
+    std::cout << "📚 token history, everything generated, no_repeat_ngram_size " << kNGramSize << "\n";
+    for (size_t length : {512, 2048, 8192}) {
+        std::vector<int32_t> sequence(length + iterations);
+        for (auto& t : sequence) {
+            t = token(engine);
+        }
+
+        // What the processors did every step before: sort the sequence for repetition_penalty, count the output
+        // and scan it for the last n-gram
+        size_t checksum = 0;
+        const int steps = std::max(1, iterations / 10);
+        std::vector<int32_t> sorted;
+        auto start = OgaClock::now();
+        for (int i = 0; i < steps; i++) {
+            const std::span<const int32_t> so_far(sequence.data(), length + i);
+            sorted.assign(so_far.begin(), so_far.end());
+            std::sort(sorted.begin(), sorted.end());
+            sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+            std::unordered_map<int32_t, uint32_t> counts;
+            for (int32_t t : so_far) {
+                counts[t]++;
+            }
+            checksum += sorted.size() + counts.size() + ReferenceBannedTokens(so_far, kNGramSize).size();
+        }
+        double rebuild_us = OgaMillisecondsSince(start) * 1000.0 / steps;
+
+        Generators::TokenHistory history{kNGramSize};
+        history.Reset({});
+        for (size_t i = 0; i < length; i++) {
+            history.Add(sequence[i]);
+        }
+        start = OgaClock::now();
+        for (int i = 0; i < iterations; i++) {
+            history.Add(sequence[length + i]);
+            checksum += history.BannedTokens().size();
+        }
+        double add_us = OgaMillisecondsSince(start) * 1000.0 / iterations;
+
+        std::cout << "  " << length << " tokens: rebuilt per step " << rebuild_us << "us, TokenHistory::Add " << add_us
+                  << "us (" << (rebuild_us / add_us) << "x)  [checksum " << checksum % 1000 << "]\n";
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 2000;
+
+    std::mt19937 engine{1234};
+    auto logits = MakeLogits(64, engine);
+
+    const Setting settings[] = {
+        {"chat: temperature 0.7, top_p 0.9", 0.7f, 0, 0.9f},
+        {"top_k 50", 1.0f, 50, 1.0f},
+        {"top_k 50, top_p 0.9", 0.8f, 50, 0.9f},
+        {"temperature 1.0, no cut", 1.0f, 0, 1.0f},
+    };
+
+    bool ok = true;
+    for (const auto& setting : settings) {
+        std::cout << "🎲 " << setting.name << "\n";
+        ok = CheckEquivalence(setting, logits, engine) && ok;
+        RunTimings(setting, logits, iterations, engine);
+    }
+
+    // A 1500 token conversation so far, the last 500 tokens generated. The generated tokens come from a small set,
+    // the way a response keeps to its topic, and end with the start of an earlier 4-gram.
+    std::uniform_int_distribution<int32_t> token(0, static_cast<int32_t>(kVocabSize) - 1);
+    std::uniform_int_distribution<int32_t> topic(1000, 1200);
+    std::vector<int32_t> sequence(1500);
+    for (size_t i = 0; i < sequence.size(); i++) {
+        sequence[i] = i < kPromptLength ? token(engine) : topic(engine);
+    }
+    std::copy_n(sequence.begin() + kPromptLength + 100, 3, sequence.end() - 3);
+
+    const Chain chains[] = {
+        {"no processors", 1.0f, 0, 0.0f, 0.0f, 0},
+        {"repetition_penalty 1.1", 1.1f, 0, 0.0f, 0.0f, 0},
+        {"min_length (EOS masked)", 1.0f, 2000, 0.0f, 0.0f, 0},
+        {"repetition_penalty 1.1, min_length", 1.1f, 2000, 0.0f, 0.0f, 0},
+        {"frequency_penalty 0.3, presence_penalty 0.2", 1.0f, 0, 0.3f, 0.2f, 0},
+        {"no_repeat_ngram_size 4", 1.0f, 0, 0.0f, 0.0f, 4},
+        {"repetition_penalty 1.1, frequency and presence, no_repeat_ngram_size 4", 1.1f, 0, 0.3f, 0.2f, 4},
+    };
+    for (const auto& chain : chains) {
+        ok = RunChain(chain, logits, sequence, iterations, engine) && ok;
+    }
+    ok = RunGreedy(logits, iterations * 10) && ok;
+    ok = RunGrammar(logits, iterations * 10, engine) && ok;
+    RunHistory(iterations, engine);
+    return ok ? 0 : 1;
+}
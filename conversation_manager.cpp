@@ -0,0 +1,288 @@
+// conversation_manager.cpp - Multi-turn chat history packed into a token budget on one long-lived generator
+
+#include "conversation_manager.h"
+
+#include <algorithm>
+
+ConversationManager::ConversationManager(const OgaModel* model, const OgaTokenizer* tokenizer, ConversationOptions options)
+    : model_{model}, tokenizer_{tokenizer}, options_{std::move(options)} {
+    if (options_.response_tokens >= options_.context_tokens) {
+        throw std::runtime_error("ConversationManager: response_tokens must be smaller than context_tokens");
+    }
+
+    // Whatever the tokenizer adds to an empty string (BOS for SentencePiece models) is added once, in front
+    // of the whole conversation, and stripped from every turn
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr owned{sequences};
+    OgaThrowIfFailed(OgaTokenizerEncode(tokenizer_, "", sequences));
+    const int32_t* data = OgaSequencesGetSequenceData(sequences, 0);
+    prefix_tokens_.assign(data, data + OgaSequencesGetSequenceCount(sequences, 0));
+
+    assistant_header_tokens_ = EncodeFragment("<|assistant|>");
+    OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer_, "<|end|>", &end_token_id_));
+
+    Clear();
+}
+
+std::vector<int32_t> ConversationManager::EncodeFragment(const std::string& text) const {
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr owned{sequences};
+    OgaThrowIfFailed(OgaTokenizerEncode(tokenizer_, text.c_str(), sequences));
+    const int32_t* data = OgaSequencesGetSequenceData(sequences, 0);
+    std::vector<int32_t> tokens(data, data + OgaSequencesGetSequenceCount(sequences, 0));
+    if (tokens.size() >= prefix_tokens_.size() && std::equal(prefix_tokens_.begin(), prefix_tokens_.end(), tokens.begin())) {
+        tokens.erase(tokens.begin(), tokens.begin() + prefix_tokens_.size());
+    }
+    return tokens;
+}
+
+void ConversationManager::CreateGenerator() {
+    generator_.reset();
+    params_.reset();
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model_, &params));
+    params_.reset(params);
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(options_.context_tokens)));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "batch_size", 1.0));
+    OgaThrowIfFailed(OgaGeneratorParamsSetPrefillChunkSize(params, static_cast<int32_t>(options_.prefill_chunk_size)));
+    OgaThrowIfFailed(OgaGeneratorParamsAddStopSequence(params, &end_token_id_, 1));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", options_.do_sample));
+    if (options_.do_sample) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "temperature", options_.temperature));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "top_p", options_.top_p));
+    }
+    if (options_.frequency_penalty != 0.0) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "frequency_penalty", options_.frequency_penalty));
+    }
+    if (options_.presence_penalty != 0.0) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "presence_penalty", options_.presence_penalty));
+    }
+    if (options_.repetition_penalty != 1.0) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "repetition_penalty", options_.repetition_penalty));
+    }
+    if (options_.no_repeat_ngram_size > 0) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "no_repeat_ngram_size",
+                                                           static_cast<double>(options_.no_repeat_ngram_size)));
+    }
+
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model_, params, &generator));
+    generator_.reset(generator);
+}
+
+void ConversationManager::SyncCachedTokens() {
+    // Only the tokens added since the last sync are read, Repack cuts cached_ back to where it rewinds to
+    size_t cursor = cached_.size();
+    const int32_t* data = nullptr;
+    size_t count = 0;
+    OgaThrowIfFailed(OgaGenerator_GetSequenceSince(generator_.get(), 0, &cursor, &data, &count));
+    cached_.insert(cached_.end(), data, data + count);
+    stats_.cached_tokens = cached_.size();
+    stats_.packed_turns = packed_.size();
+    stats_.turns = turns_.size();
+}
+
+// Pinned turns first, then the most recent turns that fit, newest first, as one contiguous window.
+// The last two turns (the new user message and the open response) are always included, and the window never
+// starts with an assistant turn whose user message was evicted.
+std::vector<size_t> ConversationManager::SelectTurns(size_t budget) const {
+    std::vector<size_t> selected;
+    size_t used = prefix_tokens_.size();
+    for (size_t i = 0; i < turns_.size(); i++) {
+        if (turns_[i].pinned) {
+            selected.push_back(i);
+            used += turns_[i].tokens.size();
+        }
+    }
+
+    for (size_t i = turns_.size(); i-- > 0;) {
+        if (turns_[i].pinned) {
+            continue;
+        }
+        bool required = i + 2 >= turns_.size();
+        if (!required && used + turns_[i].tokens.size() > budget) {
+            break;
+        }
+        selected.push_back(i);
+        used += turns_[i].tokens.size();
+    }
+    if (selected.size() > 2 && !turns_[selected.back()].pinned && turns_[selected.back()].role == Role::Assistant &&
+        selected.back() + 2 < turns_.size()) {
+        selected.pop_back();
+    }
+
+    std::sort(selected.begin(), selected.end());
+    return selected;
+}
+
+void ConversationManager::Repack() {
+    const size_t full_budget = options_.context_tokens - options_.response_tokens;
+    auto packed_size = [this](const std::vector<size_t>& turns) {
+        size_t size = prefix_tokens_.size();
+        for (size_t index : turns) {
+            size += turns_[index].tokens.size();
+        }
+        return size;
+    };
+
+    // Evict down to the low-water mark so the next turns can append again. A conversation that never
+    // overflowed (first message, or after Clear) has nothing to evict and keeps the full budget.
+    std::vector<size_t> selected;
+    if (generator_) {
+        auto low_water = static_cast<size_t>(options_.context_tokens * options_.evict_to_fraction);
+        selected = SelectTurns(low_water > options_.response_tokens ? low_water - options_.response_tokens : 0);
+    }
+    if (!generator_ || packed_size(selected) > full_budget) {
+        selected = SelectTurns(full_budget);
+    }
+    if (packed_size(selected) > full_budget) {
+        throw std::runtime_error("ConversationManager: message does not fit in the context");
+    }
+
+    std::vector<int32_t> target = prefix_tokens_;
+    for (size_t index : selected) {
+        const auto& tokens = turns_[index].tokens;
+        target.insert(target.end(), tokens.begin(), tokens.end());
+    }
+
+    // Keep the longest cached prefix of the new packing, at least one token must be run to get logits
+    size_t common = 0;
+    if (generator_) {
+        auto mismatch = std::mismatch(cached_.begin(), cached_.end(), target.begin(), target.end());
+        common = std::min(static_cast<size_t>(mismatch.first - cached_.begin()), target.size() - 1);
+    }
+    if (common == 0) {
+        CreateGenerator();
+    } else {
+        OgaThrowIfFailed(OgaGenerator_RewindTo(generator_.get(), common));
+    }
+    const bool repacked = common > 0 || !cached_.empty();
+    cached_.resize(common);
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator_.get(), target.data() + common, target.size() - common));
+
+    if (repacked) {
+        stats_.repacks++;
+    }
+    packed_ = std::move(selected);
+    stats_.reused_tokens += common;
+    stats_.prefilled_tokens += target.size() - common;
+}
+
+void ConversationManager::BeginResponse(const std::string& user_message) {
+    if (responding_) {
+        EndResponse();
+    }
+
+    bool first_exchange = std::none_of(turns_.begin(), turns_.end(), [](const Turn& t) { return t.role == Role::User; });
+    bool pin = options_.pin_first_exchange && first_exchange;
+    turns_.push_back({Role::User, EncodeFragment("<|user|>\n" + user_message + " <|end|>\n"), pin});
+    turns_.push_back({Role::Assistant, assistant_header_tokens_, pin});
+
+    std::vector<int32_t> append = pending_;
+    for (size_t i = turns_.size() - 2; i < turns_.size(); i++) {
+        append.insert(append.end(), turns_[i].tokens.begin(), turns_[i].tokens.end());
+    }
+
+    try {
+        if (generator_ && cached_.size() + append.size() + options_.response_tokens <= options_.context_tokens) {
+            OgaThrowIfFailed(OgaGenerator_AppendTokens(generator_.get(), append.data(), append.size()));
+            packed_.push_back(turns_.size() - 2);
+            packed_.push_back(turns_.size() - 1);
+            stats_.appends++;
+            stats_.reused_tokens += cached_.size();
+            stats_.prefilled_tokens += append.size();
+        } else {
+            Repack();
+        }
+    } catch (...) {
+        // Drop the message and the KV cache, the next message re-prefills from the turns
+        turns_.resize(turns_.size() - 2);
+        generator_.reset();
+        params_.reset();
+        cached_.clear();
+        pending_.clear();
+        packed_.clear();
+        throw;
+    }
+
+    pending_.clear();
+    responding_ = true;
+    response_ended_with_end_token_ = false;
+    response_length_ = 0;
+    SyncCachedTokens();
+}
+
+bool ConversationManager::GenerateNextToken(int32_t& token) {
+    if (!responding_ || response_ended_with_end_token_ || response_length_ >= options_.response_tokens ||
+        OgaGenerator_IsDone(generator_.get())) {
+        return false;
+    }
+
+    OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator_.get()));
+    const int32_t* next_tokens = nullptr;
+    size_t count = 0;
+    OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator_.get(), &next_tokens, &count));
+    if (count == 0) {
+        return false;
+    }
+
+    int32_t next = next_tokens[count - 1];
+    turns_.back().tokens.push_back(next);
+    response_length_++;
+    if (next == end_token_id_) {
+        response_ended_with_end_token_ = true;
+        return false;
+    }
+    token = next;
+    return true;
+}
+
+void ConversationManager::EndResponse() {
+    if (!responding_) {
+        return;
+    }
+    responding_ = false;
+
+    // The closing tokens go into the turn now and into the KV cache with the next user message
+    pending_ = EncodeFragment(response_ended_with_end_token_ ? "\n" : "<|end|>\n");
+    auto& tokens = turns_.back().tokens;
+    tokens.insert(tokens.end(), pending_.begin(), pending_.end());
+    SyncCachedTokens();
+}
+
+bool ConversationManager::ContinueResponse() {
+    if (responding_) {
+        return true;
+    }
+    if (!generator_ || turns_.empty() || turns_.back().role != Role::Assistant || response_ended_with_end_token_) {
+        return false;
+    }
+
+    // The closing tokens were never appended, the generator still ends with the last response token
+    auto& tokens = turns_.back().tokens;
+    tokens.resize(tokens.size() - pending_.size());
+    pending_.clear();
+    responding_ = true;
+    response_length_ = 0;
+    return true;
+}
+
+void ConversationManager::Clear() {
+    generator_.reset();
+    params_.reset();
+    turns_.clear();
+    packed_.clear();
+    cached_.clear();
+    pending_.clear();
+    responding_ = false;
+    response_ended_with_end_token_ = false;
+    stats_ = {};
+
+    if (!options_.system_prompt.empty()) {
+        turns_.push_back({Role::System, EncodeFragment("<|system|>\n" + options_.system_prompt + "<|end|>\n"), true});
+    }
+    stats_.turns = turns_.size();
+}
@@ -0,0 +1,119 @@
+// conversation_manager.h - Multi-turn chat history packed into a token budget on one long-lived generator
+//
+// Every turn is kept as the exact token span the model saw (generated tokens are never re-tokenized), and the
+// generator's KV cache is kept between turns. A new turn is appended to the cached sequence whenever it fits.
+// Only when the budget overflows are old turns evicted, and then well below the budget, so the following turns
+// append again for a while instead of re-prefilling on every message. Pinned turns (the system prompt and,
+// optionally, the first exchange) form the start of every packing, so their KV stays valid across evictions.
+#ifndef CONVERSATION_MANAGER_H
+#define CONVERSATION_MANAGER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "oga_utils.h"
+
+struct ConversationOptions {
+    // Generator max_length: everything in the KV cache, history plus the response being generated
+    size_t context_tokens{4096};
+    // Room kept free for the response when packing; also the hard cap on response length
+    size_t response_tokens{512};
+    // On overflow, history is evicted until prompt + response fit in this fraction of context_tokens
+    double evict_to_fraction{0.5};
+    // Keep the first user/assistant exchange packed; it usually states the task
+    bool pin_first_exchange{false};
+    // Repacks prefill the whole history; in chunks of this many tokens the logits output stays at chunk size
+    // (0 prefills in one pass)
+    size_t prefill_chunk_size{256};
+
+    std::string system_prompt;
+
+    // Search options for the responses; greedy unless do_sample is set (temperature and top_p only apply then)
+    bool do_sample{false};
+    double temperature{0.7};
+    double top_p{0.9};
+    // Repetition control, applied in the logits pass that picks each token (0 / 1.0 turn a control off).
+    // frequency_penalty and presence_penalty count the tokens of the current response, repetition_penalty the
+    // whole sequence, and no_repeat_ngram_size bans repeating an n-gram of the response.
+    double frequency_penalty{0.0};
+    double presence_penalty{0.0};
+    double repetition_penalty{1.0};
+    int no_repeat_ngram_size{0};
+};
+
+struct ConversationStats {
+    size_t turns{};             // Turns in the conversation, including evicted ones
+    size_t packed_turns{};      // Turns currently in the KV cache
+    size_t cached_tokens{};     // Sequence length of the generator
+    size_t appends{};           // Turns added by appending to the cached sequence
+    size_t repacks{};           // Turns that needed an eviction
+    size_t reused_tokens{};     // Tokens kept from the KV cache across all turns
+    size_t prefilled_tokens{};  // Tokens run through the model as prompt across all turns
+};
+
+class ConversationManager {
+public:
+    // The model and tokenizer must outlive the manager
+    ConversationManager(const OgaModel* model, const OgaTokenizer* tokenizer, ConversationOptions options = {});
+
+    ConversationManager(const ConversationManager&) = delete;
+    ConversationManager& operator=(const ConversationManager&) = delete;
+
+    // Add a user turn and prefill whatever part of the packed history is not cached yet
+    void BeginResponse(const std::string& user_message);
+
+    // Generate one response token. Returns false once the response has ended (end token, response_tokens or
+    // the context is full); the end token itself is not returned.
+    bool GenerateNextToken(int32_t& token);
+
+    // Close the assistant turn. Called automatically by the next BeginResponse if needed.
+    void EndResponse();
+
+    // Reopen the last response to generate more of it, straight from the cached KV. Returns false when the
+    // model ended that response itself, there is nothing to continue then.
+    bool ContinueResponse();
+
+    // Forget the whole conversation and release the KV cache
+    void Clear();
+
+    const ConversationStats& GetStats() const { return stats_; }
+
+private:
+    enum class Role { System, User, Assistant };
+
+    struct Turn {
+        Role role;
+        std::vector<int32_t> tokens;  // Everything the turn contributes to the prompt, template tokens included
+        bool pinned{};
+    };
+
+    std::vector<int32_t> EncodeFragment(const std::string& text) const;
+    void CreateGenerator();
+    std::vector<size_t> SelectTurns(size_t budget) const;
+    void Repack();
+    void SyncCachedTokens();
+
+    const OgaModel* model_;
+    const OgaTokenizer* tokenizer_;
+    ConversationOptions options_;
+
+    std::vector<int32_t> prefix_tokens_;            // Tokens the tokenizer puts in front of every encoding (BOS)
+    std::vector<int32_t> assistant_header_tokens_;  // "<|assistant|>"
+    int32_t end_token_id_{-1};
+
+    OgaGeneratorParamsPtr params_;
+    OgaGeneratorPtr generator_;
+
+    std::vector<Turn> turns_;
+    std::vector<size_t> packed_;     // Indices into turns_, in the order they sit in the KV cache
+    std::vector<int32_t> cached_;    // The generator's sequence: prefix_tokens_ + packed turns (+ open response)
+    std::vector<int32_t> pending_;   // Closing tokens of the last response, not appended to the generator yet
+    bool responding_{};
+    bool response_ended_with_end_token_{};
+    size_t response_length_{};
+
+    ConversationStats stats_;
+};
+
+#endif // CONVERSATION_MANAGER_H
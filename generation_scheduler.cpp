@@ -0,0 +1,371 @@
+// generation_scheduler.cpp - Priority scheduler for generators sharing one loaded model
+
+#include "generation_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <tuple>
+
+struct GenerationScheduler::Job {
+    uint64_t id{};
+    GenerationRequest request;
+    GenerationResult result;
+    OgaClock::time_point submitted;
+
+    OgaGeneratorParamsPtr params;
+    OgaGeneratorPtr generator;  // Null before the first step and while spilled
+
+    bool started{};
+    bool finished{};
+    std::atomic<bool> cancel_requested{false};
+};
+
+const char* GenerationPriorityName(GenerationPriority priority) {
+    switch (priority) {
+        case GenerationPriority::Interactive:
+            return "interactive";
+        case GenerationPriority::Normal:
+            return "normal";
+        case GenerationPriority::Background:
+            return "background";
+    }
+    return "unknown";
+}
+
+GenerationScheduler::GenerationScheduler(const OgaModel* model, SchedulerOptions options)
+    : model_{model}, options_{options} {
+    worker_ = std::thread([this] { Run(); });
+}
+
+GenerationScheduler::~GenerationScheduler() {
+    Shutdown();
+}
+
+uint64_t GenerationScheduler::Submit(GenerationRequest request) {
+    if (request.prompt_tokens.empty()) {
+        throw std::runtime_error("GenerationScheduler: prompt is empty");
+    }
+
+    auto job = std::make_unique<Job>();
+    job->request = std::move(request);
+    job->result.priority = job->request.priority;
+    job->submitted = OgaClock::now();
+
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            throw std::runtime_error("GenerationScheduler: submit after shutdown");
+        }
+        id = next_id_++;
+        job->id = id;
+        job->result.id = id;
+        jobs_.push_back(std::move(job));
+        pending_++;
+    }
+    work_available_.notify_one();
+    return id;
+}
+
+void GenerationScheduler::Cancel(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& job : jobs_) {
+        if (job->id == id) {
+            job->cancel_requested = true;
+            break;
+        }
+    }
+}
+
+void GenerationScheduler::WaitIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void GenerationScheduler::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ && !worker_.joinable()) {
+            return;
+        }
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+    // Anything still queued never gets to run
+    std::vector<std::unique_ptr<Job>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remaining.swap(jobs_);
+        last_stepped_ = nullptr;
+    }
+    for (auto& job : remaining) {
+        job->result.cancelled = true;
+        Complete(std::move(job));
+    }
+}
+
+void GenerationScheduler::Run() {
+    while (true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_available_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            job = PickNextLocked();
+        }
+
+        if (job->cancel_requested) {
+            job->result.cancelled = true;
+            job->finished = true;
+        } else {
+            try {
+                Step(*job);
+            } catch (const std::exception& e) {
+                job->result.error = e.what();
+                job->finished = true;
+            }
+        }
+
+        if (job->finished) {
+            std::unique_ptr<Job> owned;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = std::find_if(jobs_.begin(), jobs_.end(), [job](const auto& p) { return p.get() == job; });
+                owned = std::move(*it);
+                jobs_.erase(it);
+                if (last_stepped_ == job) {
+                    last_stepped_ = nullptr;
+                }
+            }
+            Complete(std::move(owned));
+        }
+    }
+}
+
+GenerationScheduler::Job* GenerationScheduler::PickNextLocked() {
+    Job* next = nullptr;
+
+    if (!options_.preemptive && last_stepped_) {
+        // Run to completion: the legacy serial queue behaviour
+        next = last_stepped_;
+    } else {
+        for (auto& job : jobs_) {
+            if (!next) {
+                next = job.get();
+                continue;
+            }
+            if (!options_.preemptive) {
+                if (job->id < next->id) {
+                    next = job.get();
+                }
+                continue;
+            }
+            // Cancelled requests go first so they release their generator right away
+            auto key = [](const Job& j) {
+                return std::make_tuple(j.cancel_requested ? 0 : 1, static_cast<int>(j.request.priority), j.id);
+            };
+            if (key(*job) < key(*next)) {
+                next = job.get();
+            }
+        }
+    }
+
+    if (last_stepped_ && last_stepped_ != next) {
+        PauseLocked(*last_stepped_, next);
+    }
+    last_stepped_ = next;
+    return next;
+}
+
+void GenerationScheduler::PauseLocked(Job& job, const Job* next) {
+    job.result.preemptions++;
+
+    if (options_.pause_policy != PausePolicy::Spill) {
+        return;
+    }
+
+    // Spill the paused generators least likely to run soon: lowest priority, then most recently submitted.
+    // Sampling generators are never spilled, their random state can't be rebuilt by a re-prefill and the
+    // output would change. Guided and penalized ones neither, their grammar and token counts would start over at
+    // the replayed tokens.
+    while (true) {
+        std::vector<Job*> resident;
+        for (auto& other : jobs_) {
+            if (other->generator && other.get() != next) {
+                resident.push_back(other.get());
+            }
+        }
+        if (resident.size() <= options_.max_resident_paused) {
+            return;
+        }
+
+        Job* victim = nullptr;
+        for (Job* candidate : resident) {
+            if (candidate->request.do_sample || !candidate->request.guidance_type.empty() ||
+                candidate->request.frequency_penalty != 0.0 || candidate->request.presence_penalty != 0.0) {
+                continue;
+            }
+            if (!victim || candidate->request.priority > victim->request.priority ||
+                (candidate->request.priority == victim->request.priority && candidate->id > victim->id)) {
+                victim = candidate;
+            }
+        }
+        if (!victim) {
+            return;
+        }
+        victim->generator.reset();
+        victim->params.reset();
+        victim->result.spills++;
+    }
+}
+
+void GenerationScheduler::Prefill(Job& job) {
+    const auto& request = job.request;
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model_, &params));
+    job.params.reset(params);
+
+    const double max_length = static_cast<double>(request.prompt_tokens.size() + request.max_new_tokens);
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", max_length));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "batch_size", 1.0));
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchBool(params, "do_sample", request.do_sample));
+    if (request.do_sample) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "temperature", request.temperature));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "top_p", request.top_p));
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "top_k", request.top_k));
+    }
+    if (request.frequency_penalty != 0.0) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "frequency_penalty", request.frequency_penalty));
+    }
+    if (request.presence_penalty != 0.0) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "presence_penalty", request.presence_penalty));
+    }
+    if (!request.guidance_type.empty()) {
+        OgaThrowIfFailed(OgaGeneratorParamsSetGuidance(params, request.guidance_type.c_str(), ""));
+    }
+
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model_, params, &generator));
+    job.generator.reset(generator);
+
+    // After a spill the tokens generated so far are replayed with the prompt. The last generated token has
+    // not been through the model yet in either case, so the next GenerateNextToken continues identically.
+    std::vector<int32_t> sequence = request.prompt_tokens;
+    sequence.insert(sequence.end(), job.result.tokens.begin(), job.result.tokens.end());
+    OgaThrowIfFailed(OgaGenerator_AppendTokens(generator, sequence.data(), sequence.size()));
+}
+
+void GenerationScheduler::Step(Job& job) {
+    if (!job.started) {
+        job.started = true;
+        job.result.queue_ms = OgaMillisecondsSince(job.submitted);
+    }
+
+    if (!job.generator) {
+        Prefill(job);
+    }
+
+    OgaGenerator* generator = job.generator.get();
+    if (OgaGenerator_IsDone(generator)) {
+        job.finished = true;
+        return;
+    }
+
+    OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+
+    const int32_t* next_tokens = nullptr;
+    size_t next_token_count = 0;
+    OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &next_tokens, &next_token_count));
+    if (next_token_count == 0) {
+        throw std::runtime_error("GenerationScheduler: generator produced no token");
+    }
+
+    int32_t token = next_tokens[next_token_count - 1];
+    const auto& stop_token_ids = job.request.stop_token_ids;
+    if (std::find(stop_token_ids.begin(), stop_token_ids.end(), token) != stop_token_ids.end()) {
+        job.finished = true;
+        return;
+    }
+
+    job.result.tokens.push_back(token);
+    if (job.result.tokens.size() == 1) {
+        job.result.first_token_ms = OgaMillisecondsSince(job.submitted);
+    }
+
+    if (job.request.on_token && !job.request.on_token(token)) {
+        job.result.cancelled = true;
+        job.finished = true;
+        return;
+    }
+
+    if (OgaGenerator_IsDone(generator) ||
+        job.result.tokens.size() >= static_cast<size_t>(job.request.max_new_tokens)) {
+        job.finished = true;
+    }
+}
+
+void GenerationScheduler::Complete(std::unique_ptr<Job> job) {
+    // Release the KV cache before handing control to the callback
+    job->generator.reset();
+    job->params.reset();
+    job->result.total_ms = OgaMillisecondsSince(job->submitted);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto index = static_cast<size_t>(job->request.priority);
+        auto& stats = stats_[index];
+        stats.completed++;
+        stats.generated_tokens += job->result.tokens.size();
+        stats.preemptions += job->result.preemptions;
+        stats.spills += job->result.spills;
+        if (!job->result.tokens.empty()) {
+            first_token_samples_[index].push_back(job->result.first_token_ms);
+        }
+    }
+
+    if (job->request.on_complete) {
+        job->request.on_complete(job->result);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_--;
+    }
+    idle_.notify_all();
+}
+
+std::array<PriorityClassStats, kGenerationPriorityCount> GenerationScheduler::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto stats = stats_;
+    for (size_t i = 0; i < kGenerationPriorityCount; i++) {
+        auto samples = first_token_samples_[i];
+        if (samples.empty()) {
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (double sample : samples) {
+            total += sample;
+        }
+        stats[i].mean_first_token_ms = total / samples.size();
+        stats[i].p50_first_token_ms = samples[samples.size() / 2];
+        stats[i].p95_first_token_ms = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)];
+        stats[i].max_first_token_ms = samples.back();
+    }
+    return stats;
+}
+
+void GenerationScheduler::ResetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = {};
+    for (auto& samples : first_token_samples_) {
+        samples.clear();
+    }
+}
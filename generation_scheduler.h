@@ -0,0 +1,149 @@
+// generation_scheduler.h - Priority scheduler for generators sharing one loaded model
+//
+// All generation runs on a single inference thread, one decode step at a time. Before every step the
+// scheduler picks the highest priority runnable request, so an interactive request submitted while a
+// long background generation is running waits at most one decode step. The background generator is
+// paused between steps and resumed later exactly where it stopped.
+#ifndef GENERATION_SCHEDULER_H
+#define GENERATION_SCHEDULER_H
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "oga_utils.h"
+
+enum class GenerationPriority : int {
+    Interactive = 0,
+    Normal = 1,
+    Background = 2,
+};
+constexpr size_t kGenerationPriorityCount = 3;
+
+const char* GenerationPriorityName(GenerationPriority priority);
+
+// What happens to a paused generator's KV cache while higher priority work runs
+enum class PausePolicy {
+    KeepResident,  // Generator (and its KV cache) stays allocated; resume is free
+    Spill,         // Generators beyond max_resident_paused are destroyed and re-prefilled on resume
+};
+
+struct GenerationResult {
+    uint64_t id{};
+    GenerationPriority priority{GenerationPriority::Normal};
+    std::vector<int32_t> tokens;  // Generated tokens only, the prompt is not included
+    std::string error;            // Empty on success
+    bool cancelled{};
+    double queue_ms{};        // Submit until the request's first step started
+    double first_token_ms{};  // Submit until the first generated token
+    double total_ms{};        // Submit until completion
+    int preemptions{};        // Number of times a higher priority request ran in between our steps
+    int spills{};             // Number of times our KV cache was released while paused
+};
+
+struct GenerationRequest {
+    std::vector<int32_t> prompt_tokens;
+    GenerationPriority priority{GenerationPriority::Normal};
+    int max_new_tokens{256};
+
+    // Search options, applied through OgaGeneratorParamsSetSearch*
+    bool do_sample{false};
+    double temperature{1.0};
+    double top_p{1.0};
+    int top_k{50};
+    // Lower the logits of tokens already generated, by count and once (OpenAI semantics). 0 leaves them alone.
+    double frequency_penalty{0.0};
+    double presence_penalty{0.0};
+
+    // Guidance type, applied through OgaGeneratorParamsSetGuidance when not empty ("json_object" holds the output
+    // to a JSON object)
+    std::string guidance_type;
+
+    // Tokens that end the request, in addition to the model's EOS. The stop token itself is not reported.
+    std::vector<int32_t> stop_token_ids;
+
+    // Called on the inference thread for every generated token. Return false to cancel the request.
+    std::function<bool(int32_t token)> on_token;
+    // Called on the inference thread exactly once, when the request completes, fails or is cancelled.
+    std::function<void(const GenerationResult& result)> on_complete;
+};
+
+struct SchedulerOptions {
+    // When false the scheduler runs requests to completion in submission order, like the old serial queue.
+    // Kept so the effect of preemption can be measured against the same code path.
+    bool preemptive{true};
+    PausePolicy pause_policy{PausePolicy::KeepResident};
+    // With PausePolicy::Spill, the number of paused generators allowed to keep their KV cache resident.
+    size_t max_resident_paused{1};
+};
+
+struct PriorityClassStats {
+    size_t completed{};
+    double mean_first_token_ms{};
+    double p50_first_token_ms{};
+    double p95_first_token_ms{};
+    double max_first_token_ms{};
+    size_t generated_tokens{};
+    size_t preemptions{};
+    size_t spills{};
+};
+
+class GenerationScheduler {
+public:
+    // The model must outlive the scheduler
+    GenerationScheduler(const OgaModel* model, SchedulerOptions options = {});
+    ~GenerationScheduler();
+
+    GenerationScheduler(const GenerationScheduler&) = delete;
+    GenerationScheduler& operator=(const GenerationScheduler&) = delete;
+
+    // Queue a request, returns its id. Safe to call from any thread.
+    uint64_t Submit(GenerationRequest request);
+
+    // Cancel a queued or running request. It completes with cancelled=true before its next step.
+    void Cancel(uint64_t id);
+
+    // Block until every submitted request has completed
+    void WaitIdle();
+
+    // Stop the inference thread. Outstanding requests are completed as cancelled.
+    void Shutdown();
+
+    std::array<PriorityClassStats, kGenerationPriorityCount> GetStats() const;
+    void ResetStats();
+
+private:
+    struct Job;
+
+    void Run();
+    Job* PickNextLocked();
+    void PauseLocked(Job& job, const Job* next);
+    void Step(Job& job);
+    void Prefill(Job& job);
+    void Complete(std::unique_ptr<Job> job);
+
+    const OgaModel* model_;
+    SchedulerOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable idle_;
+    std::vector<std::unique_ptr<Job>> jobs_;
+    Job* last_stepped_{};
+    size_t pending_{};  // Submitted requests whose on_complete has not returned yet
+    uint64_t next_id_{1};
+    bool stopping_{};
+
+    std::array<std::vector<double>, kGenerationPriorityCount> first_token_samples_;
+    std::array<PriorityClassStats, kGenerationPriorityCount> stats_{};
+
+    std::thread worker_;
+};
+
+#endif // GENERATION_SCHEDULER_H
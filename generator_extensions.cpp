@@ -0,0 +1,516 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include "generator_extensions.h"
+#include "token_vocabulary.h"
+#include "lookahead_decoding.h"
+#include "sampling_cpu.h"
+#include "search.h"
+#include "models/model.h"
+
+namespace Generators {
+
+ExtendedGenerator::ExtendedGenerator(const Model& model, const ExtendedGeneratorParams& params)
+    : Generator{model, params},
+      params_{std::static_pointer_cast<const ExtendedGeneratorParams>(params.shared_from_this())} {
+  // Beam search reorders the sequences every step, they aren't only appended to
+  if (params.search.num_beams == 1)
+    sequence_mirrors_.resize(static_cast<size_t>(params.search.batch_size));
+  Configure();
+}
+
+ExtendedGenerator::~ExtendedGenerator() = default;
+
+void ExtendedGenerator::Configure() {
+  const Model& model = *model_;
+  const ExtendedGeneratorParams& params = *params_;
+  prefill_chunk_size_ = params.search.batch_size == 1 ? static_cast<size_t>(std::max(params.prefill_chunk_size, 0)) : 0;
+  num_completions_ = std::max(params.num_completions, 1);
+  frequency_penalty_ = params.frequency_penalty;
+  presence_penalty_ = params.presence_penalty;
+  decoder_.reset();
+  stop_matcher_.reset();
+  history_.reset();
+
+  if (num_completions_ > 1 && (params.search.batch_size != 1 || params.search.num_beams != 1))
+    throw std::runtime_error("num_completions requires batch_size 1 and num_beams 1");
+
+  if (!params.stop_sequences.empty()) {
+    if (params.search.batch_size != 1 || params.search.num_beams != 1)
+      throw std::runtime_error("Stop sequences require batch_size 1 and num_beams 1");
+    stop_matcher_ = std::make_unique<StopSequenceMatcher>(params.stop_sequences);
+  }
+
+  if (params.guidance_type.empty()) {
+    grammar_.reset();
+  } else if (!grammar_ || params.guidance_type != guidance_type_) {
+    // There is no guidance library in this build, GrammarConstraint is all there is. Only the decoders below apply its
+    // mask, the search would ignore it.
+    if (!IsNativeGuidanceType(params.guidance_type))
+      throw std::runtime_error("Guidance type '" + params.guidance_type + "' is not supported, use json or json_object");
+    if (const char* blocker = GetMultiTokenDecodingBlocker(model, params, true))
+      throw std::runtime_error(std::string{"Guidance: "} + blocker);
+    grammar_ = std::make_unique<GrammarConstraint>(GetTokenVocabulary(model), params.guidance_type,
+                                                   model.config_->model.eos_token_id);
+  }
+  guidance_type_ = params.guidance_type;
+
+  if ((params.draft_model != nullptr) + (params.prompt_lookup_ngram_size > 0) + (params.lookahead_window_size > 0) > 1)
+    throw std::runtime_error("Only one of draft model, prompt lookup and lookahead decoding can be used at a time");
+
+  if (params.draft_model) {
+    decoder_ = std::make_unique<SpeculativeDecoder>(*this, std::make_unique<DraftModelProposer>(params.draft_model, params),
+                                                    params.num_draft_tokens);
+  } else if (params.prompt_lookup_ngram_size > 0) {
+    decoder_ = std::make_unique<SpeculativeDecoder>(*this, std::make_unique<PromptLookupProposer>(params.prompt_lookup_ngram_size),
+                                                    params.num_draft_tokens);
+  } else if (params.lookahead_window_size > 0) {
+    decoder_ = std::make_unique<LookaheadDecoder>(*this, params.lookahead_window_size, params.lookahead_ngram_size);
+  } else if (NeedsTokenSelection(params) && !GetMultiTokenDecodingBlocker(model, params, true)) {
+    // Standard decoding, with the vectorized token selection and the logits pipeline instead of the search's
+    if (IsGreedySearch(params.search))
+      decoder_ = std::make_unique<GreedyDecoder>(*this);
+    else
+      decoder_ = std::make_unique<SamplingDecoder>(*this);
+    history_ = std::make_unique<TokenHistory>(params.search.no_repeat_ngram_size);
+  }
+
+  if (!history_ && (frequency_penalty_ != 0.0f || presence_penalty_ != 0.0f))
+    throw std::runtime_error("frequency_penalty and presence_penalty need standard decoding with batch_size 1 and num_beams 1 on CPU");
+}
+
+bool ExtendedGenerator::NeedsTokenSelection(const ExtendedGeneratorParams& params) const {
+  // Otherwise Generator::GenerateNextToken decodes, as upstream. The search keeps the params it was created with, so
+  // params from Reset need the decoders too, and so does sampling after Reset: the search would go on with the random
+  // stream of the previous requests instead of starting over from random_seed.
+  return params.cpu_token_selection || params.frequency_penalty != 0.0f || params.presence_penalty != 0.0f ||
+         params.search.no_repeat_ngram_size > 0 || !params.guidance_type.empty() ||
+         search_->params_.get() != static_cast<const GeneratorParams*>(&params) ||
+         (was_reset_ && !IsGreedySearch(params.search));
+}
+
+void ExtendedGenerator::Reset(const ExtendedGeneratorParams* params) {
+  const auto& search = state_->params_->search;  // What the state, the search and their buffers were created for
+  if (search.batch_size != 1)
+    throw std::runtime_error("Reset requires batch_size 1");
+  if (params && params != params_.get()) {
+    if (&params->config != model_->config_.get())
+      throw std::runtime_error("Reset needs params created for the generator's model");
+    if (params->search.batch_size != search.batch_size || params->search.num_beams != search.num_beams ||
+        params->search.max_length != search.max_length)
+      throw std::runtime_error("Reset can't change batch_size, num_beams or max_length, the buffers it keeps are sized for them");
+    if (GetMultiTokenDecodingBlocker(*model_, *params, true))
+      throw std::runtime_error("Reset can only change the params of generators decoding on CPU with num_beams 1, the search reads the ones it was created with");
+  }
+
+  // A new decoder seeds its sampling again, like a new generator would. Params that don't work leave the old ones.
+  was_reset_ = true;
+  auto previous = params_;
+  if (params)
+    params_ = std::static_pointer_cast<const ExtendedGeneratorParams>(params->shared_from_this());
+  try {
+    Configure();
+  } catch (...) {
+    params_ = std::move(previous);
+    Configure();
+    throw;
+  }
+
+  RewindToLength(0);
+  prompt_length_ = 0;
+  completion_index_ = 0;
+  output_start_ = 0;
+  last_step_tokens_.clear();
+  stats_ = {};
+  logits_callback_ = nullptr;
+}
+
+void ExtendedGenerator::AppendTokens(cpu_span<const int32_t> input_ids) {
+  // A new prompt, the completions start over from it
+  bulk_tokens_.clear();
+  bulk_text_.clear();
+  prompt_length_ = 0;
+  completion_index_ = 0;
+  stopped_ = false;
+
+  const size_t chunk_size = prefill_chunk_size_ > 0 ? prefill_chunk_size_ : input_ids.size();
+  size_t offset = 0;
+  do {
+    auto chunk = input_ids.subspan(offset, std::min(chunk_size, input_ids.size() - offset));
+    if (token_pending_)
+      RunTokens(chunk);
+    else
+      Generator::AppendTokens(chunk);
+    MirrorTokens(chunk);
+    offset += chunk.size();
+  } while (offset < input_ids.size());
+
+  output_start_ = static_cast<size_t>(search_->GetSequenceLength());
+  if (history_)
+    history_->Reset(GetSequence(0).CopyDeviceToCpu());
+  if (grammar_)
+    grammar_->Reset();
+}
+
+void ExtendedGenerator::GenerateNextToken() {
+  auto start = std::chrono::steady_clock::now();
+  last_step_tokens_.clear();
+  const size_t first_new = static_cast<size_t>(search_->GetSequenceLength());
+
+  if (num_completions_ > 1 && prompt_length_ == 0 && computed_logits_) {
+    // Sampling processes the search's logits in place, keep the raw ones for the next completions
+    auto logits = search_->GetLogits().CopyDeviceToCpu();
+    prompt_logits_.assign(logits.begin(), logits.end());
+    prompt_length_ = search_->GetSequenceLength();
+  }
+
+  if (!decoder_) {
+    if (logits_callback_)
+      RunLogitsCallback();
+    Generator::GenerateNextToken();
+    auto next_tokens = search_->GetNextTokens().CopyDeviceToCpu();
+    last_step_tokens_.assign(next_tokens.begin(), next_tokens.end());
+    stats_.target_runs++;
+  } else {
+    ThrowErrorIfSessionTerminated(state_->session_terminated_);
+    if (!computed_logits_ && !token_pending_) {
+      // Rewound without new tokens: run the last token again to get its logits, like Generator does
+      if (search_->GetSequenceLength() == 0)
+        throw std::runtime_error("GenerateNextToken called with no prior state. Please call AppendTokens before calling GenerateNextToken.");
+      token_pending_ = true;
+      pending_in_cache_ = true;
+    }
+    if (logits_callback_)
+      RunLogitsCallback();
+    decoder_->Step(last_step_tokens_, stats_);
+  }
+  if (stop_matcher_)
+    MatchStopSequences(first_new);
+  MirrorTokens(last_step_tokens_);
+
+  stats_.steps++;
+  stats_.generated_tokens += last_step_tokens_.size();
+  stats_.decode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ExtendedGenerator::RewindToLength(size_t new_length) {
+  if (token_pending_ && new_length == static_cast<size_t>(search_->GetSequenceLength()))
+    return;
+  if (new_length < prompt_length_) {
+    prompt_length_ = 0;
+    completion_index_ = 0;
+  }
+  if (token_pending_ && new_length + 1 == static_cast<size_t>(search_->GetSequenceLength()))
+    RewindPendingToken();
+  else
+    Generator::RewindToLength(new_length);
+  for (auto& mirror : sequence_mirrors_)
+    mirror.resize(std::min(mirror.size(), new_length));
+  bulk_tokens_.clear();
+  bulk_text_.clear();
+  token_pending_ = false;
+  pending_in_cache_ = false;
+  stopped_ = false;
+  ReplayOutput();
+}
+
+std::span<const int32_t> ExtendedGenerator::GetSequenceSince(size_t index, size_t start) const {
+  if (sequence_mirrors_.empty())
+    throw std::runtime_error("Reading a sequence incrementally requires num_beams 1, read the whole sequence instead");
+  if (index >= sequence_mirrors_.size())
+    throw std::runtime_error("Sequence index " + std::to_string(index) + " is out of range");
+  std::span<const int32_t> sequence = sequence_mirrors_[index];
+  if (start > sequence.size())
+    throw std::runtime_error("Position " + std::to_string(start) + " is past the end of the sequence, which has " +
+                             std::to_string(sequence.size()) + " tokens after being rewound");
+  return sequence.subspan(start);
+}
+
+void ExtendedGenerator::MirrorTokens(std::span<const int32_t> tokens) {
+  // Every change to the sequences goes through AppendTokens, GenerateNextToken and RewindToLength. The decoders take
+  // the pending token out and run it again, which leaves the sequence as it was.
+  if (sequence_mirrors_.empty())
+    return;
+  const size_t count = tokens.size() / sequence_mirrors_.size();
+  for (size_t i = 0; i < sequence_mirrors_.size(); i++) {
+    auto sequence_tokens = tokens.subspan(i * count, count);
+    sequence_mirrors_[i].insert(sequence_mirrors_[i].end(), sequence_tokens.begin(), sequence_tokens.end());
+  }
+}
+
+DeviceSpan<float> ExtendedGenerator::GetLogits() {
+  // Generator would run the pending token without taking it out of the sequence first
+  if (token_pending_ && !computed_logits_)
+    RunTokens({});
+  return Generator::GetLogits();
+}
+
+void ExtendedGenerator::SetLogitsCallback(LogitsCallback callback) {
+  if (callback && decoder_ && !decoder_->ProcessesLogits())
+    throw std::runtime_error("Logits callbacks can't be used with speculative, prompt lookup or lookahead decoding");
+  logits_callback_ = std::move(callback);
+}
+
+void ExtendedGenerator::RunLogitsCallback() {
+  // Compute the logits ahead of the step, which then reads them from the search instead of running the model itself
+  if (decoder_ && !computed_logits_)
+    stats_.target_runs++;
+  auto logits = GetLogits();
+  auto cpu_logits = logits.CopyDeviceToCpu();
+  const size_t vocab_size = static_cast<size_t>(model_->config_->model.vocab_size);
+  logits_callback_(cpu_logits, vocab_size);
+  logits.CopyCpuToDevice();
+}
+
+ExtendedGenerator::BulkResult ExtendedGenerator::GenerateTokens(std::span<int32_t> tokens, TokenizerStream* stream,
+                                                                std::span<char> text) {
+  if (state_->params_->search.batch_size != 1 || state_->params_->search.num_beams != 1)
+    throw std::runtime_error("GenerateTokens requires batch_size 1 and num_beams 1");
+
+  // Every call has to be able to hand out at least one character, or text waiting for room would stall generation
+  if (stream && text.size() < kMinBulkTextCapacity)
+    throw std::runtime_error("GenerateTokens needs room for " + std::to_string(kMinBulkTextCapacity) +
+                             " bytes of text, a UTF-8 character and the terminator");
+
+  BulkResult result{};
+  auto flush = [&] {
+    for (; result.token_count < tokens.size() && !bulk_tokens_.empty(); bulk_tokens_.pop_front())
+      tokens[result.token_count++] = bulk_tokens_.front();
+    if (text.empty() || bulk_text_.empty())
+      return;
+    const size_t room = std::min(bulk_text_.size(), text.size() - 1 - result.text_length);
+    size_t length = room;
+    while (length > 0 && length < bulk_text_.size() && (static_cast<uint8_t>(bulk_text_[length]) & 0xC0) == 0x80)
+      length--;  // Back to the start of the character
+    if (length == 0 && result.text_length == 0)
+      length = room;  // No character start to back off to, the text isn't UTF-8. Hand it out as it is.
+    std::copy_n(bulk_text_.begin(), length, text.begin() + result.text_length);
+    bulk_text_.erase(0, length);
+    result.text_length += length;
+  };
+
+  // Whatever is kept has to be handed out before a step, a rewind inside it would drop it
+  flush();
+  while (result.token_count < tokens.size() && bulk_tokens_.empty() && bulk_text_.empty() && !IsDone()) {
+    GenerateNextToken();
+    for (int32_t token : last_step_tokens_) {
+      bulk_tokens_.push_back(token);
+      if (stream)
+        bulk_text_ += stream->Decode(token);
+    }
+    flush();
+  }
+
+  if (!text.empty())
+    text[result.text_length] = '\0';
+  result.done = IsDone() && bulk_tokens_.empty() && bulk_text_.empty();
+  return result;
+}
+
+TensorView ExtendedGenerator::GetLogitsView() {
+  // CopyDeviceToCpu hands out the logits themselves on CPU
+  auto logits = GetLogits().CopyDeviceToCpu();
+  const int64_t vocab_size = model_->config_->model.vocab_size;
+  logits_view_shape_ = {static_cast<int64_t>(logits.size()) / vocab_size, 1, vocab_size};
+  return {logits.data(), Ort::TypeToTensorType<float>, logits_view_shape_, logits.size()};
+}
+
+TensorView ExtendedGenerator::GetOutputView(const char* name) {
+  OrtValue* output = state_->GetOutput(name);
+  if (!output)
+    throw std::runtime_error(std::string{"Model has no output named "} + name);
+  if (output->GetTensorMemoryInfo().GetDeviceType() != OrtMemoryInfoDeviceType_CPU)
+    throw std::runtime_error(std::string{"Output "} + name + " is not in CPU memory, it can only be copied");
+
+  auto type_info = output->GetTensorTypeAndShapeInfo();
+  output_view_shape_ = type_info->GetShape();
+  return {output->GetTensorRawData(), type_info->GetElementType(), output_view_shape_, type_info->GetElementCount()};
+}
+
+void ExtendedGenerator::SetLogits(DeviceSpan<float> logits) {
+  // The logits replace the ones of the pending token, which still has to reach the KV cache
+  if (token_pending_ && !computed_logits_)
+    RunTokens({});
+  Generator::SetLogits(logits);
+}
+
+void ExtendedGenerator::SetLogits(std::span<const float> logits) {
+  DeviceSpan<float> current = search_->GetLogits();
+  if (current.size() == 0) {
+    current = model_->p_device_inputs_->Allocate<float>(logits.size());
+    SetLogits(current);
+  } else {
+    // Computes them if needed, running a decoder's pending token. The copy then goes where the step reads: the
+    // search's logits, which the decoders take instead of the model's output once computed_logits_ is set.
+    current = GetLogits();
+    if (logits.size() != current.size())
+      throw std::runtime_error("Generator::SetLogits passed an array of size " + std::to_string(logits.size()) +
+                               " but should be size " + std::to_string(current.size()));
+  }
+  auto cpu_logits = current.CpuSpan();
+  std::copy(logits.begin(), logits.end(), cpu_logits.begin());
+  current.CopyCpuToDevice();
+  computed_logits_ = true;
+  // The search may hold the commit row, which isn't one-hot anymore
+  one_hot_token_ = -1;
+}
+
+void ExtendedGenerator::RunTokens(cpu_span<const int32_t> tokens) {
+  if (!token_pending_) {
+    Generator::AppendTokens(tokens);
+    return;
+  }
+
+  // Take the pending token back out of the sequence and run it in front of the new ones
+  const size_t length = search_->GetSequenceLength();
+  run_tokens_.assign(1, GetSequence(0).CopyDeviceToCpu()[length - 1]);
+  run_tokens_.insert(run_tokens_.end(), tokens.begin(), tokens.end());
+
+  RewindPendingToken();
+  Generator::AppendTokens(run_tokens_);
+}
+
+void ExtendedGenerator::RewindPendingToken() {
+  const size_t length = static_cast<size_t>(search_->GetSequenceLength()) - 1;
+  if (pending_in_cache_) {
+    Generator::RewindToLength(length);
+  } else {
+    // The KV cache is already that long, rewinding it would throw. Only the search has the token.
+    search_->RewindTo(length);
+    computed_logits_ = false;
+  }
+  token_pending_ = false;
+  pending_in_cache_ = false;
+}
+
+std::span<const float> ExtendedGenerator::GetRunLogits(std::array<int64_t, 3>& shape) {
+  OrtValue* logits = state_->GetOutput(model_->config_->model.decoder.outputs.logits.c_str());
+  if (!logits)
+    throw std::runtime_error("Model has no logits output: " + model_->config_->model.decoder.outputs.logits);
+
+  auto type_info = logits->GetTensorTypeAndShapeInfo();
+  auto logits_shape = type_info->GetShape();
+  if (logits_shape.size() != 3)
+    throw std::runtime_error("Expected logits of shape [batch_size, sequence_length, vocab_size]");
+  std::copy(logits_shape.begin(), logits_shape.end(), shape.begin());
+
+  if (type_info->GetElementType() != Ort::TypeToTensorType<float>) {
+    Cast(*logits, logits_fp32_, *GetDeviceInterface(DeviceType::CPU), Ort::TypeToTensorType<float>);
+    logits = logits_fp32_.get();
+  }
+  return {logits->GetTensorData<float>(), static_cast<size_t>(shape[0] * shape[1] * shape[2])};
+}
+
+std::span<const float> ExtendedGenerator::GetRunLogits(size_t count) {
+  std::array<int64_t, 3> shape;
+  auto logits = GetRunLogits(shape);
+  if (shape[1] < static_cast<int64_t>(count))
+    throw std::runtime_error("Multi-token decoding needs the logits of the last " + std::to_string(count) +
+                             " positions, but the model's logits output does not have them");
+
+  const size_t vocab_size = static_cast<size_t>(shape[2]);
+  return logits.subspan((static_cast<size_t>(shape[1]) - count) * vocab_size, count * vocab_size);
+}
+
+void ExtendedGenerator::CommitToken(int32_t token) {
+  // Hand the search a one-hot row and let it select the token, so it tracks EOS and max_length as usual. The search
+  // only reads the row, so after the first fill moving the hot entry is enough.
+  auto logits = CommitLogits();
+  if (one_hot_token_ < 0)
+    std::fill(logits.begin(), logits.end(), std::numeric_limits<float>::lowest());
+  else
+    logits[one_hot_token_] = std::numeric_limits<float>::lowest();
+  logits[token] = 0.0f;
+  one_hot_token_ = token;
+  if (history_)
+    history_->Add(token);
+  if (grammar_)
+    grammar_->Advance(token);
+  commit_logits_.CopyCpuToDevice();
+
+  search_->SetLogits(commit_logits_);
+  search_->SelectTop();
+  computed_logits_ = false;
+  token_pending_ = true;
+  pending_in_cache_ = false;
+}
+
+bool ExtendedGenerator::StartNextCompletion() {
+  if (prompt_length_ == 0)
+    throw std::runtime_error("StartNextCompletion needs num_completions > 1 and a first completion started with GenerateNextToken");
+  if (completion_index_ + 1 >= num_completions_)
+    return false;
+
+  RewindToLength(prompt_length_);
+
+  // The prompt's logits are still valid for the KV cache it rewound to, no forward pass needed
+  auto logits = CommitLogits();
+  std::copy(prompt_logits_.begin(), prompt_logits_.end(), logits.begin());
+  one_hot_token_ = -1;
+  commit_logits_.CopyCpuToDevice();
+  search_->SetLogits(commit_logits_);
+  computed_logits_ = true;
+
+  completion_index_++;
+  return true;
+}
+
+void ExtendedGenerator::MatchStopSequences(size_t first_new) {
+  // The automaton's state only depends on the last MaxLength tokens, so start a few tokens back instead of keeping a
+  // state that every rewind would have to repair
+  auto sequence = GetSequence(0).CopyDeviceToCpu();
+  StopSequenceMatcher::State state = StopSequenceMatcher::kStart;
+  for (size_t i = first_new - std::min(first_new, stop_matcher_->MaxLength() - 1); i < sequence.size(); i++) {
+    state = stop_matcher_->Next(state, sequence[i]);
+    if (i < first_new || !stop_matcher_->Matches(state))
+      continue;
+
+    // A multi-token step can run past the stop, those tokens are dropped
+    if (const size_t extra = sequence.size() - 1 - i; extra > 0) {
+      RewindToLength(i + 1);
+      last_step_tokens_.resize(last_step_tokens_.size() - extra);
+    }
+    stopped_ = true;
+    return;
+  }
+}
+
+LogitsProcessorInputs ExtendedGenerator::GetProcessorInputs() {
+  LogitsProcessorInputs inputs;
+  inputs.history = history_.get();
+  inputs.eos_token_ids = model_->config_->model.eos_token_id;
+  if (grammar_)
+    inputs.allowed_tokens = grammar_->AllowedTokens();
+  inputs.frequency_penalty = frequency_penalty_;
+  inputs.presence_penalty = presence_penalty_;
+  return inputs;
+}
+
+void ExtendedGenerator::ReplayOutput() {
+  if (!history_ && !grammar_)
+    return;
+  auto sequence = GetSequence(0).CopyDeviceToCpu();
+  output_start_ = std::min(output_start_, sequence.size());
+  if (history_)
+    history_->Reset(sequence.subspan(0, output_start_));
+  if (grammar_)
+    grammar_->Reset();
+  for (size_t i = output_start_; i < sequence.size(); i++) {
+    if (history_)
+      history_->Add(sequence[i]);
+    if (grammar_)
+      grammar_->Advance(sequence[i]);
+  }
+}
+
+std::span<float> ExtendedGenerator::CommitLogits() {
+  if (commit_logits_.empty())
+    commit_logits_ = model_->p_device_inputs_->Allocate<float>(model_->config_->model.vocab_size);
+  return commit_logits_.CpuSpan();
+}
+
+}  // namespace Generators
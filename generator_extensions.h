@@ -0,0 +1,232 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Generator and GeneratorParams as handed out by the C API. They add the decoding modes that produce more than one
+// token per GenerateNextToken call on top of the upstream Generator, which stays untouched.
+//
+// Multi-token steps leave the last token of the sequence "pending": it is in the sequence but not in the KV cache
+// yet, exactly like a token from Generator::GenerateNextToken. The next step runs it together with the tokens it
+// verifies, so every step is a single State::Run.
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "generators.h"
+#include "grammar_constraint.h"
+#include "logits_pipeline_cpu.h"
+#include "speculative_decoding.h"
+#include "stop_sequences.h"
+#include "token_history.h"
+
+namespace Generators {
+
+struct TokenizerStream;
+
+struct ExtendedGeneratorParams : GeneratorParams {
+  ExtendedGeneratorParams(const Model& model) : GeneratorParams{model} {}
+
+  // Speculative decoding: a smaller model with the same vocabulary proposes num_draft_tokens tokens per step
+  std::shared_ptr<const Model> draft_model;
+  int num_draft_tokens{4};
+
+  // Prompt lookup decoding: drafts are copied from earlier in the sequence after matching its last n-gram, up to
+  // this size. 0 disables it. Uses num_draft_tokens as well.
+  int prompt_lookup_ngram_size{};
+
+  // Lookahead decoding (greedy only): guesses for the next window_size positions are refined with every forward pass
+  // and n-grams of ngram_size are collected from them. 0 disables it.
+  int lookahead_window_size{};
+  int lookahead_ngram_size{};
+
+  // Completions generated from one prompt, see ExtendedGenerator::StartNextCompletion
+  int num_completions{1};
+
+  // Appended tokens run in chunks of at most this many (batch_size 1), so the logits output covers one chunk instead
+  // of the whole prompt: 512 MB less fp32 logits at 4k prompt tokens and a 32k vocabulary. Only the last position's
+  // logits are used after a prefill. 0 runs every append as one chunk.
+  int prefill_chunk_size{};
+
+  // Token sequences that end generation once generated (batch_size 1), a single token for a stop token. The sequence
+  // keeps the stop sequence, like an EOS token, and IsDone is true from the step that completed it.
+  std::vector<std::vector<int32_t>> stop_sequences;
+
+  // OpenAI-style penalties on generated tokens (batch_size 1, CPU), see FrequencyPenalty in logits_pipeline_cpu.h.
+  // repetition_penalty and no_repeat_ngram_size are search options. Set through OgaGeneratorParamsSetSearchNumber.
+  float frequency_penalty{};
+  float presence_penalty{};
+
+  // Standard decoding (batch_size 1, num_beams 1, CPU) chooses tokens with the vectorized argmax and top-k/top-p
+  // sampling of sampling_cpu.h instead of the search. Penalties, no_repeat_ngram_size and guidance always do, other
+  // generators use Generator::GenerateNextToken unless this is set. Set through OgaGeneratorParamsSetSearchBool.
+  bool cpu_token_selection{};
+
+  // guidance_type "json" and "json_object" (batch_size 1, CPU) are handled here, by GrammarConstraint, and hold
+  // everything generated after the last AppendTokens to JSON. Other guidance types are an error.
+};
+
+// A tensor of the generator read where it is, see ExtendedGenerator::GetLogitsView
+struct TensorView {
+  const void* data{};
+  ONNXTensorElementDataType type{};
+  std::span<const int64_t> shape;
+  size_t element_count{};
+};
+
+// Edits the logits of the next token in place: rows of vocab_size floats, one per sequence (batch_size * num_beams)
+using LogitsCallback = std::function<void(std::span<float> logits, size_t vocab_size)>;
+
+struct ExtendedGenerator : Generator {
+  ExtendedGenerator(const Model& model, const ExtendedGeneratorParams& params);
+  ~ExtendedGenerator();
+
+  // Back to the state of a new generator, empty, but with the state, KV cache, search and their buffers kept instead of
+  // created again (batch_size 1). params (null keeps the current ones) replace the generator's params: sampling,
+  // penalties, stop sequences, guidance and the decoding mode can change, batch_size, num_beams and max_length can't.
+  // Only generators decoding on CPU with num_beams 1 take new params.
+  void Reset(const ExtendedGeneratorParams* params);
+  // The params decoding follows, the ones of the constructor or of the last Reset
+  const ExtendedGeneratorParams& GetParams() const { return *params_; }
+
+  // These hide the Generator versions so a pending token is always run before anything else
+  void AppendTokens(cpu_span<const int32_t> input_ids);
+  void GenerateNextToken();
+  void RewindToLength(size_t new_length);
+  DeviceSpan<float> GetLogits();
+  void SetLogits(DeviceSpan<float> logits);
+  // Replace the logits the next token is chosen from with a copy of logits, for the search and the decoders alike
+  void SetLogits(std::span<const float> logits);
+  // Generator::IsDone, or a stop sequence was generated
+  bool IsDone() const { return stopped_ || Generator::IsDone(); }
+
+  // The tokens the last GenerateNextToken call added to the sequence (batch_size 1), or the next token of every
+  // sequence for standard decoding
+  std::span<const int32_t> GetLastStepTokens() const { return last_step_tokens_; }
+  const DecodingStats& GetDecodingStats() const { return stats_; }
+
+  // Sequence index from position start to its end (num_beams 1), read from a CPU copy of the sequences that is
+  // appended to as tokens are added, so polling the new tokens costs nothing for the ones already read. Valid until
+  // the next call that changes the generator. Throws when start is past the end, as after a rewind.
+  std::span<const int32_t> GetSequenceSince(size_t index, size_t start) const;
+
+  // Borrowed, read-only views, valid until the next call that changes the generator. Nothing is allocated or copied
+  // on CPU: the logits of the next token as [batch_size, 1, vocab_size] (other devices copy them into the host side
+  // of the logits' DeviceSpan), and a named output of the last forward pass, which has to be in CPU memory.
+  TensorView GetLogitsView();
+  TensorView GetOutputView(const char* name);
+
+  // Bulk generation (batch_size 1, num_beams 1): GenerateNextToken until IsDone or tokens is full, with the new tokens
+  // decoded by stream (when not null) into text as a null-terminated string. Tokens a multi-token step made past the
+  // end of tokens, and text that didn't fit, are kept for the next call, which returns them first. Stops early when
+  // text is full, never splits a UTF-8 character. Appending tokens or rewinding drops what is kept. With a stream, text
+  // has to hold at least kMinBulkTextCapacity bytes.
+  static constexpr size_t kMinBulkTextCapacity = 5;
+  struct BulkResult {
+    size_t token_count;
+    size_t text_length;
+    bool done;  // IsDone and nothing kept
+  };
+  BulkResult GenerateTokens(std::span<int32_t> tokens, TokenizerStream* stream, std::span<char> text);
+
+  // Called by every GenerateNextToken between the forward pass and choosing the token, before the search's and the
+  // logits pipeline's own processing. Null removes it. Not with the decoders that take several tokens per step.
+  void SetLogitsCallback(LogitsCallback callback);
+
+  // Building blocks for the multi-token decoders
+
+  // Run the pending token (if any) followed by tokens in one forward pass. Leaves every token in the KV cache.
+  void RunTokens(cpu_span<const int32_t> tokens);
+  // Float logits of every position of the last forward pass, shape is [batch_size, sequence_length, vocab_size]
+  std::span<const float> GetRunLogits(std::array<int64_t, 3>& shape);
+  // Float logits of the last count positions of the last forward pass, count rows of vocab_size
+  std::span<const float> GetRunLogits(size_t count);
+  // Append token to the sequence without running it, the way GenerateNextToken does. Marks it pending.
+  void CommitToken(int32_t token);
+  // What the logits processors need to choose the next token: the token history, the penalties and the grammar's
+  // mask of the tokens allowed next
+  LogitsProcessorInputs GetProcessorInputs();
+
+  bool IsTokenPending() const { return token_pending_; }
+
+  // Held by every C API call that changes or reads the generator and by an AsyncGeneration, so a generator used from
+  // two threads at once fails the second one instead of being corrupted. TryClaim returns false while it is held.
+  bool TryClaim() const { return !claimed_.exchange(true, std::memory_order_acquire); }
+  void Release() const { claimed_.store(false, std::memory_order_release); }
+
+  // n completions: once a completion is finished, rewind to the end of the prompt and start the next one from the
+  // prompt's KV cache and logits, which are kept from the first completion. The prompt is prefilled once for all of
+  // them and each completion samples on its own. Decoding them as one batch is not implemented (the KV cache and
+  // RewindToLength here are batch size 1): they decode one after another. Returns false when all num_completions
+  // have been started.
+  bool StartNextCompletion();
+  int GetCompletionIndex() const { return completion_index_; }
+
+ private:
+  // Set up decoding for params_: the decoder, stop sequences, guidance and penalties
+  void Configure();
+  // Whether standard decoding with params has to choose tokens itself instead of leaving it to the search
+  bool NeedsTokenSelection(const ExtendedGeneratorParams& params) const;
+  // Reset has run. The search's random engine can't be seeded again, so sampling moves to a SamplingDecoder.
+  bool was_reset_{};
+  std::shared_ptr<const ExtendedGeneratorParams> params_;
+  std::unique_ptr<MultiTokenDecoder> decoder_;  // Null when the search decodes on its own
+  bool token_pending_{};
+  // The pending token is also in the KV cache, which happens when GenerateNextToken runs the last token again after a
+  // rewind. A committed token isn't, the KV cache is one shorter than the sequence.
+  bool pending_in_cache_{};
+  // Take the pending token out of the sequence, and out of the KV cache if it is there
+  void RewindPendingToken();
+  mutable std::atomic<bool> claimed_{};
+
+  // Look for a stop sequence ending at or after position first_new, dropping the tokens after it
+  void MatchStopSequences(size_t first_new);
+  std::unique_ptr<StopSequenceMatcher> stop_matcher_;  // Null without stop sequences
+  bool stopped_{};
+
+  // Rebuild the history and the grammar's state from the sequence after a rewind
+  void ReplayOutput();
+  size_t output_start_{};                        // Sequence length after the last AppendTokens
+  std::unique_ptr<TokenHistory> history_;        // Null unless a decoder runs the logits processors
+  std::unique_ptr<GrammarConstraint> grammar_;  // Null without native guidance
+  std::string guidance_type_;                   // grammar_'s, it is kept with its cached masks while this doesn't change
+
+  // Vocabulary row handed to the search by CommitToken and StartNextCompletion
+  std::span<float> CommitLogits();
+  DeviceSpan<float> commit_logits_;
+  int32_t one_hot_token_{-1};  // The token commit_logits_ is one-hot on, -1 when it holds other logits
+  std::vector<int32_t> run_tokens_;
+  std::unique_ptr<OrtValue> logits_fp32_;
+
+  std::vector<int32_t> last_step_tokens_;
+  DecodingStats stats_;
+
+  // Append tokens, the same number for every sequence and one sequence after the other, to sequence_mirrors_
+  void MirrorTokens(std::span<const int32_t> tokens);
+  std::vector<std::vector<int32_t>> sequence_mirrors_;  // One per sequence, none with num_beams > 1
+
+  std::deque<int32_t> bulk_tokens_;  // Generated but not returned by GenerateTokens yet
+  std::string bulk_text_;
+
+  // Compute the next token's logits and hand them to logits_callback_
+  void RunLogitsCallback();
+  LogitsCallback logits_callback_;
+
+  std::array<int64_t, 3> logits_view_shape_{};
+  std::vector<int64_t> output_view_shape_;
+
+  size_t prefill_chunk_size_;
+
+  int num_completions_;
+  float frequency_penalty_;
+  float presence_penalty_;
+  int completion_index_{};
+  size_t prompt_length_{};            // Sequence length at the first token of the first completion, 0 before
+  std::vector<float> prompt_logits_;  // Logits of the last prompt token, before any processing
+};
+
+}  // namespace Generators
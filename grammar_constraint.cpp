@@ -0,0 +1,352 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "grammar_constraint.h"
+
+namespace Generators {
+
+namespace {
+
+using Mode = JsonAutomaton::Mode;
+using State = JsonAutomaton::State;
+using Step = JsonAutomaton::Step;
+
+// Caps a whitespace run, so the model can't pad the output forever
+constexpr uint8_t kMaxWhitespace = 32;
+
+constexpr std::string_view kLiterals[] = {"true", "false", "null"};
+
+// The parts of a number, Number mode's sub
+enum NumberPart : uint8_t {
+  kMinus,
+  kZero,  // A leading 0, no more integer digits
+  kInt,
+  kDot,
+  kFrac,
+  kExp,
+  kExpSign,
+  kExpDigits,
+};
+
+bool IsDigit(uint8_t byte) { return byte >= '0' && byte <= '9'; }
+
+bool IsHexDigit(uint8_t byte) {
+  return IsDigit(byte) || (byte >= 'a' && byte <= 'f') || (byte >= 'A' && byte <= 'F');
+}
+
+bool IsWhitespace(uint8_t byte) { return byte == ' ' || byte == '\t' || byte == '\n' || byte == '\r'; }
+
+// Whether the number so far can end here
+bool NumberCanEnd(uint8_t part) { return part == kZero || part == kInt || part == kFrac || part == kExpDigits; }
+
+void EndValue(State& state) {
+  state.mode = state.stack.empty() && !state.hidden ? Mode::Done : Mode::AfterValue;
+}
+
+Step StartValue(State& state, uint8_t byte) {
+  switch (byte) {
+    case '"':
+      state.mode = Mode::String;
+      state.key = false;
+      return Step::Accept;
+    case '{':
+      state.stack.push_back('{');
+      state.mode = Mode::ObjectStart;
+      return Step::Accept;
+    case '[':
+      state.stack.push_back('[');
+      state.mode = Mode::ArrayStart;
+      return Step::Accept;
+    case '-':
+      state.mode = Mode::Number;
+      state.sub = kMinus;
+      return Step::Accept;
+  }
+  if (IsDigit(byte)) {
+    state.mode = Mode::Number;
+    state.sub = byte == '0' ? kZero : kInt;
+    return Step::Accept;
+  }
+  for (uint8_t literal = 0; literal < std::size(kLiterals); literal++) {
+    if (byte == kLiterals[literal][0]) {
+      state.mode = Mode::Literal;
+      state.literal = literal;
+      state.sub = 1;
+      return Step::Accept;
+    }
+  }
+  return Step::Reject;
+}
+
+Step CloseContainer(State& state) {
+  state.stack.pop_back();
+  EndValue(state);
+  return Step::Accept;
+}
+
+// The key of the mask cache: everything about state a token's acceptance depends on, but only the top of the stack
+uint64_t MaskKey(const State& state) {
+  const uint64_t top = state.stack.empty() ? 0 : static_cast<uint8_t>(state.stack.back());
+  const uint64_t depth = std::min<size_t>(state.stack.size(), 2);
+  return static_cast<uint64_t>(state.mode) | static_cast<uint64_t>(state.sub) << 8 |
+         static_cast<uint64_t>(state.literal) << 16 | static_cast<uint64_t>(state.key) << 24 |
+         static_cast<uint64_t>(state.whitespace) << 32 | top << 40 | depth << 48;
+}
+
+}  // namespace
+
+bool IsNativeGuidanceType(std::string_view type) {
+  return type == "json" || type == "json_object";
+}
+
+JsonAutomaton::Step JsonAutomaton::Next(State& state, uint8_t byte) {
+  switch (state.mode) {
+    case Mode::ObjectOnly:
+    case Mode::Value:
+    case Mode::ArrayStart:
+    case Mode::ObjectStart:
+    case Mode::Key:
+    case Mode::Colon:
+    case Mode::AfterValue:
+      if (IsWhitespace(byte)) {
+        if (state.whitespace == kMaxWhitespace)
+          return Step::Reject;
+        state.whitespace++;
+        return Step::Accept;
+      }
+      state.whitespace = 0;
+      break;
+    default:
+      break;
+  }
+
+  switch (state.mode) {
+    case Mode::ObjectOnly:
+      if (byte != '{')
+        return Step::Reject;
+      return StartValue(state, byte);
+
+    case Mode::Value:
+      return StartValue(state, byte);
+
+    case Mode::ArrayStart:
+      if (byte == ']')
+        return CloseContainer(state);
+      return StartValue(state, byte);
+
+    case Mode::ObjectStart:
+      if (byte == '}')
+        return CloseContainer(state);
+      [[fallthrough]];
+    case Mode::Key:
+      if (byte != '"')
+        return Step::Reject;
+      state.mode = Mode::String;
+      state.key = true;
+      return Step::Accept;
+
+    case Mode::Colon:
+      if (byte != ':')
+        return Step::Reject;
+      state.mode = Mode::Value;
+      return Step::Accept;
+
+    case Mode::AfterValue: {
+      if (state.stack.empty())
+        return state.hidden ? Step::Unknown : Step::Reject;
+      const char top = state.stack.back();
+      if (byte == ',') {
+        state.mode = top == '{' ? Mode::Key : Mode::Value;
+        return Step::Accept;
+      }
+      if ((byte == '}' && top == '{') || (byte == ']' && top == '['))
+        return CloseContainer(state);
+      return Step::Reject;
+    }
+
+    case Mode::String:
+      if (byte == '"') {
+        if (state.key)
+          state.mode = Mode::Colon;
+        else
+          EndValue(state);
+        state.key = false;
+        return Step::Accept;
+      }
+      if (byte == '\\') {
+        state.mode = Mode::Escape;
+        return Step::Accept;
+      }
+      return byte >= 0x20 ? Step::Accept : Step::Reject;
+
+    case Mode::Escape:
+      if (byte == 'u') {
+        state.mode = Mode::Unicode;
+        state.sub = 4;
+        return Step::Accept;
+      }
+      if (std::string_view{"\"\\/bfnrt"}.find(static_cast<char>(byte)) == std::string_view::npos)
+        return Step::Reject;
+      state.mode = Mode::String;
+      return Step::Accept;
+
+    case Mode::Unicode:
+      if (!IsHexDigit(byte))
+        return Step::Reject;
+      if (--state.sub == 0)
+        state.mode = Mode::String;
+      return Step::Accept;
+
+    case Mode::Number:
+      switch (state.sub) {
+        case kMinus:
+          if (!IsDigit(byte))
+            return Step::Reject;
+          state.sub = byte == '0' ? kZero : kInt;
+          return Step::Accept;
+        case kDot:
+          if (!IsDigit(byte))
+            return Step::Reject;
+          state.sub = kFrac;
+          return Step::Accept;
+        case kExp:
+          if (byte == '+' || byte == '-') {
+            state.sub = kExpSign;
+            return Step::Accept;
+          }
+          [[fallthrough]];
+        case kExpSign:
+          if (!IsDigit(byte))
+            return Step::Reject;
+          state.sub = kExpDigits;
+          return Step::Accept;
+      }
+      if (IsDigit(byte) && state.sub != kZero)
+        return Step::Accept;  // kInt, kFrac and kExpDigits take more digits
+      if (byte == '.' && (state.sub == kZero || state.sub == kInt)) {
+        state.sub = kDot;
+        return Step::Accept;
+      }
+      if ((byte == 'e' || byte == 'E') && state.sub != kExpDigits) {
+        state.sub = kExp;
+        return Step::Accept;
+      }
+      // Anything else ends the number and belongs to what follows it
+      state.sub = 0;
+      EndValue(state);
+      return Next(state, byte);
+
+    case Mode::Literal: {
+      const std::string_view literal = kLiterals[state.literal];
+      if (byte != static_cast<uint8_t>(literal[state.sub]))
+        return Step::Reject;
+      if (++state.sub == literal.size()) {
+        state.sub = 0;
+        state.literal = 0;
+        EndValue(state);
+      }
+      return Step::Accept;
+    }
+
+    case Mode::Done:
+      return Step::Reject;
+  }
+  return Step::Reject;
+}
+
+JsonAutomaton::Step JsonAutomaton::Next(State& state, std::string_view text) {
+  for (char byte : text) {
+    if (Step step = Next(state, static_cast<uint8_t>(byte)); step != Step::Accept)
+      return step;
+  }
+  return Step::Accept;
+}
+
+bool JsonAutomaton::IsComplete(const State& state) {
+  if (state.mode == Mode::Done)
+    return true;
+  // A number at the root only ends with the output
+  return state.mode == Mode::Number && state.stack.empty() && !state.hidden && NumberCanEnd(state.sub);
+}
+
+GrammarConstraint::GrammarConstraint(std::shared_ptr<const TokenVocabulary> vocabulary, std::string_view type,
+                                     std::span<const int32_t> eos_token_ids)
+    : vocabulary_{std::move(vocabulary)},
+      eos_token_ids_(eos_token_ids.begin(), eos_token_ids.end()),
+      object_only_{type == "json_object"},
+      state_{JsonAutomaton::Start(object_only_)} {
+  if (!IsNativeGuidanceType(type))
+    throw std::runtime_error("Guidance type '" + std::string{type} + "' is not supported, use json or json_object");
+}
+
+const GrammarConstraint::Mask& GrammarConstraint::GetMask() {
+  auto [entry, added] = masks_.try_emplace(MaskKey(state_));
+  Mask& mask = entry->second;
+  if (!added)
+    return mask;
+
+  // Run every token from the state cut down to what the key holds: the top of the stack, and whether there is more
+  State base = state_;
+  if (base.stack.size() > 1) {
+    base.stack.erase(0, base.stack.size() - 1);
+    base.hidden = true;
+  }
+
+  const auto& texts = vocabulary_->texts;
+  mask.bits.assign((texts.size() + 31) / 32, 0);
+  for (size_t token = 0; token < texts.size(); token++) {
+    if (texts[token].empty())
+      continue;
+    State state = base;
+    switch (JsonAutomaton::Next(state, texts[token])) {
+      case Step::Accept:
+        mask.bits[token / 32] |= 1u << (token % 32);
+        break;
+      case Step::Unknown:
+        mask.uncertain.push_back(static_cast<int32_t>(token));
+        break;
+      case Step::Reject:
+        break;
+    }
+  }
+  return mask;
+}
+
+std::span<const uint32_t> GrammarConstraint::AllowedTokens() {
+  const Mask& mask = GetMask();
+  allowed_.assign(mask.bits.begin(), mask.bits.end());
+
+  for (int32_t token : mask.uncertain) {
+    State state = state_;
+    if (JsonAutomaton::Next(state, vocabulary_->texts[token]) == Step::Accept)
+      allowed_[token / 32] |= 1u << (token % 32);
+  }
+
+  if (IsComplete()) {
+    for (int32_t token : eos_token_ids_) {
+      if (token >= 0 && static_cast<size_t>(token) < vocabulary_->texts.size())
+        allowed_[token / 32] |= 1u << (token % 32);
+    }
+  }
+  return allowed_;
+}
+
+void GrammarConstraint::Advance(int32_t token) {
+  if (std::find(eos_token_ids_.begin(), eos_token_ids_.end(), token) != eos_token_ids_.end())
+    return;
+  const auto& texts = vocabulary_->texts;
+  State state = state_;
+  if (token < 0 || static_cast<size_t>(token) >= texts.size() || texts[token].empty() ||
+      JsonAutomaton::Next(state, texts[token]) != Step::Accept)
+    throw std::runtime_error("Token " + std::to_string(token) + " does not match the guidance grammar");
+  state_ = std::move(state);
+}
+
+void GrammarConstraint::Reset() {
+  state_ = JsonAutomaton::Start(object_only_);
+}
+
+}  // namespace Generators
@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Structured output without the guidance library: before every token is chosen, the logits of the tokens the grammar
+// can't accept next are masked (TokenMask in logits_pipeline_cpu.h), so the output always parses.
+//
+// Grammars are byte-level pushdown automata run over the tokens' text. Whether a token is accepted only depends on the
+// automaton's state and the top of its stack, except for tokens that close more containers than that and keep going,
+// so the mask of a state is computed over the whole vocabulary once and reused whenever generation gets back to it. The
+// few tokens that depend on the rest of the stack are kept with the mask and checked against the real stack. After
+// the first few tokens of an output, a step costs a copy of a cached mask (vocab_size / 8 bytes) and the mask-and-fill.
+//
+// guidance_type "json" holds the output to a JSON value, "json_object" to a JSON object. guidance_data isn't used.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "token_vocabulary.h"
+
+namespace Generators {
+
+// Whether guidance_type is one GrammarConstraint handles
+bool IsNativeGuidanceType(std::string_view type);
+
+// JSON (RFC 8259), one byte at a time
+struct JsonAutomaton {
+  enum class Mode : uint8_t {
+    ObjectOnly,   // Before the root of json_object
+    Value,        // Before a value
+    ArrayStart,   // After '[', a value or ']'
+    ObjectStart,  // After '{', a key or '}'
+    Key,          // After ',' in an object
+    Colon,
+    AfterValue,   // ',' or the closing bracket
+    String,
+    Escape,       // After '\' in a string
+    Unicode,      // In the hex digits of \u
+    Number,
+    Literal,      // true, false or null
+    Done,
+  };
+
+  struct State {
+    Mode mode{};
+    uint8_t sub{};         // Number: the part being read. Literal: bytes matched. Unicode: hex digits left.
+    uint8_t literal{};     // Literal: which one
+    bool key{};            // String: an object key
+    uint8_t whitespace{};  // Whitespace bytes in a row
+    bool hidden{};         // There are containers under stack that aren't known (mask computation only)
+    std::string stack;     // '{' or '[' for every open container, innermost last
+  };
+
+  enum class Step : uint8_t {
+    Accept,
+    Reject,
+    Unknown,  // Needs a container under stack. Never returned without hidden.
+  };
+
+  static State Start(bool object_only) {
+    return {object_only ? Mode::ObjectOnly : Mode::Value, 0, 0, false, 0, false, std::string{}};
+  }
+
+  // Advance state by byte. state is undefined after anything but Accept.
+  static Step Next(State& state, uint8_t byte);
+  static Step Next(State& state, std::string_view text);
+
+  // Whether the bytes so far are a whole value
+  static bool IsComplete(const State& state);
+};
+
+struct GrammarConstraint {
+  GrammarConstraint(std::shared_ptr<const TokenVocabulary> vocabulary, std::string_view type,
+                    std::span<const int32_t> eos_token_ids);
+
+  // The tokens the grammar accepts next as a bitmask over the vocabulary, bit t % 32 of word t / 32. EOS is in it once
+  // the output is complete. Valid until the next call.
+  std::span<const uint32_t> AllowedTokens();
+
+  // Follow token, which has to be allowed. EOS tokens are ignored.
+  void Advance(int32_t token);
+  // Back to the start of the output
+  void Reset();
+  bool IsComplete() const { return JsonAutomaton::IsComplete(state_); }
+
+  // Masks computed so far, one per automaton state seen
+  size_t CachedMaskCount() const { return masks_.size(); }
+
+ private:
+  struct Mask {
+    std::vector<uint32_t> bits;      // Tokens accepted whatever is under the top of the stack
+    std::vector<int32_t> uncertain;  // Tokens that depend on it
+  };
+
+  const Mask& GetMask();
+
+  std::shared_ptr<const TokenVocabulary> vocabulary_;
+  std::vector<int32_t> eos_token_ids_;
+  bool object_only_;
+  JsonAutomaton::State state_;
+
+  std::unordered_map<uint64_t, Mask> masks_;  // By the part of the state a mask depends on
+  std::vector<uint32_t> allowed_;
+};
+
+}  // namespace Generators
@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <cassert>
+#include <optional>
+
+#include "logits_pipeline_cpu.h"
+
+namespace Generators {
+
+namespace {
+
+bool UsesRepetitionPenalty(const Config::Search& search, const LogitsProcessorInputs& inputs) {
+  return search.repetition_penalty != 1.0f && inputs.history && inputs.history->Length() > 0;
+}
+
+bool UsesFrequencyPenalty(const LogitsProcessorInputs& inputs) {
+  return (inputs.frequency_penalty != 0.0f || inputs.presence_penalty != 0.0f) && inputs.history &&
+         !inputs.history->OutputTokens().empty();
+}
+
+bool UsesNoRepeatNGram(const Config::Search& search, const LogitsProcessorInputs& inputs) {
+  return search.no_repeat_ngram_size > 0 && inputs.history && !inputs.history->BannedTokens().empty();
+}
+
+bool UsesEosBlock(const Config::Search& search, const LogitsProcessorInputs& inputs) {
+  const size_t length = inputs.history ? inputs.history->Length() : 0;
+  return search.min_length > 0 && length < static_cast<size_t>(search.min_length) && !inputs.eos_token_ids.empty();
+}
+
+// Calls run with the processors that are set, in order. Every combination is an instantiation of its own, so the
+// pipeline doesn't check per tile which processors run.
+template <typename Run>
+float WithProcessors(const Run& run) {
+  return run();
+}
+
+template <typename Run, typename Processor, typename... Rest>
+float WithProcessors(const Run& run, const std::optional<Processor>& processor, const std::optional<Rest>&... rest) {
+  if (!processor)
+    return WithProcessors(run, rest...);
+  return WithProcessors([&](const auto&... chosen) { return run(*processor, chosen...); }, rest...);
+}
+
+}  // namespace
+
+bool HasLogitsProcessors(const Config::Search& search, const LogitsProcessorInputs& inputs) {
+  return UsesRepetitionPenalty(search, inputs) || UsesFrequencyPenalty(inputs) || UsesNoRepeatNGram(search, inputs) ||
+         UsesEosBlock(search, inputs) || !inputs.allowed_tokens.empty();
+}
+
+float ProcessLogits(std::span<const float> logits, const Config::Search& search, const LogitsProcessorInputs& inputs,
+                    std::span<float> out) {
+  assert(out.size() == logits.size());
+  assert(inputs.allowed_tokens.empty() || inputs.allowed_tokens.size() * 32 >= logits.size());
+  std::optional<RepetitionPenalty> penalty;
+  if (UsesRepetitionPenalty(search, inputs))
+    penalty.emplace(inputs.history->SequenceTokens(), search.repetition_penalty);
+  std::optional<FrequencyPenalty> frequency_penalty;
+  if (UsesFrequencyPenalty(inputs))
+    frequency_penalty.emplace(*inputs.history, inputs.frequency_penalty, inputs.presence_penalty);
+  std::optional<BlockTokens> ngram_block;
+  if (UsesNoRepeatNGram(search, inputs))
+    ngram_block.emplace(inputs.history->BannedTokens());
+  std::optional<BlockTokens> eos_block;
+  if (UsesEosBlock(search, inputs))
+    eos_block.emplace(inputs.eos_token_ids);
+  std::optional<TokenMask> token_mask;
+  if (!inputs.allowed_tokens.empty())
+    token_mask.emplace(inputs.allowed_tokens);
+
+  return WithProcessors([&](const auto&... processors) { return RunLogitsPipeline(logits, out, processors...); },
+                        penalty, frequency_penalty, ngram_block, eos_block, token_mask);
+}
+
+}  // namespace Generators
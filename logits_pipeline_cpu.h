@@ -0,0 +1,128 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// The logits processors applied before choosing a token (repetition, frequency and presence penalties, no-repeat
+// n-grams, the min_length EOS block, grammar masks),
+// fused into one pass over the vocabulary. The row is walked in tiles small enough to stay in L1: each tile is copied
+// out once, every processor of the chain edits it there, and its maximum is taken before moving on, so the row is read
+// and written once however many processors run. Temperature needs no pass of its own, it is the scale of the exp that
+// follows (see sampling_cpu.h).
+//
+// A chain is a list of processor types composed at compile time (RunLogitsPipeline<RepetitionPenalty, BlockTokens>) and
+// ProcessLogits picks the instantiation for the search settings and inputs at run time.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "generators.h"
+#include "token_history.h"
+#include "vector_math_cpu.h"
+
+namespace Generators {
+
+// Floats per tile, 4 KB
+constexpr size_t kLogitsTileSize = 1024;
+
+// What the processors need besides the logits
+struct LogitsProcessorInputs {
+  const TokenHistory* history{};             // The sequence so far, null for an empty one
+  std::span<const int32_t> eos_token_ids;    // Blocked while the sequence is shorter than min_length
+  std::span<const uint32_t> allowed_tokens;  // Bitmask of the tokens a grammar allows next, empty without one
+  // Not in Config::Search, 0 for none. Negative values make repeats more likely. See FrequencyPenalty.
+  float frequency_penalty{};
+  float presence_penalty{};
+};
+
+// Divides the logit of every token in the sequence by penalty, multiplies it when negative: less likely either way
+struct RepetitionPenalty {
+  // tokens sorted, each once
+  RepetitionPenalty(std::span<const int32_t> tokens, float penalty) : tokens_{tokens}, penalty_{penalty} {}
+
+  void Apply(size_t begin, std::span<float> tile) const {
+    auto token = std::lower_bound(tokens_.begin(), tokens_.end(), static_cast<int32_t>(begin));
+    for (; token != tokens_.end() && static_cast<size_t>(*token) < begin + tile.size(); ++token) {
+      float& logit = tile[*token - begin];
+      logit = logit < 0.0f ? logit * penalty_ : logit / penalty_;
+    }
+  }
+
+ private:
+  std::span<const int32_t> tokens_;
+  float penalty_;
+};
+
+// OpenAI's frequency and presence penalties: every generated token's logit goes down by frequency_penalty per time it
+// was generated, plus presence_penalty once
+struct FrequencyPenalty {
+  FrequencyPenalty(const TokenHistory& history, float frequency_penalty, float presence_penalty)
+      : history_{history}, frequency_penalty_{frequency_penalty}, presence_penalty_{presence_penalty} {}
+
+  void Apply(size_t begin, std::span<float> tile) const {
+    auto tokens = history_.OutputTokens();
+    auto token = std::lower_bound(tokens.begin(), tokens.end(), static_cast<int32_t>(begin));
+    for (; token != tokens.end() && static_cast<size_t>(*token) < begin + tile.size(); ++token)
+      tile[*token - begin] -= static_cast<float>(history_.OutputCount(*token)) * frequency_penalty_ + presence_penalty_;
+  }
+
+ private:
+  const TokenHistory& history_;
+  float frequency_penalty_;
+  float presence_penalty_;
+};
+
+// Makes tokens impossible: EOS before min_length, the tokens that would repeat an n-gram
+struct BlockTokens {
+  explicit BlockTokens(std::span<const int32_t> tokens) : tokens_{tokens} {}
+
+  void Apply(size_t begin, std::span<float> tile) const {
+    for (int32_t token : tokens_) {
+      if (token >= 0 && static_cast<size_t>(token) >= begin && static_cast<size_t>(token) < begin + tile.size())
+        tile[token - begin] = std::numeric_limits<float>::lowest();
+    }
+  }
+
+ private:
+  std::span<const int32_t> tokens_;
+};
+
+// Makes the tokens a grammar doesn't allow next impossible, see grammar_constraint.h
+struct TokenMask {
+  static_assert(kLogitsTileSize % 32 == 0, "Tiles have to start on a mask word");
+
+  explicit TokenMask(std::span<const uint32_t> allowed_tokens) : allowed_tokens_{allowed_tokens} {}
+
+  void Apply(size_t begin, std::span<float> tile) const {
+    MaskFill(tile, allowed_tokens_.subspan(begin / 32), std::numeric_limits<float>::lowest());
+  }
+
+ private:
+  std::span<const uint32_t> allowed_tokens_;
+};
+
+// out = logits with every processor applied, in order. Returns the maximum of out.
+template <typename... Processors>
+float RunLogitsPipeline(std::span<const float> logits, std::span<float> out, const Processors&... processors) {
+  float max = -std::numeric_limits<float>::infinity();
+  for (size_t begin = 0; begin < logits.size(); begin += kLogitsTileSize) {
+    auto tile = out.subspan(begin, std::min(kLogitsTileSize, logits.size() - begin));
+    std::copy_n(logits.begin() + begin, tile.size(), tile.begin());
+    (processors.Apply(begin, tile), ...);
+    max = std::max(max, ReduceMax(tile));
+  }
+  return max;
+}
+
+// Whether any processor changes the logits for these settings and inputs
+bool HasLogitsProcessors(const Config::Search& search, const LogitsProcessorInputs& inputs);
+
+// RunLogitsPipeline with the chain the settings need: repetition_penalty when it isn't 1, the frequency and presence
+// penalties, the n-grams of no_repeat_ngram_size (inputs.history has to be built with it), EOS while the sequence is
+// shorter than min_length, then the grammar's token mask. Returns the maximum of out.
+float ProcessLogits(std::span<const float> logits, const Config::Search& search, const LogitsProcessorInputs& inputs,
+                    std::span<float> out);
+
+}  // namespace Generators
@@ -0,0 +1,129 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+
+#include "lookahead_decoding.h"
+#include "generator_extensions.h"
+#include "sampling_cpu.h"
+#include "search.h"
+#include "models/model.h"
+
+namespace Generators {
+
+LookaheadDecoder::LookaheadDecoder(ExtendedGenerator& generator, int window_size, int ngram_size)
+    : MultiTokenDecoder{generator},
+      window_size_{static_cast<size_t>(std::max(window_size, 1))},
+      ngram_size_{static_cast<size_t>(std::max(ngram_size, 2))} {
+  if (!IsGreedySearch(search_))
+    throw std::runtime_error("Lookahead decoding only supports greedy search (do_sample false)");
+}
+
+void LookaheadDecoder::FillWindow(std::span<const int32_t> sequence) {
+  std::uniform_int_distribution<size_t> position(0, sequence.size() - 1);
+  while (window_.size() < window_size_)
+    window_.push_back(sequence[position(engine_)]);
+}
+
+void LookaheadDecoder::CollectNgrams(size_t start, std::span<const int32_t> inputs) {
+  // The prediction after inputs[j] was made given inputs[j], which was the previous pass's prediction given the token
+  // before it, and so on: following the diagonal back through the trajectory gives tokens that followed each other
+  std::vector<int32_t> ngram(ngram_size_);
+  for (size_t j = 0; j < predictions_.size(); j++) {
+    const size_t position = start + j;  // Of inputs[j]
+    ngram[ngram_size_ - 1] = predictions_[j];
+    ngram[ngram_size_ - 2] = inputs[j];
+
+    bool complete = true;
+    for (size_t k = 1; k + 1 < ngram_size_; k++) {
+      const Pass* pass = k <= trajectory_.size() ? &trajectory_[trajectory_.size() - k] : nullptr;
+      if (!pass || position < pass->start + k || position - k >= pass->start + pass->tokens.size()) {
+        complete = false;
+        break;
+      }
+      ngram[ngram_size_ - 2 - k] = pass->tokens[position - k - pass->start];
+    }
+    if (!complete)
+      continue;
+
+    auto& ngrams = pool_[ngram.front()];
+    auto match = std::find_if(ngrams.begin(), ngrams.end(), [&](const std::vector<int32_t>& continuation) {
+      return std::equal(continuation.begin(), continuation.end(), ngram.begin() + 1);
+    });
+    if (match != ngrams.end())
+      ngrams.erase(match);
+    else if (ngrams.size() == kLookaheadMaxNgramsPerToken)
+      ngrams.pop_front();
+    ngrams.emplace_back(ngram.begin() + 1, ngram.end());
+  }
+
+  trajectory_.push_back({start, {inputs.begin(), inputs.end()}});
+  while (trajectory_.size() > ngram_size_ - 2)
+    trajectory_.pop_front();
+}
+
+const std::vector<int32_t>* LookaheadDecoder::FindNgram(int32_t token) const {
+  auto found = pool_.find(token);
+  if (found == pool_.end() || found->second.empty())
+    return nullptr;
+  return &found->second.back();
+}
+
+void LookaheadDecoder::Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) {
+  auto& generator = generator_;
+  const Config& config = *generator.model_->config_;
+
+  if (generator.computed_logits_) {
+    int32_t token = ArgMax(generator.search_->GetLogits().CopyDeviceToCpu());
+    generator.CommitToken(token);
+    step_tokens.push_back(token);
+    return;
+  }
+
+  auto sequence = generator.GetSequence(0).CopyDeviceToCpu();
+  const size_t length = sequence.size();
+  const size_t max_length = static_cast<size_t>(search_.max_length);
+  const size_t max_guesses = std::min(window_size_, length + 1 < max_length ? max_length - length - 1 : 0);
+  const int32_t pending = sequence[length - 1];
+
+  // The front of the window is replaced by a pool n-gram for the pending token, if there is one
+  FillWindow(sequence);
+  run_.assign(window_.begin(), window_.begin() + max_guesses);
+  if (const auto* ngram = FindNgram(pending)) {
+    const size_t count = std::min(ngram->size(), run_.size());
+    std::copy_n(ngram->begin(), count, run_.begin());
+  }
+
+  generator.RunTokens(run_);
+  stats.target_runs++;
+  stats.proposed_tokens += run_.size();
+  auto logits = generator.GetRunLogits(run_.size() + 1);
+  const size_t vocab_size = logits.size() / (run_.size() + 1);
+
+  predictions_.resize(run_.size() + 1);
+  for (size_t i = 0; i < predictions_.size(); i++)
+    predictions_[i] = ArgMax(logits.subspan(i * vocab_size, vocab_size));
+
+  emitted_.clear();
+  size_t accepted = 0;
+  while (accepted < run_.size() && run_[accepted] == predictions_[accepted]) {
+    emitted_.push_back(run_[accepted++]);
+    if (IsEosToken(config, emitted_.back()))
+      break;
+  }
+  if (emitted_.empty() || !IsEosToken(config, emitted_.back()))
+    emitted_.push_back(predictions_[accepted]);
+  stats.accepted_tokens += accepted;
+
+  inputs_.assign(1, pending);
+  inputs_.insert(inputs_.end(), run_.begin(), run_.end());
+  CollectNgrams(length - 1, inputs_);
+
+  // Jacobi step: the predictions for the positions after the new pending token are the next guesses
+  window_.assign(predictions_.begin() + std::min(emitted_.size(), predictions_.size()), predictions_.end());
+
+  Commit(length, run_.size(), emitted_);
+  step_tokens.insert(step_tokens.end(), emitted_.begin(), emitted_.end());
+}
+
+}  // namespace Generators
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Lookahead decoding: greedy decoding that needs neither a draft model nor a prompt to copy from. A window of guesses
+// for the next positions runs with the pending token in every forward pass. The model's predictions for those
+// positions become the next guesses (Jacobi iteration), and the chains of tokens that produced each other over the
+// last passes are collected as n-grams in a pool. When the pool has an n-gram that starts with the pending token, it
+// takes the front of the window, so phrases the model already produced once are accepted whole next time.
+//
+// Guesses are kept only where they equal the model's argmax, so the output is identical to greedy decoding.
+// The model only gives causal attention, so one window serves both as the lookahead and the verification branch.
+#pragma once
+
+#include <deque>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "speculative_decoding.h"
+
+namespace Generators {
+
+// Most n-grams kept per first token, the oldest is dropped first
+constexpr size_t kLookaheadMaxNgramsPerToken = 8;
+
+struct LookaheadDecoder : MultiTokenDecoder {
+  LookaheadDecoder(ExtendedGenerator& generator, int window_size, int ngram_size);
+
+  void Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) override;
+
+ private:
+  // Pad the window to window_size_ with tokens of the sequence, the starting guesses of the Jacobi iteration
+  void FillWindow(std::span<const int32_t> sequence);
+  // Add the n-grams ending in each prediction of the pass whose inputs start at position start
+  void CollectNgrams(size_t start, std::span<const int32_t> inputs);
+  // Most recent n-gram after token, without token itself. Null if there is none.
+  const std::vector<int32_t>* FindNgram(int32_t token) const;
+
+  size_t window_size_;
+  size_t ngram_size_;
+
+  std::vector<int32_t> window_;  // Guesses for the positions after the pending token
+
+  // Inputs of the last ngram_size - 2 passes, tokens[0] is at position start of the sequence
+  struct Pass {
+    size_t start;
+    std::vector<int32_t> tokens;
+  };
+  std::deque<Pass> trajectory_;
+  std::unordered_map<int32_t, std::deque<std::vector<int32_t>>> pool_;
+
+  std::vector<int32_t> run_;          // Guesses sent with the pending token
+  std::vector<int32_t> inputs_;       // The pending token followed by run_
+  std::vector<int32_t> predictions_;  // Argmax after the pending token and after each guess
+  std::vector<int32_t> emitted_;
+  std::minstd_rand engine_;
+};
+
+}  // namespace Generators
@@ -0,0 +1,63 @@
+// oga_utils.h - Small helpers shared by the C API front ends (scheduler, server, batch tools)
+#ifndef OGA_UTILS_H
+#define OGA_UTILS_H
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "ort_genai_c.h"
+#include "ort_genai_c_ext.h"
+
+// Convert an OgaResult into an exception, releasing the result
+inline void OgaThrowIfFailed(OgaResult* result) {
+    if (result == nullptr) {
+        return;
+    }
+    std::string message = OgaResultGetError(result);
+    OgaDestroyResult(result);
+    throw std::runtime_error(message);
+}
+
+// unique_ptr deleters so front ends don't need a cleanup ladder on every error path
+struct OgaModelDeleter { void operator()(OgaModel* p) const { OgaDestroyModel(p); } };
+struct OgaTokenizerDeleter { void operator()(OgaTokenizer* p) const { OgaDestroyTokenizer(p); } };
+struct OgaTokenizerStreamDeleter { void operator()(OgaTokenizerStream* p) const { OgaDestroyTokenizerStream(p); } };
+struct OgaSequencesDeleter { void operator()(OgaSequences* p) const { OgaDestroySequences(p); } };
+struct OgaGeneratorParamsDeleter { void operator()(OgaGeneratorParams* p) const { OgaDestroyGeneratorParams(p); } };
+struct OgaGeneratorDeleter { void operator()(OgaGenerator* p) const { OgaDestroyGenerator(p); } };
+struct OgaTensorDeleter { void operator()(OgaTensor* p) const { OgaDestroyTensor(p); } };
+struct OgaSequenceScoresDeleter { void operator()(OgaSequenceScores* p) const { OgaDestroySequenceScores(p); } };
+struct OgaAsyncGenerationDeleter { void operator()(OgaAsyncGeneration* p) const { OgaDestroyAsyncGeneration(p); } };
+
+using OgaModelPtr = std::unique_ptr<OgaModel, OgaModelDeleter>;
+using OgaTokenizerPtr = std::unique_ptr<OgaTokenizer, OgaTokenizerDeleter>;
+using OgaTokenizerStreamPtr = std::unique_ptr<OgaTokenizerStream, OgaTokenizerStreamDeleter>;
+using OgaSequencesPtr = std::unique_ptr<OgaSequences, OgaSequencesDeleter>;
+using OgaGeneratorParamsPtr = std::unique_ptr<OgaGeneratorParams, OgaGeneratorParamsDeleter>;
+using OgaGeneratorPtr = std::unique_ptr<OgaGenerator, OgaGeneratorDeleter>;
+using OgaTensorPtr = std::unique_ptr<OgaTensor, OgaTensorDeleter>;
+using OgaSequenceScoresPtr = std::unique_ptr<OgaSequenceScores, OgaSequenceScoresDeleter>;
+using OgaAsyncGenerationPtr = std::unique_ptr<OgaAsyncGeneration, OgaAsyncGenerationDeleter>;
+
+// Decode tokens into text, reusing its capacity: no result string to destroy, and no allocation once text has grown
+// to the size of the outputs
+inline void OgaDecodeInto(const OgaTokenizer* tokenizer, const int32_t* tokens, size_t count, std::string& text) {
+    size_t length = 0;
+    text.resize(text.capacity());
+    OgaThrowIfFailed(OgaTokenizerDecodeInto(tokenizer, tokens, count, text.data(), text.size() + 1, &length));
+    if (length > text.size()) {
+        text.resize(length);
+        OgaThrowIfFailed(OgaTokenizerDecodeInto(tokenizer, tokens, count, text.data(), text.size() + 1, &length));
+    }
+    text.resize(length);
+}
+
+using OgaClock = std::chrono::steady_clock;
+
+inline double OgaMillisecondsSince(OgaClock::time_point start) {
+    return std::chrono::duration<double, std::milli>(OgaClock::now() - start).count();
+}
+
+#endif // OGA_UTILS_H
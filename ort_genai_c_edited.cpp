@@ -6,7 +6,11 @@
 #include <cstddef>
 #include "span.h"
 #include "ort_genai_c.h"
+#include "ort_genai_c_ext.h"
 #include "generators.h"
+#include "generator_extensions.h"
+#include "sequence_scoring.h"
+#include "async_generation.h"
 #include "models/model.h"
 #include "constrained_logits_processor.h"
 #include "runtime_settings.h"
@@ -30,6 +34,14 @@ const char* AllocOgaString(const std::string& string) {
   return cstr_buffer.release();
 }
 
+// Copy a string and its terminator into a caller's buffer of capacity bytes when it fits, leaving the buffer alone when
+// it doesn't. The length is reported either way, so a caller can grow the buffer and try again.
+void CopyToCallerBuffer(const std::string& string, char* buffer, size_t capacity, size_t* out_length) {
+  *out_length = string.size();
+  if (buffer && string.size() < capacity)
+    memcpy(buffer, string.c_str(), string.size() + 1);
+}
+
 // This type can't be created or copied by value, only by pointer. It's used for the definitions below to ensure nobody
 // accidentally creates/copies one of the types that happens to have a default constructor.
 struct OgaAbstract {
@@ -42,10 +54,11 @@ struct OgaAbstract {
 // We still need to cast from internal types to the external ones, but these definitions ensure that the types are correct.
 // But do not use reinterpret_cast!
 struct OgaAdapters : Generators::Adapters, OgaAbstract {};
+struct OgaAsyncGeneration : Generators::AsyncGeneration, OgaAbstract {};
 struct OgaAudios : Generators::Audios, OgaAbstract {};
 struct OgaConfig : Generators::Config, OgaAbstract {};
-struct OgaGenerator : Generators::Generator, OgaAbstract {};
-struct OgaGeneratorParams : Generators::GeneratorParams, OgaAbstract {};
+struct OgaGenerator : Generators::ExtendedGenerator, OgaAbstract {};
+struct OgaGeneratorParams : Generators::ExtendedGeneratorParams, OgaAbstract {};
 struct OgaImages : Generators::Images, OgaAbstract {};
 struct OgaModel : Generators::Model, OgaAbstract {};
 struct OgaMultiModalProcessor : Generators::MultiModalProcessor, OgaAbstract {};
@@ -53,6 +66,7 @@ struct OgaNamedTensors : Generators::NamedTensors, OgaAbstract {};
 struct OgaResult : Generators::Result, OgaAbstract {};
 struct OgaRuntimeSettings : Generators::RuntimeSettings, OgaAbstract {};
 struct OgaSequences : Generators::TokenSequences, OgaAbstract {};
+struct OgaSequenceScores : Generators::SequenceScores, OgaAbstract {};
 struct OgaStringArray : std::vector<std::string>, OgaAbstract {};
 struct OgaTensor : Generators::Tensor, OgaAbstract {};
 struct OgaTokenizer : Generators::Tokenizer, OgaAbstract {};
@@ -75,6 +89,29 @@ T* ReturnUnique(std::unique_ptr<U> p) {
   return static_cast<T*>(p.release());
 }
 
+// Holds the generator for the length of a C API call that changes it, see ExtendedGenerator::TryClaim
+struct GeneratorClaim {
+  explicit GeneratorClaim(const Generators::ExtendedGenerator& generator) : generator_{generator} {
+    if (!generator_.TryClaim())
+      throw std::runtime_error("The generator is in use by another thread or an asynchronous generation");
+  }
+  ~GeneratorClaim() { generator_.Release(); }
+
+  GeneratorClaim(const GeneratorClaim&) = delete;
+  GeneratorClaim& operator=(const GeneratorClaim&) = delete;
+
+ private:
+  const Generators::ExtendedGenerator& generator_;
+};
+
+void ToOgaTensorView(const Generators::TensorView& view, OgaTensorView* out) {
+  out->data = view.data;
+  out->type = static_cast<OgaElementType>(view.type);
+  out->shape = view.shape.data();
+  out->shape_rank = view.shape.size();
+  out->element_count = view.element_count;
+}
+
 extern "C" {
 
 #define OGA_TRY try {
@@ -279,9 +316,64 @@ OgaResult* OGA_API_CALL OgaModelGetDeviceType(const OgaModel* model, const char*
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaCreateDraftModel(const OgaModel* target, const char* config_path, OgaModel** out) {
+  OGA_TRY
+  auto model = Generators::CreateDraftModel(*target, config_path);
+  *out = ReturnShared<OgaModel>(model);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaScoreSequence(const OgaModel* model, const int32_t* prompt, size_t prompt_count,
+                                         const int32_t* continuation, size_t continuation_count, size_t top_k,
+                                         OgaSequenceScores** out) {
+  OGA_TRY
+  std::span<const int32_t> prompts[] = {{prompt, prompt_count}};
+  std::span<const int32_t> continuations[] = {{continuation, continuation_count}};
+  *out = ReturnUnique<OgaSequenceScores>(Generators::ScoreSequences(*model, prompts, continuations, top_k));
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaScoreSequences(const OgaModel* model, const OgaSequences* prompts,
+                                          const OgaSequences* continuations, size_t top_k, OgaSequenceScores** out) {
+  OGA_TRY
+  std::vector<std::span<const int32_t>> prompt_spans(prompts->begin(), prompts->end());
+  std::vector<std::span<const int32_t>> continuation_spans(continuations->begin(), continuations->end());
+  *out = ReturnUnique<OgaSequenceScores>(Generators::ScoreSequences(*model, prompt_spans, continuation_spans, top_k));
+  return nullptr;
+  OGA_CATCH
+}
+
+size_t OGA_API_CALL OgaSequenceScores_GetCount(const OgaSequenceScores* scores) {
+  return scores->logprobs.size();
+}
+
+OgaResult* OGA_API_CALL OgaSequenceScores_GetLogProbs(const OgaSequenceScores* scores, size_t index,
+                                                      const float** out, size_t* out_count) {
+  OGA_TRY
+  const auto& logprobs = scores->logprobs.at(index);
+  *out = logprobs.data();
+  *out_count = logprobs.size();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaSequenceScores_GetTopK(const OgaSequenceScores* scores, size_t index,
+                                                  const int32_t** out_tokens, const float** out_logprobs,
+                                                  size_t* out_count) {
+  OGA_TRY
+  const auto& tokens = scores->top_tokens.at(index);
+  *out_tokens = tokens.data();
+  *out_logprobs = scores->top_logprobs.at(index).data();
+  *out_count = tokens.size();
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaCreateGeneratorParams(const OgaModel* model, OgaGeneratorParams** out) {
   OGA_TRY
-  auto params = std::make_shared<Generators::GeneratorParams>(*model);
+  auto params = std::make_shared<Generators::ExtendedGeneratorParams>(*model);
   *out = ReturnShared<OgaGeneratorParams>(params);
   return nullptr;
   OGA_CATCH
@@ -296,14 +388,88 @@ OgaResult* OGA_API_CALL OgaRuntimeSettingsSetHandle(OgaRuntimeSettings* settings
 
 OgaResult* OGA_API_CALL OgaGeneratorParamsSetSearchNumber(OgaGeneratorParams* generator_params, const char* name, double value) {
   OGA_TRY
-  Generators::SetSearchNumber(generator_params->search, name, value);
+  // The OpenAI-style penalties aren't search options, the generator applies them
+  if (std::string_view{name} == "frequency_penalty")
+    generator_params->frequency_penalty = static_cast<float>(value);
+  else if (std::string_view{name} == "presence_penalty")
+    generator_params->presence_penalty = static_cast<float>(value);
+  else
+    Generators::SetSearchNumber(generator_params->search, name, value);
   return nullptr;
   OGA_CATCH
 }
 
 OgaResult* OGA_API_CALL OgaGeneratorParamsSetSearchBool(OgaGeneratorParams* generator_params, const char* name, bool value) {
   OGA_TRY
-  Generators::SetSearchBool(generator_params->search, name, value);
+  // Not a search option either, it takes token selection away from the search
+  if (std::string_view{name} == "cpu_token_selection")
+    generator_params->cpu_token_selection = value;
+  else
+    Generators::SetSearchBool(generator_params->search, name, value);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsSetDraftModel(OgaGeneratorParams* generator_params, const OgaModel* draft_model, int32_t num_draft_tokens) {
+  OGA_TRY
+  if (num_draft_tokens < 1)
+    throw std::runtime_error("num_draft_tokens must be at least 1");
+  generator_params->draft_model = draft_model->shared_from_this();
+  generator_params->num_draft_tokens = num_draft_tokens;
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsSetPromptLookup(OgaGeneratorParams* generator_params, int32_t max_ngram_size, int32_t num_draft_tokens) {
+  OGA_TRY
+  if (max_ngram_size < 1 || num_draft_tokens < 1)
+    throw std::runtime_error("max_ngram_size and num_draft_tokens must be at least 1");
+  generator_params->prompt_lookup_ngram_size = max_ngram_size;
+  generator_params->num_draft_tokens = num_draft_tokens;
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsSetLookahead(OgaGeneratorParams* generator_params, int32_t window_size, int32_t ngram_size) {
+  OGA_TRY
+  if (window_size < 1 || ngram_size < 2)
+    throw std::runtime_error("window_size must be at least 1 and ngram_size at least 2");
+  generator_params->lookahead_window_size = window_size;
+  generator_params->lookahead_ngram_size = ngram_size;
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsSetNumCompletions(OgaGeneratorParams* generator_params, int32_t num_completions) {
+  OGA_TRY
+  if (num_completions < 1)
+    throw std::runtime_error("num_completions must be at least 1");
+  generator_params->num_completions = num_completions;
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsSetPrefillChunkSize(OgaGeneratorParams* generator_params, int32_t chunk_size) {
+  OGA_TRY
+  if (chunk_size < 0)
+    throw std::runtime_error("chunk_size must not be negative");
+  generator_params->prefill_chunk_size = chunk_size;
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsAddStopSequence(OgaGeneratorParams* generator_params, const int32_t* tokens, size_t token_count) {
+  OGA_TRY
+  if (token_count == 0)
+    throw std::runtime_error("Stop sequences must not be empty");
+  generator_params->stop_sequences.emplace_back(tokens, tokens + token_count);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGeneratorParamsAddStopString(OgaGeneratorParams* generator_params, const OgaTokenizer* tokenizer, const char* text) {
+  OGA_TRY
+  generator_params->stop_sequences.push_back(Generators::EncodeStopString(*tokenizer, text));
   return nullptr;
   OGA_CATCH
 }
@@ -346,13 +512,18 @@ OgaResult* OGA_API_CALL OgaGeneratorParamsSetGuidance(OgaGeneratorParams* oga_pa
 
 OgaResult* OgaCreateGenerator(const OgaModel* model, const OgaGeneratorParams* generator_params, OgaGenerator** out) {
   OGA_TRY
-  *out = ReturnUnique<OgaGenerator>(CreateGenerator(*model, *generator_params));
+  *out = ReturnUnique<OgaGenerator>(std::make_unique<Generators::ExtendedGenerator>(*model, *generator_params));
   return nullptr;
   OGA_CATCH
 }
 
 bool OGA_API_CALL OgaGenerator_IsDone(const OgaGenerator* generator) {
-  return generator->IsDone();
+  // Not done as long as someone else is generating with it, such as an asynchronous generation
+  if (!generator->TryClaim())
+    return false;
+  const bool done = generator->IsDone();
+  generator->Release();
+  return done;
 }
 
 bool OGA_API_CALL OgaGenerator_IsSessionTerminated(const OgaGenerator* generator) {
@@ -361,6 +532,7 @@ bool OGA_API_CALL OgaGenerator_IsSessionTerminated(const OgaGenerator* generator
 
 OgaResult* OGA_API_CALL OgaGenerator_AppendTokenSequences(OgaGenerator* generator, const OgaSequences* sequences) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
 
   if (sequences->empty()) {
     throw std::runtime_error("input sequences are empty");
@@ -380,6 +552,7 @@ OgaResult* OGA_API_CALL OgaGenerator_AppendTokenSequences(OgaGenerator* generato
 
 OgaResult* OGA_API_CALL OgaGenerator_AppendTokens(OgaGenerator* generator, const int32_t* input_ids, size_t input_ids_count) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   generator->AppendTokens(Generators::cpu_span<const int32_t>(input_ids, input_ids_count));
   return nullptr;
   OGA_CATCH
@@ -387,6 +560,7 @@ OgaResult* OGA_API_CALL OgaGenerator_AppendTokens(OgaGenerator* generator, const
 
 OgaResult* OGA_API_CALL OgaGenerator_GenerateNextToken(OgaGenerator* generator) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   generator->GenerateNextToken();
   return nullptr;
   OGA_CATCH
@@ -394,6 +568,7 @@ OgaResult* OGA_API_CALL OgaGenerator_GenerateNextToken(OgaGenerator* generator)
 
 OgaResult* OGA_API_CALL OgaGenerator_GetNextTokens(const OgaGenerator* generator, const int32_t** out, size_t* out_count) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   auto tokens = generator->search_->GetNextTokens().CopyDeviceToCpu();
   *out = tokens.data();
   *out_count = tokens.size();
@@ -401,15 +576,76 @@ OgaResult* OGA_API_CALL OgaGenerator_GetNextTokens(const OgaGenerator* generator
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaGenerator_GenerateTokens(OgaGenerator* generator, size_t max_tokens, OgaTokenizerStream* tokenizer_stream,
+                                                    int32_t* out_tokens, size_t* out_token_count, char* out_text,
+                                                    size_t text_capacity, size_t* out_text_length, bool* out_done) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  // Without out_text there is nowhere to return text, so nothing is decoded
+  auto result = generator->GenerateTokens(std::span<int32_t>(out_tokens, max_tokens), out_text ? tokenizer_stream : nullptr,
+                                          std::span<char>(out_text, out_text ? text_capacity : 0));
+  *out_token_count = result.token_count;
+  if (out_text_length)
+    *out_text_length = result.text_length;
+  *out_done = result.done;
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_StartAsync(OgaGenerator* generator, OgaTokenizerStream* tokenizer_stream,
+                                                OgaTokenCallback callback, void* user_data, OgaAsyncGeneration** out) {
+  OGA_TRY
+  auto on_tokens = [callback, user_data](std::span<const int32_t> tokens, std::string_view text) {
+    // text is a whole std::string, so its terminator is there
+    return callback(user_data, tokens.data(), tokens.size(), text.data());
+  };
+  *out = ReturnUnique<OgaAsyncGeneration>(std::make_unique<Generators::AsyncGeneration>(*generator, tokenizer_stream, on_tokens));
+  return nullptr;
+  OGA_CATCH
+}
+
+void OGA_API_CALL OgaAsyncGeneration_Cancel(OgaAsyncGeneration* generation) {
+  generation->Cancel();
+}
+
+bool OGA_API_CALL OgaAsyncGeneration_IsDone(const OgaAsyncGeneration* generation) {
+  return generation->IsDone();
+}
+
+OgaResult* OGA_API_CALL OgaAsyncGeneration_Join(OgaAsyncGeneration* generation) {
+  OGA_TRY
+  generation->Join();
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaGenerator_RewindTo(OgaGenerator* generator, size_t new_length) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   generator->RewindToLength(new_length);
   return nullptr;
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaGenerator_StartNextCompletion(OgaGenerator* generator, bool* out) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  *out = generator->StartNextCompletion();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_Reset(OgaGenerator* generator, const OgaGeneratorParams* params) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  generator->Reset(params);
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaGenerator_SetRuntimeOption(OgaGenerator* generator, const char* key, const char* value) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   generator->SetRuntimeOption(key, value);
   return nullptr;
   OGA_CATCH
@@ -417,6 +653,7 @@ OgaResult* OGA_API_CALL OgaGenerator_SetRuntimeOption(OgaGenerator* generator, c
 
 OgaResult* OGA_API_CALL OgaGenerator_GetOutput(const OgaGenerator* generator, const char* name, OgaTensor** out) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   auto* ortvalue_output = generator->state_->GetOutput(name);
   auto type_info = ortvalue_output->GetTensorTypeAndShapeInfo();
   auto ortvalue_clone = OrtValue::CreateTensor(generator->model_->allocator_cpu_, type_info->GetShape(), type_info->GetElementType());
@@ -435,6 +672,7 @@ OgaResult* OGA_API_CALL OgaGenerator_GetOutput(const OgaGenerator* generator, co
 
 OgaResult* OGA_API_CALL OgaGenerator_GetLogits(OgaGenerator* generator, OgaTensor** out) {
   OGA_TRY
+  GeneratorClaim claim{*generator};
   auto logits_span = generator->GetLogits();
   const std::array<int64_t, 3> shape{generator->state_->params_->search.batch_size, 1, generator->model_->config_->model.vocab_size};
   std::span<const float> cpu_logits_span = logits_span.CopyDeviceToCpu();
@@ -449,24 +687,41 @@ OgaResult* OGA_API_CALL OgaGenerator_GetLogits(OgaGenerator* generator, OgaTenso
   OGA_CATCH
 }
 
-OgaResult* OGA_API_CALL OgaGenerator_SetLogits(OgaGenerator* generator, OgaTensor* tensor) {
+OgaResult* OGA_API_CALL OgaGenerator_GetLogitsView(OgaGenerator* generator, OgaTensorView* out) {
   OGA_TRY
-  auto logits = generator->search_->GetLogits();
-  if (!generator->computed_logits_ && logits.size() != 0) {
-    throw std::runtime_error("logits are not computed yet. Please call GenerateNextToken or AppendTokens before calling SetLogits.");
-  }
-  size_t element_count = tensor->GetElementCount();
-  auto new_logits_span = std::span<const float>(tensor->GetData<float>(), element_count);
-  if (logits.size() == 0) {
-    logits = generator->model_->p_device_inputs_->Allocate<float>(element_count);
-    generator->SetLogits(logits);
-  } else if (new_logits_span.size() != logits.size()) {
-    throw std::runtime_error("Generator::SetLogits passed an array of size " +
-                             std::to_string(new_logits_span.size()) + " but should be size " + std::to_string(logits.size()));
+  GeneratorClaim claim{*generator};
+  ToOgaTensorView(generator->GetLogitsView(), out);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_GetOutputView(OgaGenerator* generator, const char* name, OgaTensorView* out) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  ToOgaTensorView(generator->GetOutputView(name), out);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_SetLogitsCallback(OgaGenerator* generator, OgaLogitsCallback callback, void* user_data) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  if (!callback) {
+    generator->SetLogitsCallback({});
+    return nullptr;
   }
-  Generators::copy(new_logits_span, logits.CpuSpan());
-  logits.CopyCpuToDevice();
-  generator->computed_logits_ = true;
+  generator->SetLogitsCallback([callback, user_data](std::span<float> logits, size_t vocab_size) {
+    callback(user_data, logits.data(), logits.size() / vocab_size, vocab_size);
+  });
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_SetLogits(OgaGenerator* generator, OgaTensor* tensor) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  // Through the generator, so a decoder choosing the tokens reads them too
+  generator->SetLogits(std::span<const float>(tensor->GetData<float>(), tensor->GetElementCount()));
   return nullptr;
   OGA_CATCH
 }
@@ -479,6 +734,43 @@ const int32_t* OGA_API_CALL OgaGenerator_GetSequenceData(const OgaGenerator* gen
   return generator->GetSequence(static_cast<int>(index)).CopyDeviceToCpu().data();
 }
 
+OgaResult* OGA_API_CALL OgaGenerator_GetLastStepTokens(const OgaGenerator* generator, const int32_t** out, size_t* out_count) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  auto tokens = generator->GetLastStepTokens();
+  *out = tokens.data();
+  *out_count = tokens.size();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_GetSequenceSince(const OgaGenerator* generator, size_t index, size_t* cursor,
+                                                      const int32_t** out, size_t* out_count) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  auto tokens = generator->GetSequenceSince(index, *cursor);
+  *out = tokens.data();
+  *out_count = tokens.size();
+  *cursor += tokens.size();
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaGenerator_GetDecodingStats(const OgaGenerator* generator, OgaDecodingStats* out) {
+  OGA_TRY
+  GeneratorClaim claim{*generator};
+  const auto& stats = generator->GetDecodingStats();
+  out->steps = stats.steps;
+  out->target_runs = stats.target_runs;
+  out->proposed_tokens = stats.proposed_tokens;
+  out->accepted_tokens = stats.accepted_tokens;
+  out->generated_tokens = stats.generated_tokens;
+  out->propose_ms = stats.propose_ms;
+  out->decode_ms = stats.decode_ms;
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaCreateTokenizer(const OgaModel* model, OgaTokenizer** out) {
   OGA_TRY
   auto tokenizer = model->CreateTokenizer();
@@ -523,6 +815,23 @@ OgaResult* OGA_API_CALL OgaTokenizerApplyChatTemplate(const OgaTokenizer* tokeni
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaTokenizerDecodeInto(const OgaTokenizer* tokenizer, const int32_t* tokens, size_t token_count,
+                                               char* buffer, size_t capacity, size_t* out_length) {
+  OGA_TRY
+  CopyToCallerBuffer(tokenizer->Decode({tokens, token_count}), buffer, capacity, out_length);
+  return nullptr;
+  OGA_CATCH
+}
+
+OgaResult* OGA_API_CALL OgaTokenizerApplyChatTemplateInto(const OgaTokenizer* tokenizer, const char* template_str, const char* messages,
+                                                          const char* tools, bool add_generation_prompt, char* buffer,
+                                                          size_t capacity, size_t* out_length) {
+  OGA_TRY
+  CopyToCallerBuffer(tokenizer->ApplyChatTemplate(template_str, messages, tools, add_generation_prompt), buffer, capacity, out_length);
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaTokenizerDecodeBatch(const OgaTokenizer* tokenizer, const OgaTensor* tensor, OgaStringArray** out) {
   OGA_TRY
   auto shape = tensor->GetShape();
@@ -541,6 +850,14 @@ OgaResult* OGA_API_CALL OgaProcessorDecode(const OgaMultiModalProcessor* process
   OGA_CATCH
 }
 
+OgaResult* OGA_API_CALL OgaProcessorDecodeInto(const OgaMultiModalProcessor* processor, const int32_t* tokens, size_t token_count,
+                                               char* buffer, size_t capacity, size_t* out_length) {
+  OGA_TRY
+  CopyToCallerBuffer(processor->tokenizer_->Decode({tokens, token_count}), buffer, capacity, out_length);
+  return nullptr;
+  OGA_CATCH
+}
+
 OgaResult* OGA_API_CALL OgaCreateTokenizerStream(const OgaTokenizer* p, OgaTokenizerStream** out) {
   OGA_TRY
   *out = ReturnUnique<OgaTokenizerStream>(p->CreateStream());
@@ -770,6 +1087,7 @@ void OGA_API_CALL OgaDestroyStringArray(OgaStringArray* string_array) { delete s
 void OGA_API_CALL OgaDestroyResult(OgaResult* p) { delete p; }
 void OGA_API_CALL OgaDestroyString(const char* p) { delete p; }
 void OGA_API_CALL OgaDestroySequences(OgaSequences* p) { delete p; }
+void OGA_API_CALL OgaDestroySequenceScores(OgaSequenceScores* p) { delete p; }
 void OGA_API_CALL OgaDestroyConfig(OgaConfig* p) { delete p; }
 void OGA_API_CALL OgaDestroyModel(OgaModel* p) { p->ExternalRelease(); }
 void OGA_API_CALL OgaDestroyGeneratorParams(OgaGeneratorParams* p) { p->ExternalRelease(); }
@@ -782,6 +1100,7 @@ void OGA_API_CALL OgaDestroyImages(OgaImages* p) { delete p; }
 void OGA_API_CALL OgaDestroyAudios(OgaAudios* p) { delete p; }
 void OGA_API_CALL OgaDestroyNamedTensors(OgaNamedTensors* p) { delete p; }
 void OGA_API_CALL OgaDestroyAdapters(OgaAdapters* p) { p->ExternalRelease(); }
+void OGA_API_CALL OgaDestroyAsyncGeneration(OgaAsyncGeneration* p) { delete p; }
 void OGA_API_CALL OgaDestroyRuntimeSettings(OgaRuntimeSettings* p) { delete p; }
 
 }  // extern "C"
@@ -0,0 +1,438 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Additions to the ORT GenAI C API implemented in ort_genai_c_edited.cpp. Same conventions as ort_genai_c.h:
+// functions return nullptr on success or an OgaResult that must be destroyed with OgaDestroyResult.
+//
+// Threads: one OgaModel serves any number of generators on as many threads, with one copy of the weights. Their
+// forward passes run concurrently on the model's sessions, which ONNX Runtime allows; nothing else is shared between
+// generators but read-only model data and the token vocabulary of guidance, which is built once under a lock.
+//  - OgaModel, OgaTokenizer and OgaGeneratorParams can be used from any number of threads at once, as long as nothing
+//    changes the params while generators are created from them. Each object is destroyed once, after its last use.
+//  - An OgaGenerator and an OgaTokenizerStream belong to one thread at a time: any thread, but one after the other.
+//    Calls that change or read a generator fail with an error while another thread is inside one, or while an
+//    OgaGenerator_StartAsync generation runs on it (its callback included), instead of corrupting it or reading it
+//    half-changed. OgaGenerator_IsDone returns false then. OgaGenerator_GetSequenceCount and
+//    OgaGenerator_GetSequenceData have no error to return and are not synchronized: don't call them while the
+//    generator is in use elsewhere, read the sequence with OgaGenerator_GetSequenceSince instead.
+//  - Tokenizer streams of one tokenizer decode independently: each keeps its own detokenization cache.
+//  - Returned borrowed pointers (sequences, logits views, decoded text) follow their object's thread.
+#pragma once
+
+#include "ort_genai_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Counters for the decoding done by a generator, see OgaGenerator_GetDecodingStats.
+ */
+typedef struct OgaDecodingStats {
+  size_t steps;             /**< GenerateNextToken calls */
+  size_t target_runs;       /**< Forward passes of the model while decoding */
+  size_t proposed_tokens;   /**< Draft tokens sent for verification */
+  size_t accepted_tokens;   /**< Draft tokens the model agreed with */
+  size_t generated_tokens;  /**< Tokens added to the sequence */
+  double propose_ms;        /**< Time spent producing drafts */
+  double decode_ms;         /**< Total time spent in GenerateNextToken */
+} OgaDecodingStats;
+
+/**
+ * \brief A borrowed, read-only view of a generator's tensor, see OgaGenerator_GetLogitsView. Nothing in it is owned by
+ *        the caller, and all of it is valid until the next call that changes the generator.
+ */
+typedef struct OgaTensorView {
+  const void* data;        /**< Elements, row-major */
+  OgaElementType type;     /**< Element type of data */
+  const int64_t* shape;    /**< shape_rank dimensions */
+  size_t shape_rank;       /**< Number of dimensions */
+  size_t element_count;    /**< Product of the dimensions */
+} OgaTensorView;
+
+/**
+ * \brief Edits the logits of the next token in place, see OgaGenerator_SetLogitsCallback.
+ * \param[in] user_data The pointer passed to OgaGenerator_SetLogitsCallback.
+ * \param[in,out] logits row_count rows of vocab_size floats, one per sequence (batch_size * num_beams).
+ * \param[in] row_count Number of rows.
+ * \param[in] vocab_size Floats per row.
+ */
+typedef void(OGA_API_CALL* OgaLogitsCallback)(void* user_data, float* logits, size_t row_count, size_t vocab_size);
+
+/**
+ * \brief Generation running on a worker thread, see OgaGenerator_StartAsync.
+ */
+typedef struct OgaAsyncGeneration OgaAsyncGeneration;
+
+/**
+ * \brief Receives the tokens of each generation step, see OgaGenerator_StartAsync. Called on the worker thread.
+ * \param[in] user_data The pointer passed to OgaGenerator_StartAsync.
+ * \param[in] tokens The tokens the step added to the sequence, valid during the call.
+ * \param[in] token_count Number of tokens.
+ * \param[in] text Their decoded text, null-terminated, empty without a tokenizer stream. Valid during the call.
+ * \return True to go on, false to stop generating.
+ */
+typedef bool(OGA_API_CALL* OgaTokenCallback)(void* user_data, const int32_t* tokens, size_t token_count, const char* text);
+
+/**
+ * \brief Log-probabilities of scored continuations, see OgaScoreSequence.
+ */
+typedef struct OgaSequenceScores OgaSequenceScores;
+
+/**
+ * \brief Loads a draft model for speculative decoding with target. The draft must share the target's vocabulary.
+ *        If the target's genai_config.json has a decoder.pipeline entry named "draft", its session_options are
+ *        used for the draft session.
+ * \param[in] target The model the draft proposes tokens for.
+ * \param[in] config_path The directory containing the draft model's genai_config.json.
+ * \param[out] out The created draft model, destroy with OgaDestroyModel.
+ * \return OgaResult containing the error message if loading failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaCreateDraftModel(const OgaModel* target, const char* config_path, OgaModel** out);
+
+/**
+ * \brief Enables speculative decoding: each GenerateNextToken call lets draft_model propose num_draft_tokens tokens
+ *        and verifies them with one forward pass of the target. The output has the same distribution as normal
+ *        decoding (identical output for greedy search). Requires batch_size 1 and the CPU device.
+ * \param[in] params The generator params to update.
+ * \param[in] draft_model A model created with OgaCreateDraftModel. The params keep a reference to it.
+ * \param[in] num_draft_tokens Tokens proposed per step.
+ * \return OgaResult containing the error message if the draft model could not be set.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetDraftModel(OgaGeneratorParams* params, const OgaModel* draft_model, int32_t num_draft_tokens);
+
+/**
+ * \brief Enables prompt lookup decoding: each GenerateNextToken call matches the last tokens of the sequence (the
+ *        longest n-gram up to max_ngram_size that occurred before) and proposes the up to num_draft_tokens tokens
+ *        that followed it, verified in one forward pass. Needs no draft model; works best when the output copies
+ *        spans of the prompt (summaries, code edits). Same output guarantees and requirements as
+ *        OgaGeneratorParamsSetDraftModel.
+ * \param[in] params The generator params to update.
+ * \param[in] max_ngram_size Longest n-gram to match, 3 is a good default.
+ * \param[in] num_draft_tokens Most tokens proposed per step.
+ * \return OgaResult containing the error message if the arguments are invalid.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetPromptLookup(OgaGeneratorParams* params, int32_t max_ngram_size, int32_t num_draft_tokens);
+
+/**
+ * \brief Enables lookahead decoding for greedy search: each GenerateNextToken call runs window_size guessed tokens
+ *        with the pending one, refines the guesses from the model's predictions and keeps the n-grams of ngram_size
+ *        they form. N-grams that start with the last token are verified first. Needs no draft model and no repetition
+ *        in the prompt; output is identical to greedy decoding. Requires do_sample false, batch_size 1 and the CPU
+ *        device.
+ * \param[in] params The generator params to update.
+ * \param[in] window_size Guessed tokens per forward pass, 5 to 8 suits CPU decoding.
+ * \param[in] ngram_size Length of the collected n-grams including their first token, at least 2.
+ * \return OgaResult containing the error message if the arguments are invalid.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetLookahead(OgaGeneratorParams* params, int32_t window_size, int32_t ngram_size);
+
+/**
+ * \brief Generates num_completions answers to one prompt while prefilling it only once. The generator produces the
+ *        first completion as usual; OgaGenerator_StartNextCompletion then rewinds to the end of the prompt and
+ *        starts the next one from the kept prompt state. Each completion samples independently. Requires
+ *        batch_size 1.
+ *        Not implemented: decoding the completions together as a batch. Only the prefill is shared; the
+ *        completions decode one after another at batch size 1, so decoding costs n times the forward passes of
+ *        one completion. For one batched forward pass per step, use a generator with batch_size n and the prompt
+ *        appended n times, which prefills it n times.
+ * \param[in] params The generator params to update.
+ * \param[in] num_completions Number of completions, at least 1.
+ * \return OgaResult containing the error message if num_completions is invalid.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetNumCompletions(OgaGeneratorParams* params, int32_t num_completions);
+
+/**
+ * \brief Runs appended tokens in chunks of at most chunk_size tokens. The model outputs logits for every position it
+ *        runs but generation only uses the last one, so chunking bounds the logits output of a long prompt to
+ *        chunk_size rows of vocabulary size. Only applies to batch_size 1.
+ * \param[in] params The generator params to update.
+ * \param[in] chunk_size Most tokens per forward pass when appending, 0 to run every append in one pass.
+ * \return OgaResult containing the error message if chunk_size is negative.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsSetPrefillChunkSize(OgaGeneratorParams* params, int32_t chunk_size);
+
+/*
+ * Repetition control: besides the search options of genai_config.json, OgaGeneratorParamsSetSearchNumber takes
+ * "frequency_penalty" and "presence_penalty" (OpenAI semantics, default 0): the logit of every token generated since
+ * the last append is lowered by frequency_penalty times its count plus presence_penalty. They apply with standard
+ * decoding at batch_size 1 and num_beams 1 on CPU, where "repetition_penalty" and "no_repeat_ngram_size" run in the
+ * same logits pass; OgaCreateGenerator fails for other configurations. Keeping them up to date costs O(1) per token.
+ *
+ * OgaGeneratorParamsSetSearchBool takes "cpu_token_selection" (default false): standard decoding at batch_size 1 and
+ * num_beams 1 on CPU picks tokens with the vectorized argmax and top-k/top-p sampling instead of the search. The
+ * penalties, "no_repeat_ngram_size" and guidance select tokens that way whether it is set or not.
+ */
+
+/**
+ * \brief Adds a stop sequence: generation ends on the step that generates these tokens in a row, and
+ *        OgaGenerator_IsDone returns true right after it. The sequence keeps the stop tokens, like an EOS token.
+ *        Tokens a multi-token decoding step produced past the stop are dropped. Requires batch_size 1.
+ * \param[in] params The generator params to update.
+ * \param[in] tokens The stop sequence, a single token for a stop token.
+ * \param[in] token_count Number of tokens, at least 1.
+ * \return OgaResult containing the error message if the sequence is empty.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsAddStopSequence(OgaGeneratorParams* params, const int32_t* tokens, size_t token_count);
+
+/**
+ * \brief Adds the tokens of text as a stop sequence, see OgaGeneratorParamsAddStopSequence. Special tokens such as
+ *        "<|end|>" become a single stop token. Other text matches when the model generates the same tokens the
+ *        tokenizer encodes it to on its own.
+ * \param[in] params The generator params to update.
+ * \param[in] tokenizer The model's tokenizer.
+ * \param[in] text The stop string.
+ * \return OgaResult containing the error message if text encodes to no tokens.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGeneratorParamsAddStopString(OgaGeneratorParams* params, const OgaTokenizer* tokenizer, const char* text);
+
+/**
+ * \brief Ends the current completion and starts the next one right after the prompt, see
+ *        OgaGeneratorParamsSetNumCompletions. Appending tokens starts a new prompt with a new set of completions.
+ * \param[in] generator The generator.
+ * \param[out] out True if a next completion was started, false when all of them have been generated.
+ * \return OgaResult containing the error message if no completion has been started yet.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_StartNextCompletion(OgaGenerator* generator, bool* out);
+
+/**
+ * \brief Returns the generator to the state of a new one, with no tokens, while keeping its KV cache, logits, input
+ *        and position buffers, so a pool of generators can serve one request after the other without creating them
+ *        again. Requires batch_size 1. The logits callback is removed and the decoding stats start over. Sampling
+ *        starts over from random_seed: after a reset it runs on CPU as with cpu_token_selection, so with a seed it
+ *        matches a new generator that has cpu_token_selection set.
+ * \param[in] generator The generator.
+ * \param[in] params Params for the next request, created for the same model, or null to keep the current ones.
+ *        Sampling options, penalties, stop sequences, guidance and decoding modes can change; batch_size, num_beams
+ *        and max_length have to stay the same. Only generators decoding on CPU with num_beams 1 take new params.
+ * \return OgaResult containing the error message if the generator can't be reset or params don't fit it, which leaves
+ *         its params unchanged.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_Reset(OgaGenerator* generator, const OgaGeneratorParams* params);
+
+/**
+ * \brief Returns the tokens the last OgaGenerator_GenerateNextToken call added to the sequence. Decoding modes that
+ *        accept several tokens per step return all of them here, OgaGenerator_GetNextTokens only has the last one.
+ * \param[in] generator The generator.
+ * \param[out] out Pointer to the tokens, valid until the next call that changes the generator.
+ * \param[out] out_count Number of tokens.
+ * \return OgaResult containing the error message if getting the tokens failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetLastStepTokens(const OgaGenerator* generator, const int32_t** out, size_t* out_count);
+
+/**
+ * \brief Returns the tokens of a sequence from position *cursor to its end and moves *cursor to the end, so polling
+ *        after every step only reads the new tokens instead of copying the whole sequence like
+ *        OgaGenerator_GetSequenceData. Start with *cursor at 0. After OgaGenerator_RewindTo, a cursor past the new length
+ *        has to be set back by the caller. Requires num_beams 1.
+ * \param[in] generator The generator.
+ * \param[in] index The sequence.
+ * \param[in,out] cursor Position of the first token to return, the sequence length on return.
+ * \param[out] out Pointer to the tokens, valid until the next call that changes the generator.
+ * \param[out] out_count Number of tokens.
+ * \return OgaResult containing the error message if *cursor is past the end of the sequence or num_beams is not 1.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetSequenceSince(const OgaGenerator* generator, size_t index, size_t* cursor,
+                                                                 const int32_t** out, size_t* out_count);
+
+/**
+ * \brief Generates up to max_tokens tokens in one call instead of one OgaGenerator_GenerateNextToken,
+ *        OgaGenerator_GetNextTokens, OgaTokenizerStreamDecode and OgaGenerator_IsDone round trip per token. Steps until
+ *        the generator is done (EOS, max_length or a stop sequence, whose tokens are returned like any other) or
+ *        out_tokens is full, and decodes the new tokens with tokenizer_stream into out_text. Tokens of a multi-token
+ *        step beyond max_tokens and text beyond text_capacity are kept and returned first by the next call; text is
+ *        never cut inside a UTF-8 character and generation pauses while text is waiting. Appending tokens or
+ *        rewinding drops what is kept. Requires batch_size 1.
+ * \param[in] generator The generator.
+ * \param[in] max_tokens Capacity of out_tokens, at least 1.
+ * \param[in] tokenizer_stream Decodes the tokens, null for no text. Not used when out_text is null.
+ * \param[out] out_tokens The new tokens.
+ * \param[out] out_token_count Number of tokens written.
+ * \param[out] out_text The decoded text, null-terminated. Can be null.
+ * \param[in] text_capacity Size of out_text in bytes, the terminator included. At least 5 (the longest UTF-8 character
+ *            and the terminator) when tokenizer_stream is not null.
+ * \param[out] out_text_length Length of the text written without the terminator. Can be null.
+ * \param[out] out_done True once the generator is done and everything has been returned.
+ * \return OgaResult containing the error message if generating failed or text_capacity is too small.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GenerateTokens(OgaGenerator* generator, size_t max_tokens, OgaTokenizerStream* tokenizer_stream,
+                                                               int32_t* out_tokens, size_t* out_token_count, char* out_text,
+                                                               size_t text_capacity, size_t* out_text_length, bool* out_done);
+
+/**
+ * \brief Generates on a worker thread owned by the library until the generator is done, callback returns false or
+ *        the generation is cancelled, calling callback with the tokens and text of every step. The generator and
+ *        tokenizer_stream must not be used by anything else until OgaAsyncGeneration_Join returns, and must outlive
+ *        the generation. Any number of generators can generate at the same time this way.
+ * \param[in] generator The generator, with its prompt appended.
+ * \param[in] tokenizer_stream Decodes the tokens, null for no text. Not used when out_text is null.
+ * \param[in] callback Receives the tokens of each step.
+ * \param[in] user_data Passed to callback as is.
+ * \param[out] out The running generation, destroy with OgaDestroyAsyncGeneration.
+ * \return OgaResult containing the error message if the worker thread could not be started.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_StartAsync(OgaGenerator* generator, OgaTokenizerStream* tokenizer_stream,
+                                                           OgaTokenCallback callback, void* user_data, OgaAsyncGeneration** out);
+
+/**
+ * \brief Stops the generation after the step in progress. Returns right away, safe to call from any thread.
+ */
+OGA_EXPORT void OGA_API_CALL OgaAsyncGeneration_Cancel(OgaAsyncGeneration* generation);
+
+/**
+ * \brief Returns true once the generation has ended. Safe to call from any thread.
+ */
+OGA_EXPORT bool OGA_API_CALL OgaAsyncGeneration_IsDone(const OgaAsyncGeneration* generation);
+
+/**
+ * \brief Waits until the generation has ended. Safe to call from any thread except from inside the callback, and
+ *        more than once.
+ * \param[in] generation The generation.
+ * \return OgaResult containing the error message the generation failed with, if it did.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaAsyncGeneration_Join(OgaAsyncGeneration* generation);
+
+/**
+ * \brief Cancels the generation, waits for it to end and frees it.
+ */
+OGA_EXPORT void OGA_API_CALL OgaDestroyAsyncGeneration(OgaAsyncGeneration* generation);
+
+/**
+ * \brief Returns the decoding counters of the generator: acceptance rate is accepted_tokens / proposed_tokens and
+ *        decode throughput is generated_tokens / decode_ms.
+ * \param[in] generator The generator.
+ * \param[out] out The counters.
+ * \return OgaResult containing the error message if getting the counters failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetDecodingStats(const OgaGenerator* generator, OgaDecodingStats* out);
+
+/**
+ * \brief OgaGenerator_GetLogits without the copy: a view of the logits the next token is chosen from, float32 of shape
+ *        [batch_size, 1, vocab_size]. On the CPU device it points at the generator's own logits, so nothing is
+ *        allocated or copied; other devices copy the logits to host memory the generator keeps for them. Use
+ *        OgaGenerator_SetLogits to change them.
+ * \param[in] generator The generator.
+ * \param[out] out The view, valid until the next call that changes the generator.
+ * \return OgaResult containing the error message if computing the logits failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetLogitsView(OgaGenerator* generator, OgaTensorView* out);
+
+/**
+ * \brief OgaGenerator_GetOutput without the copy: a view of the named output of the last forward pass. The output
+ *        has to be in CPU memory, use OgaGenerator_GetOutput for outputs on other devices.
+ * \param[in] generator The generator.
+ * \param[in] name The model output name.
+ * \param[out] out The view, valid until the next call that changes the generator.
+ * \return OgaResult containing the error message if there is no such output or it isn't in CPU memory.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_GetOutputView(OgaGenerator* generator, const char* name, OgaTensorView* out);
+
+/**
+ * \brief Registers a logits processor: every OgaGenerator_GenerateNextToken calls callback on the inference thread
+ *        with the logits of the next token, after the forward pass and before the token is chosen. It edits them in
+ *        place, without the tensor copies of OgaGenerator_GetLogits / OgaGenerator_SetLogits (on CPU the logits are
+ *        the generator's own; other devices copy them to the host and back). Temperature, top_k / top_p, the
+ *        penalties and guidance apply after the callback. Fails with speculative, prompt lookup and lookahead
+ *        decoding, which choose tokens from logits of their own.
+ * \param[in] generator The generator.
+ * \param[in] callback The callback, or null to remove it.
+ * \param[in] user_data Passed to callback as is.
+ * \return OgaResult containing the error message if the generator's decoding mode doesn't support callbacks.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaGenerator_SetLogitsCallback(OgaGenerator* generator, OgaLogitsCallback callback, void* user_data);
+
+/**
+ * \brief Teacher-forced scoring: runs prompt followed by continuation through the model in one forward pass and
+ *        returns the log-probability of every continuation token given everything before it. Sum them for the
+ *        log-probability of the whole continuation.
+ * \param[in] model The model.
+ * \param[in] prompt The prompt tokens, at least one.
+ * \param[in] prompt_count Number of prompt tokens.
+ * \param[in] continuation The tokens to score.
+ * \param[in] continuation_count Number of tokens to score.
+ * \param[in] top_k Also return the top_k most likely tokens at each continuation position, 0 for none.
+ * \param[out] out The scores, destroy with OgaDestroySequenceScores.
+ * \return OgaResult containing the error message if scoring failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaScoreSequence(const OgaModel* model, const int32_t* prompt, size_t prompt_count,
+                                                    const int32_t* continuation, size_t continuation_count, size_t top_k,
+                                                    OgaSequenceScores** out);
+
+/**
+ * \brief Batched OgaScoreSequence: scores continuations[i] after prompts[i] for every i in one forward pass of
+ *        batch size equal to the sequence count. Sequences are padded to the longest one.
+ * \param[in] model The model.
+ * \param[in] prompts The prompts.
+ * \param[in] continuations The continuations to score, as many as prompts.
+ * \param[in] top_k Also return the top_k most likely tokens at each continuation position, 0 for none.
+ * \param[out] out The scores, one entry per prompt. Destroy with OgaDestroySequenceScores.
+ * \return OgaResult containing the error message if scoring failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaScoreSequences(const OgaModel* model, const OgaSequences* prompts,
+                                                     const OgaSequences* continuations, size_t top_k, OgaSequenceScores** out);
+
+/**
+ * \brief Returns the number of scored continuations.
+ */
+OGA_EXPORT size_t OGA_API_CALL OgaSequenceScores_GetCount(const OgaSequenceScores* scores);
+
+/**
+ * \brief Returns the log-probability of every token of continuation index.
+ * \param[in] scores The scores.
+ * \param[in] index The continuation.
+ * \param[out] out The log-probabilities, valid until scores is destroyed.
+ * \param[out] out_count Number of log-probabilities, the continuation's token count.
+ * \return OgaResult containing the error message if index is out of range.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaSequenceScores_GetLogProbs(const OgaSequenceScores* scores, size_t index,
+                                                                 const float** out, size_t* out_count);
+
+/**
+ * \brief Returns the top_k alternatives at every position of continuation index: top_k entries per continuation
+ *        token, most likely first.
+ * \param[in] scores The scores.
+ * \param[in] index The continuation.
+ * \param[out] out_tokens The alternative tokens, valid until scores is destroyed.
+ * \param[out] out_logprobs Their log-probabilities.
+ * \param[out] out_count Number of entries, continuation token count times top_k.
+ * \return OgaResult containing the error message if index is out of range.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaSequenceScores_GetTopK(const OgaSequenceScores* scores, size_t index,
+                                                             const int32_t** out_tokens, const float** out_logprobs,
+                                                             size_t* out_count);
+
+OGA_EXPORT void OGA_API_CALL OgaDestroySequenceScores(OgaSequenceScores* scores);
+
+/**
+ * \brief OgaTokenizerDecode into a caller's buffer instead of a string to destroy with OgaDestroyString, so decoding
+ *        at a high rate doesn't allocate and free a result string every time. The text is written with its null
+ *        terminator when it fits, that is when *out_length < capacity; otherwise buffer is left unchanged and the call
+ *        can be repeated with a buffer of *out_length + 1 bytes. A null buffer or capacity 0 only reports the length.
+ * \param[in] tokenizer The tokenizer.
+ * \param[in] tokens The tokens to decode.
+ * \param[in] token_count Number of tokens.
+ * \param[out] buffer Receives the text, may be null.
+ * \param[in] capacity Size of buffer in bytes, the terminator included.
+ * \param[out] out_length Length of the text in bytes, without the terminator, whether it fit or not.
+ * \return OgaResult containing the error message if decoding failed.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaTokenizerDecodeInto(const OgaTokenizer* tokenizer, const int32_t* tokens, size_t token_count,
+                                                          char* buffer, size_t capacity, size_t* out_length);
+
+/**
+ * \brief OgaTokenizerApplyChatTemplate into a caller's buffer, same buffer rules as OgaTokenizerDecodeInto.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaTokenizerApplyChatTemplateInto(const OgaTokenizer* tokenizer, const char* template_str,
+                                                                     const char* messages, const char* tools,
+                                                                     bool add_generation_prompt, char* buffer,
+                                                                     size_t capacity, size_t* out_length);
+
+/**
+ * \brief OgaProcessorDecode into a caller's buffer, same buffer rules as OgaTokenizerDecodeInto.
+ */
+OGA_EXPORT OgaResult* OGA_API_CALL OgaProcessorDecodeInto(const OgaMultiModalProcessor* processor, const int32_t* tokens,
+                                                          size_t token_count, char* buffer, size_t capacity, size_t* out_length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,627 @@
+// phi3_server.cpp - Local OpenAI-compatible HTTP server for Phi-3 (Linux)
+//
+// Keeps the model resident and serves POST /v1/chat/completions on localhost, with server-sent events when
+// "stream": true. Connections are handled by a small I/O thread pool; all generation goes through one shared
+// GenerationScheduler, so interactive requests preempt background ones between decode steps.
+//
+// Usage: phi3_server <model_path> [--host 127.0.0.1] [--port 8080] [--io-threads 4] [--max-tokens 256]
+//                    [--context-tokens 4096]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "generation_scheduler.h"
+#include "oga_utils.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+struct ServerOptions {
+    std::string model_path;
+    std::string host{"127.0.0.1"};
+    int port{8080};
+    int io_threads{4};
+    int default_max_tokens{256};
+    int context_tokens{4096};  // Prompt and response together, the model's context length
+};
+
+// An idle connection gives up its I/O thread after this long
+constexpr int kReceiveTimeoutSeconds = 30;
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    std::string error;  // Set when the request is malformed; answered with 400 instead of being handled
+
+    std::string Header(const std::string& name) const {
+        for (const auto& [key, value] : headers) {
+            if (strcasecmp(key.c_str(), name.c_str()) == 0) {
+                return value;
+            }
+        }
+        return {};
+    }
+};
+
+bool SendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool ReadRequest(int fd, HttpRequest& request) {
+    constexpr size_t kMaxRequestBytes = 1 << 20;
+    std::string data;
+    char buffer[4096];
+    size_t header_end = std::string::npos;
+
+    while (header_end == std::string::npos) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0 || data.size() > kMaxRequestBytes) {
+            return false;
+        }
+        data.append(buffer, static_cast<size_t>(n));
+        header_end = data.find("\r\n\r\n");
+    }
+
+    std::istringstream head(data.substr(0, header_end));
+    std::string line;
+    std::getline(head, line);
+    std::istringstream request_line(line);
+    std::string version;
+    request_line >> request.method >> request.path >> version;
+    while (std::getline(head, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        auto colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        auto value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        request.headers.emplace_back(line.substr(0, colon), value);
+    }
+
+    size_t content_length = 0;
+    auto length_header = request.Header("Content-Length");
+    if (!length_header.empty()) {
+        const char* end = length_header.data() + length_header.size();
+        auto [parsed_end, error] = std::from_chars(length_header.data(), end, content_length);
+        if (error != std::errc{} || parsed_end != end) {
+            request.error = "Content-Length must be a non-negative integer";
+            return true;
+        }
+    }
+    if (content_length > kMaxRequestBytes) {
+        return false;
+    }
+
+    request.body = data.substr(header_end + 4);
+    while (request.body.size() < content_length) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        request.body.append(buffer, static_cast<size_t>(n));
+    }
+    request.body.resize(content_length);
+    return true;
+}
+
+const char* StatusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+void SendJson(int fd, int status, const json& body) {
+    std::string payload = body.dump();
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << " " << StatusText(status) << "\r\n"
+             << "Content-Type: application/json\r\n"
+             << "Content-Length: " << payload.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << payload;
+    SendAll(fd, response.str());
+}
+
+void SendError(int fd, int status, const std::string& message) {
+    SendJson(fd, status, {{"error", {{"message", message}, {"type", "invalid_request_error"}}}});
+}
+
+// Tokens flow from the inference thread to the connection's I/O thread through this channel, so decoding
+// and socket writes never hold up the decode loop.
+struct TokenChannel {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<int32_t> tokens;
+    bool done{};
+    GenerationResult result;
+    std::atomic<bool> client_gone{false};
+};
+
+class ChatServer {
+public:
+    ChatServer(const ServerOptions& options, OgaModel* model, OgaTokenizer* tokenizer)
+        : options_{options}, tokenizer_{tokenizer}, scheduler_{model} {
+        OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer_, "<|end|>", &end_token_id_));
+    }
+
+    // Completes every queued and running request as cancelled, so no handler waits for its tokens any longer.
+    // Requests submitted afterwards fail.
+    void Shutdown() { scheduler_.Shutdown(); }
+
+    void HandleConnection(int fd) {
+        HttpRequest request;
+        if (!ReadRequest(fd, request)) {
+            return;
+        }
+        if (!request.error.empty()) {
+            SendError(fd, 400, request.error);
+            return;
+        }
+
+        try {
+            if (request.path == "/health") {
+                SendJson(fd, 200, {{"status", "ok"}});
+            } else if (request.path == "/v1/models") {
+                SendJson(fd, 200, {{"object", "list"},
+                                   {"data", json::array({{{"id", kModelName}, {"object", "model"}, {"owned_by", "local"}}})}});
+            } else if (request.path == "/v1/chat/completions") {
+                if (request.method != "POST") {
+                    SendError(fd, 405, "Use POST for /v1/chat/completions");
+                    return;
+                }
+                HandleChatCompletion(fd, request);
+            } else {
+                SendError(fd, 404, "Unknown path: " + request.path);
+            }
+        } catch (const json::exception& e) {
+            SendError(fd, 400, std::string("Invalid JSON: ") + e.what());
+        } catch (const std::exception& e) {
+            SendError(fd, 500, e.what());
+        }
+    }
+
+private:
+    static constexpr const char* kModelName = "phi3";
+
+    // Phi-3 chat template, matching the format the app and demos use
+    std::string BuildPrompt(const json& messages) const {
+        if (!messages.is_array() || messages.empty()) {
+            throw std::invalid_argument("messages must be a non-empty array");
+        }
+        std::string prompt;
+        for (const auto& message : messages) {
+            std::string role = message.at("role").get<std::string>();
+            if (role != "system" && role != "user" && role != "assistant") {
+                throw std::invalid_argument("Unsupported message role: " + role);
+            }
+            prompt += "<|" + role + "|>\n" + message.at("content").get<std::string>() + " <|end|>\n";
+        }
+        prompt += "<|assistant|>";
+        return prompt;
+    }
+
+    std::vector<int32_t> Encode(const std::string& prompt) const {
+        OgaSequences* sequences = nullptr;
+        OgaThrowIfFailed(OgaCreateSequences(&sequences));
+        OgaSequencesPtr owned{sequences};
+        {
+            std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+            OgaThrowIfFailed(OgaTokenizerEncode(tokenizer_, prompt.c_str(), sequences));
+        }
+        const int32_t* data = OgaSequencesGetSequenceData(sequences, 0);
+        return {data, data + OgaSequencesGetSequenceCount(sequences, 0)};
+    }
+
+    void HandleChatCompletion(int fd, const HttpRequest& http_request) {
+        json body = json::parse(http_request.body);
+
+        GenerationRequest request;
+        try {
+            request.prompt_tokens = Encode(BuildPrompt(body.at("messages")));
+        } catch (const std::invalid_argument& e) {
+            SendError(fd, 400, e.what());
+            return;
+        }
+        request.max_new_tokens = options_.default_max_tokens;
+        if (body.contains("max_tokens")) {
+            if (!body["max_tokens"].is_number_integer() || body["max_tokens"].get<int64_t>() < 1) {
+                SendError(fd, 400, "max_tokens must be a positive integer");
+                return;
+            }
+            request.max_new_tokens = static_cast<int>(
+                std::min<int64_t>(body["max_tokens"].get<int64_t>(), options_.context_tokens));
+        }
+        // The response gets whatever the prompt leaves of the context, and finishes with "length" there
+        const int context_left = options_.context_tokens - static_cast<int>(request.prompt_tokens.size());
+        if (context_left < 1) {
+            SendError(fd, 400, "The messages take " + std::to_string(request.prompt_tokens.size()) +
+                                   " tokens, the context holds " + std::to_string(options_.context_tokens));
+            return;
+        }
+        request.max_new_tokens = std::min(request.max_new_tokens, context_left);
+        if (body.contains("temperature") || body.contains("top_p")) {
+            request.temperature = body.value("temperature", 1.0);
+            request.top_p = body.value("top_p", 1.0);
+            request.do_sample = request.temperature > 0.0;
+        }
+        request.frequency_penalty = body.value("frequency_penalty", 0.0);
+        request.presence_penalty = body.value("presence_penalty", 0.0);
+        if (std::abs(request.frequency_penalty) > 2.0 || std::abs(request.presence_penalty) > 2.0) {
+            SendError(fd, 400, "frequency_penalty and presence_penalty must be between -2 and 2");
+            return;
+        }
+        request.stop_token_ids = {end_token_id_};
+        if (body.contains("response_format")) {
+            const std::string type = body["response_format"].value("type", std::string{"text"});
+            if (type == "json_object") {
+                request.guidance_type = "json_object";
+            } else if (type != "text") {
+                SendError(fd, 400, "Unsupported response_format type: " + type);
+                return;
+            }
+        }
+
+        // Extension: "priority": "interactive" | "normal" | "background" (default interactive)
+        std::string priority = body.value("priority", std::string{"interactive"});
+        if (priority == "background") {
+            request.priority = GenerationPriority::Background;
+        } else if (priority == "normal") {
+            request.priority = GenerationPriority::Normal;
+        } else {
+            request.priority = GenerationPriority::Interactive;
+        }
+
+        auto channel = std::make_shared<TokenChannel>();
+        request.on_token = [channel](int32_t token) {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            channel->tokens.push_back(token);
+            channel->changed.notify_one();
+            return !channel->client_gone.load();
+        };
+        request.on_complete = [channel](const GenerationResult& result) {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            channel->result = result;
+            channel->done = true;
+            channel->changed.notify_one();
+        };
+
+        const size_t prompt_token_count = request.prompt_tokens.size();
+        const int max_new_tokens = request.max_new_tokens;
+        const bool stream = body.value("stream", false);
+        const std::string id = "chatcmpl-" + std::to_string(next_completion_id_++);
+        const auto created = static_cast<int64_t>(std::time(nullptr));
+
+        OgaTokenizerStream* tokenizer_stream = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+            OgaThrowIfFailed(OgaCreateTokenizerStream(tokenizer_, &tokenizer_stream));
+        }
+        OgaTokenizerStreamPtr stream_owner{tokenizer_stream};
+
+        uint64_t job_id = scheduler_.Submit(std::move(request));
+
+        if (stream) {
+            std::string headers =
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Connection: close\r\n\r\n";
+            if (!SendAll(fd, headers)) {
+                channel->client_gone = true;
+                scheduler_.Cancel(job_id);
+            }
+        }
+
+        auto make_chunk = [&](const json& delta, const json& finish_reason) {
+            json chunk = {{"id", id}, {"object", "chat.completion.chunk"}, {"created", created}, {"model", kModelName}};
+            chunk["choices"] = json::array({{{"index", 0}, {"delta", delta}, {"finish_reason", finish_reason}}});
+            return "data: " + chunk.dump() + "\n\n";
+        };
+
+        try {
+            std::string content;
+            bool first_chunk = true;
+            while (true) {
+                std::deque<int32_t> tokens;
+                bool done;
+                {
+                    std::unique_lock<std::mutex> lock(channel->mutex);
+                    channel->changed.wait(lock, [&] { return channel->done || !channel->tokens.empty(); });
+                    tokens.swap(channel->tokens);
+                    done = channel->done;
+                }
+
+                std::string text;
+                {
+                    std::lock_guard<std::mutex> lock(tokenizer_mutex_);
+                    for (int32_t token : tokens) {
+                        const char* piece = nullptr;
+                        OgaThrowIfFailed(OgaTokenizerStreamDecode(tokenizer_stream, token, &piece));
+                        text += piece;
+                    }
+                }
+                content += text;
+
+                if (stream && !channel->client_gone && (!text.empty() || first_chunk)) {
+                    json delta = {{"content", text}};
+                    if (first_chunk) {
+                        delta["role"] = "assistant";
+                        first_chunk = false;
+                    }
+                    if (!SendAll(fd, make_chunk(delta, nullptr))) {
+                        channel->client_gone = true;
+                        scheduler_.Cancel(job_id);
+                    }
+                }
+
+                if (done) {
+                    break;
+                }
+            }
+
+            const auto& result = channel->result;
+            if (!result.error.empty()) {
+                if (stream) {
+                    SendAll(fd, "data: " + json{{"error", {{"message", result.error}}}}.dump() + "\n\n");
+                } else {
+                    SendError(fd, 500, result.error);
+                }
+                return;
+            }
+            if (channel->client_gone) {
+                return;
+            }
+
+            const char* finish_reason = result.tokens.size() >= static_cast<size_t>(max_new_tokens) ? "length" : "stop";
+            if (stream) {
+                SendAll(fd, make_chunk(json::object(), finish_reason) + "data: [DONE]\n\n");
+                return;
+            }
+
+            json response = {{"id", id}, {"object", "chat.completion"}, {"created", created}, {"model", kModelName}};
+            response["choices"] = json::array({{{"index", 0},
+                                                {"message", {{"role", "assistant"}, {"content", content}}},
+                                                {"finish_reason", finish_reason}}});
+            response["usage"] = {{"prompt_tokens", prompt_token_count},
+                                 {"completion_tokens", result.tokens.size()},
+                                 {"total_tokens", prompt_token_count + result.tokens.size()}};
+            SendJson(fd, 200, response);
+        } catch (const std::exception& e) {
+            // Stop generating for a response that won't be finished
+            channel->client_gone = true;
+            scheduler_.Cancel(job_id);
+            if (!stream) {
+                throw;
+            }
+            // The status line has been sent, report the error in the event stream and close it
+            SendAll(fd, "data: " + json{{"error", {{"message", e.what()}, {"type", "server_error"}}}}.dump() + "\n\n");
+        }
+    }
+
+    ServerOptions options_;
+    OgaTokenizer* tokenizer_;
+    // Every I/O thread encodes and decodes with the one tokenizer. Nothing documents that a tokenizer can be used
+    // from several threads at once, so its calls take turns. They take microseconds, decode steps take milliseconds.
+    mutable std::mutex tokenizer_mutex_;
+    GenerationScheduler scheduler_;
+    int32_t end_token_id_{-1};
+    std::atomic<uint64_t> next_completion_id_{1};
+};
+
+// Fixed pool of connection handlers fed by the accept loop
+class IoThreadPool {
+public:
+    IoThreadPool(int thread_count, ChatServer& server) : server_{server} {
+        for (int i = 0; i < thread_count; i++) {
+            threads_.emplace_back([this] { Run(); });
+        }
+    }
+
+    ~IoThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            // Wake handlers blocked on idle keep-alive or slow clients; queued connections fail their first read
+            for (int fd : active_) {
+                shutdown(fd, SHUT_RDWR);
+            }
+            for (int fd : connections_) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        // Handlers waiting for a response would otherwise wait for it and every request queued ahead of it
+        server_.Shutdown();
+        available_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Enqueue(int fd) {
+        timeval timeout{};
+        timeout.tv_sec = kReceiveTimeoutSeconds;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connections_.push_back(fd);
+        }
+        available_.notify_one();
+    }
+
+private:
+    void Run() {
+        while (true) {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                available_.wait(lock, [this] { return stopping_ || !connections_.empty(); });
+                if (connections_.empty()) {
+                    return;
+                }
+                fd = connections_.front();
+                connections_.pop_front();
+                active_.insert(fd);
+            }
+            server_.HandleConnection(fd);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                active_.erase(fd);
+            }
+            close(fd);
+        }
+    }
+
+    ChatServer& server_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::deque<int> connections_;
+    std::unordered_set<int> active_;  // Connections a handler is working on
+    std::vector<std::thread> threads_;
+    bool stopping_{};
+};
+
+std::atomic<bool> g_stop_server{false};
+int g_listen_fd = -1;
+
+void HandleSignal(int) {
+    g_stop_server = true;
+    if (g_listen_fd >= 0) {
+        shutdown(g_listen_fd, SHUT_RDWR);
+    }
+}
+
+bool ParseArguments(int argc, char* argv[], ServerOptions& options) {
+    if (argc < 2) {
+        return false;
+    }
+    options.model_path = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--host") {
+            options.host = value;
+        } else if (flag == "--port") {
+            options.port = std::stoi(value);
+        } else if (flag == "--io-threads") {
+            options.io_threads = std::max(1, std::stoi(value));
+        } else if (flag == "--max-tokens") {
+            options.default_max_tokens = std::max(1, std::stoi(value));
+        } else if (flag == "--context-tokens") {
+            options.context_tokens = std::max(2, std::stoi(value));
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    ServerOptions options;
+    if (!ParseArguments(argc, argv, options)) {
+        std::cout << "Usage: " << argv[0]
+                  << " <model_path> [--host 127.0.0.1] [--port 8080] [--io-threads 4] [--max-tokens 256]"
+                  << " [--context-tokens 4096]\n";
+        return 1;
+    }
+
+    try {
+        std::cout << "📚 Loading model from: " << options.model_path << "\n";
+        OgaModel* model = nullptr;
+        OgaThrowIfFailed(OgaCreateModel(options.model_path.c_str(), &model));
+        OgaModelPtr model_owner{model};
+
+        OgaTokenizer* tokenizer = nullptr;
+        OgaThrowIfFailed(OgaCreateTokenizer(model, &tokenizer));
+        OgaTokenizerPtr tokenizer_owner{tokenizer};
+
+        g_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (g_listen_fd < 0) {
+            throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+        }
+        int reuse = 1;
+        setsockopt(g_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(options.port));
+        if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+            throw std::runtime_error("Invalid host address: " + options.host);
+        }
+        if (bind(g_listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            listen(g_listen_fd, 64) < 0) {
+            throw std::runtime_error(std::string("bind/listen: ") + std::strerror(errno));
+        }
+
+        signal(SIGINT, HandleSignal);
+        signal(SIGTERM, HandleSignal);
+
+        {
+            ChatServer server(options, model, tokenizer);
+            IoThreadPool pool(options.io_threads, server);
+            std::cout << "🚀 Serving on http://" << options.host << ":" << options.port
+                      << " with " << options.io_threads << " I/O threads\n";
+
+            while (!g_stop_server) {
+                int client = accept(g_listen_fd, nullptr, nullptr);
+                if (client < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                pool.Enqueue(client);
+            }
+        }
+
+        close(g_listen_fd);
+        std::cout << "👋 Server stopped\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "❌ Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,206 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+#include "sampling_cpu.h"
+#include "logits_pipeline_cpu.h"
+#include "vector_math_cpu.h"
+
+namespace Generators {
+
+bool IsGreedySearch(const Config::Search& search) {
+  return !search.do_sample || search.top_k == 1 || search.temperature == 0.0f;
+}
+
+bool IsEosToken(const Config& config, int32_t token) {
+  const auto& eos_token_ids = config.model.eos_token_id;
+  return std::find(eos_token_ids.begin(), eos_token_ids.end(), token) != eos_token_ids.end();
+}
+
+int32_t ArgMax(std::span<const float> logits) {
+  return static_cast<int32_t>(IndexOfMax(logits));
+}
+
+namespace {
+
+// Probabilities here are in [0, 1], where the float bit pattern orders like the value. A bucket is the exponent and the
+// top 4 mantissa bits, so every bucket spans less than 7% of its values and higher buckets hold larger probabilities.
+constexpr int kBucketShift = 19;
+constexpr size_t kBucketCount = (std::bit_cast<uint32_t>(1.0f) >> kBucketShift) + 1;
+
+inline size_t Bucket(float probability) {
+  return std::min<size_t>(std::bit_cast<uint32_t>(probability) >> kBucketShift, kBucketCount - 1);
+}
+
+using Candidates = std::vector<std::pair<float, int32_t>>;
+
+struct Histogram {
+  std::array<uint32_t, kBucketCount> counts{};
+  std::array<double, kBucketCount> masses{};
+};
+
+bool HasCut(const Config::Search& search, size_t vocab_size) {
+  return (search.top_k > 0 && static_cast<size_t>(search.top_k) < vocab_size) || (search.top_p > 0.0f && search.top_p < 1.0f);
+}
+
+// exp((logits - max) / temperature) into probs after the logits processors, returns their sum. With a histogram, each
+// tile of probs is counted into it while still in cache.
+float ExpProbs(std::span<const float> logits, const Config::Search& search, const LogitsProcessorInputs& inputs,
+               std::span<float> probs, Histogram* histogram) {
+  assert(probs.size() == logits.size());
+  const float temperature = search.temperature > 0.0f ? search.temperature : 1.0f;
+  float max;
+  if (HasLogitsProcessors(search, inputs)) {
+    max = ProcessLogits(logits, search, inputs, probs);
+    logits = probs;
+  } else {
+    max = ReduceMax(logits);
+  }
+  if (!histogram)
+    return ExpShifted(logits, max, 1.0f / temperature, probs);
+
+  float total = 0.0f;
+  for (size_t begin = 0; begin < logits.size(); begin += kLogitsTileSize) {
+    const size_t size = std::min(kLogitsTileSize, logits.size() - begin);
+    auto tile = probs.subspan(begin, size);
+    total += ExpShifted(logits.subspan(begin, size), max, 1.0f / temperature, tile);
+    for (float probability : tile) {
+      size_t bucket = Bucket(probability);
+      histogram->counts[bucket]++;
+      histogram->masses[bucket] += probability;
+    }
+  }
+  return total;
+}
+
+// The tokens of the top_k / top_p cut, most likely first, and their mass
+float SelectCut(std::span<const float> probs, float total, const Histogram& histogram, const Config::Search& search,
+                Candidates& candidates) {
+  const size_t vocab_size = probs.size();
+  const size_t top_k = search.top_k > 0 ? std::min(static_cast<size_t>(search.top_k), vocab_size) : vocab_size;
+  const bool use_top_p = search.top_p > 0.0f && search.top_p < 1.0f;
+
+  // Lowest bucket the cut can reach. With top_k that is the bucket of the top_k-th token, and every bucket down to it is
+  // needed for the mass top_p applies to. Without it top_p applies to the total, and the cut stops in the bucket where
+  // the mass from the top reaches top_p of it.
+  size_t lowest = kBucketCount - 1;
+  if (top_k < vocab_size) {
+    size_t count = 0;
+    while (lowest > 0 && (count += histogram.counts[lowest]) < top_k)
+      lowest--;
+  } else if (use_top_p) {
+    // A little past the threshold, float rounding must not end the walk a bucket too high
+    const double threshold = search.top_p * static_cast<double>(total) * (1.0 + 1e-5);
+    double mass = 0.0;
+    while (lowest > 0 && (mass += histogram.masses[lowest]) < threshold)
+      lowest--;
+  }
+
+  candidates.clear();
+  for (size_t i = 0; i < vocab_size; i++) {
+    if (Bucket(probs[i]) >= lowest)
+      candidates.emplace_back(probs[i], static_cast<int32_t>(i));
+  }
+  auto by_probability = [](const auto& a, const auto& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); };
+  const size_t kept_k = std::min(top_k, candidates.size());
+  std::partial_sort(candidates.begin(), candidates.begin() + kept_k, candidates.end(), by_probability);
+  candidates.resize(kept_k);
+
+  float kept_mass = total;
+  if (top_k < vocab_size) {
+    kept_mass = 0.0f;
+    for (const auto& candidate : candidates)
+      kept_mass += candidate.first;
+  }
+  if (!use_top_p)
+    return kept_mass;
+
+  const float threshold = search.top_p * kept_mass;
+  float cumulative = 0.0f;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    cumulative += candidates[i].first;
+    if (cumulative >= threshold) {
+      candidates.resize(i + 1);
+      break;
+    }
+  }
+  return cumulative;
+}
+
+}  // namespace
+
+void ComputeSamplingProbs(std::span<const float> logits, const Config::Search& search, std::span<float> probs) {
+  if (!HasCut(search, logits.size())) {
+    const float total = ExpProbs(logits, search, {}, probs, nullptr);
+    for (auto& p : probs)
+      p /= total;
+    return;
+  }
+
+  Histogram histogram;
+  const float total = ExpProbs(logits, search, {}, probs, &histogram);
+  Candidates candidates;
+  const float kept_mass = SelectCut(probs, total, histogram, search, candidates);
+  std::fill(probs.begin(), probs.end(), 0.0f);
+  for (const auto& [probability, token] : candidates)
+    probs[token] = probability / kept_mass;
+}
+
+int32_t SampleToken(std::span<const float> logits, const Config::Search& search, std::mt19937& engine, std::vector<float>& probs) {
+  return SampleToken(logits, search, {}, engine, probs);
+}
+
+int32_t SampleToken(std::span<const float> logits, const Config::Search& search, const LogitsProcessorInputs& inputs,
+                    std::mt19937& engine, std::vector<float>& probs) {
+  probs.resize(logits.size());
+  if (!HasCut(search, logits.size())) {
+    ExpProbs(logits, search, inputs, probs, nullptr);
+    return SampleFromProbs(probs, engine);
+  }
+
+  Histogram histogram;
+  const float total = ExpProbs(logits, search, inputs, probs, &histogram);
+  Candidates candidates;
+  const float kept_mass = SelectCut(probs, total, histogram, search, candidates);
+  float target = std::uniform_real_distribution<float>(0.0f, kept_mass)(engine);
+  for (const auto& [probability, token] : candidates) {
+    if ((target -= probability) < 0.0f)
+      return token;
+  }
+  return candidates.back().second;  // Rounding left target just past the end
+}
+
+int32_t SampleFromProbs(std::span<const float> probs, std::mt19937& engine) {
+  float sum = std::accumulate(probs.begin(), probs.end(), 0.0f);
+  if (!(sum > 0.0f))
+    return ArgMax(probs);
+
+  float target = std::uniform_real_distribution<float>(0.0f, sum)(engine);
+  float cumulative = 0.0f;
+  int32_t last_nonzero = 0;
+  for (size_t i = 0; i < probs.size(); i++) {
+    if (probs[i] <= 0.0f)
+      continue;
+    cumulative += probs[i];
+    last_nonzero = static_cast<int32_t>(i);
+    if (target < cumulative)
+      return last_nonzero;
+  }
+  return last_nonzero;  // Rounding left target just past the end
+}
+
+std::mt19937 CreateSamplingEngine(const Config::Search& search, uint32_t offset) {
+  if (search.random_seed == -1) {
+    std::random_device rd;
+    return std::mt19937{rd() + offset};
+  }
+  return std::mt19937{static_cast<uint32_t>(search.random_seed) + offset};
+}
+
+}  // namespace Generators
@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// CPU token selection on a single row of logits, shared by the decoding modes that verify or score several
+// positions per forward pass (speculative decoding and friends). Search_Cpu only ever sees one position per
+// sequence, so these work on plain spans of one vocabulary row.
+#pragma once
+
+#include <random>
+#include <span>
+#include <vector>
+
+#include "generators.h"
+#include "logits_pipeline_cpu.h"
+
+namespace Generators {
+
+// Sampling settings that always pick the most likely token
+bool IsGreedySearch(const Config::Search& search);
+
+bool IsEosToken(const Config& config, int32_t token);
+
+// Index of the largest logit, the first one on ties
+int32_t ArgMax(std::span<const float> logits);
+
+// The distribution sampling draws from: softmax(logits / temperature), cut to the top_k most likely tokens and then to
+// the smallest set of those whose mass reaches top_p, renormalized. Tokens outside the cut get probability 0.
+// The exp pass is vectorized and the cut needs no sort of the vocabulary: a histogram over the probabilities' float
+// bits finds the few buckets the cut can reach, and only the tokens in those are sorted.
+void ComputeSamplingProbs(std::span<const float> logits, const Config::Search& search, std::span<float> probs);
+
+// Draw a token from the distribution ComputeSamplingProbs gives, without writing the dense row of it: after the exp
+// pass only the tokens inside the cut are touched. probs is scratch space, resized to the vocabulary.
+int32_t SampleToken(std::span<const float> logits, const Config::Search& search, std::mt19937& engine, std::vector<float>& probs);
+
+// SampleToken after the logits processors for inputs (repetition_penalty, the min_length EOS mask), which run in the
+// same pass that finds the maximum
+int32_t SampleToken(std::span<const float> logits, const Config::Search& search, const LogitsProcessorInputs& inputs,
+                    std::mt19937& engine, std::vector<float>& probs);
+
+// Draw a token from (unnormalized, non-negative) probabilities. Falls back to the most likely token if they sum to 0.
+int32_t SampleFromProbs(std::span<const float> probs, std::mt19937& engine);
+
+// Seeded from search.random_seed, or randomly when it is -1. offset decorrelates engines that share the seed.
+std::mt19937 CreateSamplingEngine(const Config::Search& search, uint32_t offset = 0);
+
+}  // namespace Generators
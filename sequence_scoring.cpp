@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <functional>
+
+#include "sequence_scoring.h"
+#include "generator_extensions.h"
+#include "vector_math_cpu.h"
+#include "models/model.h"
+
+namespace Generators {
+
+namespace {
+
+// The k largest logits with their token ids, largest first
+void TopK(std::span<const float> logits, size_t k, std::vector<std::pair<float, int32_t>>& top) {
+  // Min-heap of the best k so far, one pass over the vocabulary
+  top.clear();
+  for (size_t i = 0; i < logits.size(); i++) {
+    if (top.size() < k) {
+      top.emplace_back(logits[i], static_cast<int32_t>(i));
+      std::push_heap(top.begin(), top.end(), std::greater<>{});
+    } else if (logits[i] > top.front().first) {
+      std::pop_heap(top.begin(), top.end(), std::greater<>{});
+      top.back() = {logits[i], static_cast<int32_t>(i)};
+      std::push_heap(top.begin(), top.end(), std::greater<>{});
+    }
+  }
+  std::sort_heap(top.begin(), top.end(), std::greater<>{});
+}
+
+}  // namespace
+
+std::unique_ptr<SequenceScores> ScoreSequences(const Model& model, std::span<const std::span<const int32_t>> prompts,
+                                               std::span<const std::span<const int32_t>> continuations, size_t top_k) {
+  if (prompts.empty() || prompts.size() != continuations.size())
+    throw std::runtime_error("Scoring needs one continuation per prompt");
+
+  const size_t batch_size = prompts.size();
+  std::vector<std::vector<int32_t>> sequences(batch_size);
+  for (size_t i = 0; i < batch_size; i++) {
+    if (prompts[i].empty())
+      throw std::runtime_error("Scoring needs at least one prompt token before the continuation");
+    sequences[i].assign(prompts[i].begin(), prompts[i].end());
+    sequences[i].insert(sequences[i].end(), continuations[i].begin(), continuations[i].end());
+  }
+
+  // PadInputs pads on the right: every sequence starts at position 0 and the pads after it can't change its logits
+  std::vector<std::span<const int32_t>> sequence_spans(sequences.begin(), sequences.end());
+  auto input_ids = PadInputs(sequence_spans, model.config_->model.pad_token_id);
+  const size_t length = input_ids.size() / batch_size;
+
+  auto params = std::make_shared<ExtendedGeneratorParams>(model);
+  params->search.batch_size = static_cast<int>(batch_size);
+  params->search.max_length = static_cast<int>(length + 1);
+  ExtendedGenerator generator{model, *params};
+  generator.AppendTokens(input_ids);
+
+  std::array<int64_t, 3> shape;
+  auto logits = generator.GetRunLogits(shape);
+  if (shape[0] != static_cast<int64_t>(batch_size) || shape[1] != static_cast<int64_t>(length))
+    throw std::runtime_error("Scoring needs the logits of every position, the model's logits output does not have them");
+  const size_t vocab_size = static_cast<size_t>(shape[2]);
+  top_k = std::min(top_k, vocab_size);
+
+  auto scores = std::make_unique<SequenceScores>();
+  scores->top_k = top_k;
+  scores->logprobs.resize(batch_size);
+  scores->top_tokens.resize(batch_size);
+  scores->top_logprobs.resize(batch_size);
+
+  std::vector<std::pair<float, int32_t>> top;
+  for (size_t i = 0; i < batch_size; i++) {
+    const auto continuation = continuations[i];
+    auto& logprobs = scores->logprobs[i];
+    logprobs.reserve(continuation.size());
+
+    for (size_t j = 0; j < continuation.size(); j++) {
+      // The logits after the token before continuation[j]
+      const size_t position = prompts[i].size() - 1 + j;
+      auto row = logits.subspan((i * length + position) * vocab_size, vocab_size);
+      const float normalizer = LogSumExp(row);
+
+      const int32_t token = continuation[j];
+      if (token < 0 || static_cast<size_t>(token) >= vocab_size)
+        throw std::runtime_error("Token id " + std::to_string(token) + " is outside the vocabulary");
+      logprobs.push_back(row[token] - normalizer);
+
+      if (top_k > 0) {
+        TopK(row, top_k, top);
+        for (const auto& [logit, top_token] : top) {
+          scores->top_tokens[i].push_back(top_token);
+          scores->top_logprobs[i].push_back(logit - normalizer);
+        }
+      }
+    }
+  }
+  return scores;
+}
+
+}  // namespace Generators
@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Teacher-forced scoring: the log-probability the model gives each token of a continuation after a prompt, for
+// reranking and evaluation. Prompt and continuation run as one prefill and every position's logits are normalized
+// in place with a vectorized log-sum-exp, so nothing vocabulary-sized is copied out per token.
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "generators.h"
+
+namespace Generators {
+
+struct SequenceScores {
+  size_t top_k{};
+  // One entry per scored sequence: log p(token) of every continuation token
+  std::vector<std::vector<float>> logprobs;
+  // One entry per scored sequence: top_k alternatives per continuation token, most likely first
+  std::vector<std::vector<int32_t>> top_tokens;
+  std::vector<std::vector<float>> top_logprobs;
+};
+
+// Score continuations[i] after prompts[i] for every i in one batched forward pass. Prompts need at least one token.
+std::unique_ptr<SequenceScores> ScoreSequences(const Model& model, std::span<const std::span<const int32_t>> prompts,
+                                               std::span<const std::span<const int32_t>> continuations, size_t top_k);
+
+}  // namespace Generators
@@ -0,0 +1,284 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <chrono>
+
+#include "speculative_decoding.h"
+#include "generator_extensions.h"
+#include "grammar_constraint.h"
+#include "sampling_cpu.h"
+#include "search.h"
+#include "models/model.h"
+
+namespace Generators {
+
+DraftModelProposer::DraftModelProposer(std::shared_ptr<const Model> draft_model, const GeneratorParams& target_params)
+    : model_{std::move(draft_model)},
+      params_{std::make_shared<GeneratorParams>(*model_)},
+      search_{target_params.search},
+      engine_{CreateSamplingEngine(target_params.search, 1)} {
+  if (model_->config_->model.vocab_size != target_params.config.model.vocab_size)
+    throw std::runtime_error("Draft model vocab_size " + std::to_string(model_->config_->model.vocab_size) +
+                             " does not match the target's " + std::to_string(target_params.config.model.vocab_size));
+  params_->search.batch_size = 1;
+  params_->search.max_length = target_params.search.max_length;
+}
+
+void DraftModelProposer::Sync(std::span<const int32_t> sequence) {
+  // Keep the longest common prefix, at least one token must run to get logits for the end of sequence
+  size_t common = std::mismatch(synced_.begin(), synced_.end(), sequence.begin(), sequence.end()).first - synced_.begin();
+  common = std::min(common, sequence.size() - 1);
+
+  if (!generator_ || common == 0) {
+    generator_ = CreateGenerator(*model_, *params_);
+    synced_.clear();
+    common = 0;
+  } else if (common < synced_.size()) {
+    generator_->RewindToLength(common);
+    synced_.resize(common);
+  }
+
+  auto append = sequence.subspan(common);
+  generator_->AppendTokens(append);
+  synced_.insert(synced_.end(), append.begin(), append.end());
+}
+
+void DraftModelProposer::Propose(std::span<const int32_t> sequence, size_t max_tokens, DraftProposal& proposal) {
+  Sync(sequence);
+
+  const bool greedy = IsGreedySearch(search_);
+  const size_t vocab_size = model_->config_->model.vocab_size;
+  for (size_t i = 0; i < max_tokens; i++) {
+    auto logits = generator_->GetLogits().CopyDeviceToCpu();
+    int32_t token;
+    if (greedy) {
+      token = ArgMax(logits);
+    } else {
+      proposal.probs.resize((proposal.tokens.size() + 1) * vocab_size);
+      auto probs = std::span<float>(proposal.probs).subspan(proposal.tokens.size() * vocab_size, vocab_size);
+      ComputeSamplingProbs(logits, search_, probs);
+      token = SampleFromProbs(probs, engine_);
+    }
+    proposal.tokens.push_back(token);
+
+    // The last guess doesn't need to be run, the target runs it during verification
+    if (i + 1 == max_tokens || IsEosToken(*model_->config_, token))
+      break;
+    generator_->AppendTokens(cpu_span<const int32_t>(&token, 1));
+    synced_.push_back(token);
+  }
+}
+
+PromptLookupProposer::PromptLookupProposer(int max_ngram_size)
+    : max_ngram_size_{static_cast<size_t>(std::max(max_ngram_size, 1))} {}
+
+void PromptLookupProposer::Propose(std::span<const int32_t> sequence, size_t max_tokens, DraftProposal& proposal) {
+  const size_t length = sequence.size();
+  for (size_t n = std::min(max_ngram_size_, length > 0 ? length - 1 : 0); n > 0; n--) {
+    auto key = sequence.subspan(length - n);
+    // Most recent match first, it is the most likely to continue the same way
+    for (size_t start = length - n; start-- > 0;) {
+      if (!std::equal(key.begin(), key.end(), sequence.begin() + start))
+        continue;
+      size_t begin = start + n;
+      size_t end = std::min(begin + max_tokens, length);
+      proposal.tokens.insert(proposal.tokens.end(), sequence.begin() + begin, sequence.begin() + end);
+      return;
+    }
+  }
+}
+
+const char* GetMultiTokenDecodingBlocker(const Model& model, const GeneratorParams& params, bool processes_logits) {
+  if (params.search.batch_size != 1 || params.search.num_beams != 1)
+    return "Multi-token decoding requires batch_size 1 and num_beams 1";
+  if (model.p_device_->GetType() != DeviceType::CPU)
+    return "Multi-token decoding is only supported on the CPU device";
+  if (!processes_logits && (params.search.repetition_penalty != 1.0f || params.search.min_length > 0 ||
+                            params.search.no_repeat_ngram_size > 0))
+    return "Multi-token decoding does not support repetition_penalty, min_length or no_repeat_ngram_size";
+  if (!params.guidance_type.empty() && !(processes_logits && IsNativeGuidanceType(params.guidance_type)))
+    return "Multi-token decoding does not support guidance";
+  return nullptr;
+}
+
+MultiTokenDecoder::MultiTokenDecoder(ExtendedGenerator& generator, bool processes_logits)
+    : generator_{generator},
+      search_{generator.GetParams().search},
+      processes_logits_{processes_logits} {
+  if (const char* blocker = GetMultiTokenDecodingBlocker(*generator.model_, generator.GetParams(), processes_logits))
+    throw std::runtime_error(blocker);
+}
+
+void MultiTokenDecoder::Commit(size_t length, size_t run_count, std::span<const int32_t> emitted) {
+  // Everything before the last new token is already in the KV cache, drop the rejected guesses after it.
+  // The last token is committed like a generated one so the search sees EOS and max_length.
+  const size_t keep = length + emitted.size() - 1;
+  if (keep < length + run_count)
+    generator_.RewindToLength(keep);
+  generator_.CommitToken(emitted.back());
+}
+
+SpeculativeDecoder::SpeculativeDecoder(ExtendedGenerator& generator, std::unique_ptr<DraftProposer> proposer, int num_draft_tokens)
+    : MultiTokenDecoder{generator},
+      proposer_{std::move(proposer)},
+      num_draft_tokens_{static_cast<size_t>(std::max(num_draft_tokens, 0))},
+      greedy_{IsGreedySearch(search_)},
+      engine_{CreateSamplingEngine(search_)} {}
+
+int32_t SpeculativeDecoder::SelectToken(std::span<const float> logits) {
+  if (greedy_)
+    return ArgMax(logits);
+  probs_.resize(logits.size());
+  ComputeSamplingProbs(logits, search_, probs_);
+  return SampleFromProbs(probs_, engine_);
+}
+
+void SpeculativeDecoder::Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) {
+  auto& generator = generator_;
+  const Config& config = *generator.model_->config_;
+
+  if (generator.computed_logits_) {
+    // Right after AppendTokens the logits of the last prompt token are ready, the first token needs no draft
+    int32_t token = SelectToken(generator.search_->GetLogits().CopyDeviceToCpu());
+    generator.CommitToken(token);
+    step_tokens.push_back(token);
+    return;
+  }
+
+  // The sequence ends with the pending token, the draft continues from it. Leave room for the target's own token.
+  auto sequence = generator.GetSequence(0).CopyDeviceToCpu();
+  const size_t length = sequence.size();
+  const size_t max_length = static_cast<size_t>(search_.max_length);
+  const size_t max_drafts = std::min(num_draft_tokens_, length + 1 < max_length ? max_length - length - 1 : 0);
+
+  proposal_.tokens.clear();
+  proposal_.probs.clear();
+  if (max_drafts > 0) {
+    auto propose_start = std::chrono::steady_clock::now();
+    proposer_->Propose(sequence, max_drafts, proposal_);
+    stats.propose_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - propose_start).count();
+  }
+  const size_t draft_count = proposal_.tokens.size();
+
+  // One forward pass over the pending token and the drafts gives the target's logits after each of them
+  generator.RunTokens(proposal_.tokens);
+  stats.target_runs++;
+  stats.proposed_tokens += draft_count;
+  auto logits = generator.GetRunLogits(draft_count + 1);
+  const size_t vocab_size = logits.size() / (draft_count + 1);
+
+  emitted_.clear();
+  bool ended_on_draft = false;
+  size_t accepted = 0;
+  for (; accepted < draft_count; accepted++) {
+    auto row = logits.subspan(accepted * vocab_size, vocab_size);
+    const int32_t draft = proposal_.tokens[accepted];
+
+    if (greedy_) {
+      int32_t target = ArgMax(row);
+      if (target != draft) {
+        emitted_.push_back(target);
+        break;
+      }
+    } else {
+      probs_.resize(vocab_size);
+      ComputeSamplingProbs(row, search_, probs_);
+      const float* q = proposal_.probs.empty() ? nullptr : proposal_.probs.data() + accepted * vocab_size;
+      const float draft_prob = q ? q[draft] : 1.0f;
+      float u = std::uniform_real_distribution<float>(0.0f, 1.0f)(engine_);
+      if (u * draft_prob >= probs_[draft]) {
+        // Rejected: sample from the part of the target distribution the draft under-covers
+        if (q) {
+          for (size_t v = 0; v < vocab_size; v++)
+            probs_[v] = std::max(0.0f, probs_[v] - q[v]);
+        } else {
+          probs_[draft] = 0.0f;
+        }
+        emitted_.push_back(SampleFromProbs(probs_, engine_));
+        break;
+      }
+    }
+
+    emitted_.push_back(draft);
+    if (IsEosToken(config, draft)) {
+      accepted++;
+      ended_on_draft = true;
+      break;
+    }
+  }
+  stats.accepted_tokens += accepted;
+
+  // Every draft accepted: the last row gives one more token for free
+  if (accepted == draft_count && !ended_on_draft)
+    emitted_.push_back(SelectToken(logits.subspan(draft_count * vocab_size, vocab_size)));
+
+  Commit(length, draft_count, emitted_);
+
+  step_tokens.insert(step_tokens.end(), emitted_.begin(), emitted_.end());
+}
+
+SamplingDecoder::SamplingDecoder(ExtendedGenerator& generator)
+    : MultiTokenDecoder{generator, true},
+      engine_{CreateSamplingEngine(search_)} {}
+
+void SamplingDecoder::Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) {
+  const LogitsProcessorInputs inputs = generator_.GetProcessorInputs();
+
+  int32_t token;
+  if (generator_.computed_logits_) {
+    token = SampleToken(generator_.search_->GetLogits().CopyDeviceToCpu(), search_, inputs, engine_, probs_);
+  } else {
+    generator_.RunTokens({});
+    stats.target_runs++;
+    token = SampleToken(generator_.GetRunLogits(1), search_, inputs, engine_, probs_);
+  }
+  generator_.CommitToken(token);
+  step_tokens.push_back(token);
+}
+
+GreedyDecoder::GreedyDecoder(ExtendedGenerator& generator)
+    : MultiTokenDecoder{generator, true} {
+  if (!IsGreedySearch(search_))
+    throw std::runtime_error("GreedyDecoder needs greedy search (do_sample false)");
+}
+
+void GreedyDecoder::Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) {
+  std::span<const float> logits;
+  if (generator_.computed_logits_) {
+    logits = generator_.search_->GetLogits().CopyDeviceToCpu();
+  } else {
+    generator_.RunTokens({});
+    stats.target_runs++;
+    logits = generator_.GetRunLogits(1);
+  }
+
+  const LogitsProcessorInputs inputs = generator_.GetProcessorInputs();
+  if (HasLogitsProcessors(search_, inputs)) {
+    processed_.resize(logits.size());
+    ProcessLogits(logits, search_, inputs, processed_);
+    logits = processed_;
+  }
+
+  const int32_t token = ArgMax(logits);
+  generator_.CommitToken(token);
+  step_tokens.push_back(token);
+}
+
+std::shared_ptr<Model> CreateDraftModel(const Model& target, const char* config_path) {
+  auto config = std::make_unique<Config>(fs::path(config_path), std::string_view{});
+
+  // The draft runs as a second session next to the target; a "draft" entry in the target's decoder.pipeline supplies
+  // its session options (threads, providers, config entries), the same way pipeline models get theirs
+  for (const auto& pipeline_model : target.config_->model.decoder.pipeline) {
+    if (pipeline_model.model_id == kDraftModelId && pipeline_model.session_options.has_value())
+      config->model.decoder.session_options = *pipeline_model.session_options;
+  }
+
+  if (config->model.vocab_size != target.config_->model.vocab_size)
+    throw std::runtime_error("Draft model vocab_size " + std::to_string(config->model.vocab_size) +
+                             " does not match the target's " + std::to_string(target.config_->model.vocab_size));
+  return CreateModel(GetOrtEnv(), std::move(config));
+}
+
+}  // namespace Generators
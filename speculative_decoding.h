@@ -0,0 +1,157 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Speculative decoding: a proposer guesses the next few tokens and the target model checks all of them in one
+// forward pass. CPU decode is bound by reading the weights once per step, so verifying k tokens costs about as much
+// as generating one, and every accepted guess is a step saved.
+//
+// Acceptance follows the speculative sampling rule: a draft token x with draft probability q(x) is kept with
+// probability min(1, p(x) / q(x)) under the target distribution p, and the first rejection is replaced by a sample
+// from max(0, p - q). The output therefore has exactly the distribution of normal decoding. With greedy search a draft
+// token is kept when it is the target's argmax, so the output is identical to greedy decoding.
+#pragma once
+
+#include <memory>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "generators.h"
+
+namespace Generators {
+
+struct ExtendedGenerator;
+
+struct DecodingStats {
+  size_t steps{};             // GenerateNextToken calls
+  size_t target_runs{};       // Forward passes of the target model while decoding
+  size_t proposed_tokens{};   // Draft tokens sent for verification
+  size_t accepted_tokens{};   // Draft tokens the target model agreed with
+  size_t generated_tokens{};  // Tokens added to the sequence
+  double propose_ms{};        // Time spent producing drafts
+  double decode_ms{};         // Total time in GenerateNextToken, proposing included
+};
+
+struct DraftProposal {
+  std::vector<int32_t> tokens;
+  // Draft distribution each token was sampled from, tokens.size() rows of vocab_size.
+  // Empty when the proposer is deterministic, the rows are then one-hot on the proposed token.
+  std::vector<float> probs;
+};
+
+struct DraftProposer {
+  virtual ~DraftProposer() = default;
+
+  // Append up to max_tokens guesses for what follows sequence (the whole sequence of the generator)
+  virtual void Propose(std::span<const int32_t> sequence, size_t max_tokens, DraftProposal& proposal) = 0;
+};
+
+// Proposes with a small decoder-only model that shares the target's vocabulary. The draft keeps its own generator
+// and KV cache and follows the target by rewinding to the longest common prefix before each proposal.
+struct DraftModelProposer : DraftProposer {
+  DraftModelProposer(std::shared_ptr<const Model> draft_model, const GeneratorParams& target_params);
+
+  void Propose(std::span<const int32_t> sequence, size_t max_tokens, DraftProposal& proposal) override;
+
+ private:
+  void Sync(std::span<const int32_t> sequence);
+
+  std::shared_ptr<const Model> model_;
+  std::shared_ptr<GeneratorParams> params_;
+  std::unique_ptr<Generator> generator_;
+  std::vector<int32_t> synced_;  // Tokens in the draft's KV cache
+
+  const Config::Search search_;  // The target's sampling settings, the draft samples the same way
+  std::mt19937 engine_;
+};
+
+// Prompt lookup: proposes the tokens that followed the most recent earlier occurrence of the sequence's last n tokens,
+// trying n = max_ngram_size down to 1. Summaries and code edits copy long spans of their prompt, and those are
+// proposed for free: no draft model and nothing kept besides the generator's own sequence.
+struct PromptLookupProposer : DraftProposer {
+  PromptLookupProposer(int max_ngram_size);
+
+  void Propose(std::span<const int32_t> sequence, size_t max_tokens, DraftProposal& proposal) override;
+
+ private:
+  size_t max_ngram_size_;
+};
+
+// Why the decoders below can't replace the search's own decoding for these params, or null if they can: they need
+// batch_size 1, num_beams 1 and the CPU device. Only decoders that run the logits pipeline (processes_logits) apply
+// repetition_penalty, no_repeat_ngram_size, min_length and the guidance types of grammar_constraint.h, and none applies
+// other guidance.
+const char* GetMultiTokenDecodingBlocker(const Model& model, const GeneratorParams& params, bool processes_logits = false);
+
+// A decoding mode that adds one or more tokens per GenerateNextToken call by verifying guesses in one forward pass.
+struct MultiTokenDecoder {
+  MultiTokenDecoder(ExtendedGenerator& generator, bool processes_logits = false);
+  virtual ~MultiTokenDecoder() = default;
+
+  // One step: run the pending token and the guesses in one forward pass, keep the accepted prefix and one token from
+  // the target. Appends the new tokens to step_tokens.
+  virtual void Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) = 0;
+
+  // Whether the decoder chooses every token from the logits row the search holds or runs the logits pipeline on, so
+  // edits to that row apply. Decoders that verify guesses choose from rows of their own.
+  bool ProcessesLogits() const { return processes_logits_; }
+
+ protected:
+  // After a run of the pending token (at length - 1) and run_count guesses: drop the rejected guesses from the KV cache
+  // and commit the last emitted token as the new pending one
+  void Commit(size_t length, size_t run_count, std::span<const int32_t> emitted);
+
+  ExtendedGenerator& generator_;
+  const Config::Search search_;
+  const bool processes_logits_;
+};
+
+struct SpeculativeDecoder : MultiTokenDecoder {
+  SpeculativeDecoder(ExtendedGenerator& generator, std::unique_ptr<DraftProposer> proposer, int num_draft_tokens);
+
+  void Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) override;
+
+ private:
+  int32_t SelectToken(std::span<const float> logits);
+
+  std::unique_ptr<DraftProposer> proposer_;
+  size_t num_draft_tokens_;
+  const bool greedy_;
+
+  DraftProposal proposal_;
+  std::vector<float> probs_;
+  std::vector<int32_t> emitted_;
+  std::mt19937 engine_;
+};
+
+// Standard decoding, one token per step, that samples with SampleToken instead of the search: the logits processors
+// fused into one pass, vectorized softmax and a top_k / top_p cut without sorting the vocabulary. Same
+// distribution as the search's sampling, plus the penalties and grammar mask of the generator, if any.
+struct SamplingDecoder : MultiTokenDecoder {
+  SamplingDecoder(ExtendedGenerator& generator);
+
+  void Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) override;
+
+ private:
+  std::vector<float> probs_;
+  std::mt19937 engine_;
+};
+
+// Greedy search without the search's own selection: the argmax of the last logits row, vectorized, read straight from
+// the model's output. Nothing is copied or allocated per token unless a logits processor needs a processed row.
+struct GreedyDecoder : MultiTokenDecoder {
+  GreedyDecoder(ExtendedGenerator& generator);
+
+  void Step(std::vector<int32_t>& step_tokens, DecodingStats& stats) override;
+
+ private:
+  std::vector<float> processed_;  // Logits after the processors
+};
+
+// Model id of the decoder.pipeline entry whose session_options the draft model is created with
+constexpr const char* kDraftModelId = "draft";
+
+// Load a draft model for target from its own genai_config.json
+std::shared_ptr<Model> CreateDraftModel(const Model& target, const char* config_path);
+
+}  // namespace Generators
@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+
+#include "stop_sequences.h"
+#include "generators.h"
+#include "models/model.h"
+
+namespace Generators {
+
+StopSequenceMatcher::StopSequenceMatcher(std::span<const std::vector<int32_t>> sequences) : nodes_(1) {
+  // The trie of all sequences
+  std::vector<std::vector<int32_t>> children(1);  // Tokens leaving each node, for the breadth-first pass
+  for (const auto& sequence : sequences) {
+    if (sequence.empty())
+      throw std::runtime_error("Stop sequences must not be empty");
+    State state = kStart;
+    for (int32_t token : sequence) {
+      auto [edge, added] = edges_.try_emplace(EdgeKey(state, token), static_cast<State>(nodes_.size()));
+      if (added) {
+        children[state].push_back(token);
+        nodes_.emplace_back();
+        children.emplace_back();
+      }
+      state = edge->second;
+    }
+    nodes_[state].matches = true;
+    max_length_ = std::max(max_length_, sequence.size());
+  }
+
+  // Failure links breadth first, so a node's failure is done before its children need it
+  std::deque<State> queue;
+  for (int32_t token : children[kStart])
+    queue.push_back(edges_.at(EdgeKey(kStart, token)));
+  while (!queue.empty()) {
+    const State state = queue.front();
+    queue.pop_front();
+    for (int32_t token : children[state]) {
+      const State child = edges_.at(EdgeKey(state, token));
+      nodes_[child].failure = Next(nodes_[state].failure, token);
+      nodes_[child].matches = nodes_[child].matches || nodes_[nodes_[child].failure].matches;
+      queue.push_back(child);
+    }
+  }
+}
+
+StopSequenceMatcher::State StopSequenceMatcher::Next(State state, int32_t token) const {
+  while (true) {
+    if (auto edge = edges_.find(EdgeKey(state, token)); edge != edges_.end())
+      return edge->second;
+    if (state == kStart)
+      return kStart;
+    state = nodes_[state].failure;
+  }
+}
+
+std::vector<int32_t> EncodeStopString(const Tokenizer& tokenizer, const char* text) {
+  auto prefix = tokenizer.Encode("");
+  auto tokens = tokenizer.Encode(text);
+  if (tokens.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), tokens.begin()))
+    tokens.erase(tokens.begin(), tokens.begin() + prefix.size());
+  if (tokens.empty())
+    throw std::runtime_error("Stop string encodes to no tokens");
+  return tokens;
+}
+
+}  // namespace Generators
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Stop sequences matched on token ids as they are generated. All of them go into one Aho-Corasick automaton, so each
+// new token costs one transition however many sequences there are and however long they get, and a stop is seen on
+// the step that completes it: no decoding of the output to text and no string search per token.
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace Generators {
+
+struct Tokenizer;
+
+struct StopSequenceMatcher {
+  explicit StopSequenceMatcher(std::span<const std::vector<int32_t>> sequences);
+
+  using State = uint32_t;
+  static constexpr State kStart = 0;
+
+  // The state after token. Check Matches on it for a completed stop sequence.
+  State Next(State state, int32_t token) const;
+  bool Matches(State state) const { return nodes_[state].matches; }
+
+  // Longest stop sequence, the most trailing tokens that can take part in a match
+  size_t MaxLength() const { return max_length_; }
+  bool Empty() const { return max_length_ == 0; }
+
+ private:
+  struct Node {
+    State failure{kStart};  // The longest proper suffix of this node's tokens that is a node too
+    bool matches{};         // A stop sequence ends here, or at one of the failure nodes
+  };
+
+  static uint64_t EdgeKey(State state, int32_t token) {
+    return (static_cast<uint64_t>(state) << 32) | static_cast<uint32_t>(token);
+  }
+
+  std::vector<Node> nodes_;
+  std::unordered_map<uint64_t, State> edges_;  // Trie edges, keyed by EdgeKey
+  size_t max_length_{};
+};
+
+// text as the tokenizer encodes it on its own, without what it adds to every string (BOS for SentencePiece models)
+std::vector<int32_t> EncodeStopString(const Tokenizer& tokenizer, const char* text);
+
+}  // namespace Generators
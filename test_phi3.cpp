@@ -5,6 +5,7 @@
 
 // Include the ONNX Runtime GenAI C API header
 #include "ort_genai_c.h"
+#include "oga_utils.h"
 
 int test_phi3_main(const char *model_path) {
     std::cout << "🚀 Testing Phi-3 with ONNX Runtime GenAI C++ API on macOS\n";
@@ -86,6 +87,10 @@ int test_phi3_main(const char *model_path) {
         // Set generation parameters
         OgaGeneratorParamsSetSearchNumber(params, "max_length", 100.0);
         OgaGeneratorParamsSetSearchNumber(params, "batch_size", 1.0);
+        // <|end|> ends the reply, IsDone turns true on the step that generates it
+        int32_t end_token_id = -1;
+        OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer, "<|end|>", &end_token_id));
+        OgaThrowIfFailed(OgaGeneratorParamsAddStopSequence(params, &end_token_id, 1));
         
         // Create generator
         OgaGenerator* generator = nullptr;
@@ -142,11 +147,6 @@ int test_phi3_main(const char *model_path) {
                 if (OgaTokenizerStreamDecode(tokenizer_stream, new_token, &token_text) == nullptr) {
                     std::cout << token_text;
                     response += token_text;
-                    
-                    // Check for end token
-                    if (std::string(token_text).find("<|end|>") != std::string::npos) {
-                        break;
-                    }
                 }
             }
             
@@ -5,6 +5,7 @@
 
 // Include the ONNX Runtime GenAI C API header
 #include "ort_genai_c.h"
+#include "oga_utils.h"
 
 int main() {
     std::cout << "🚀 Testing Phi-3 with ONNX Runtime GenAI C++ API on macOS\n";
@@ -98,6 +99,10 @@ int main() {
         // Set generation parameters
         OgaGeneratorParamsSetSearchNumber(params, "max_length", 100.0);
         OgaGeneratorParamsSetSearchNumber(params, "batch_size", 1.0);
+        // <|end|> ends the reply, IsDone turns true on the step that generates it
+        int32_t end_token_id = -1;
+        OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer, "<|end|>", &end_token_id));
+        OgaThrowIfFailed(OgaGeneratorParamsAddStopSequence(params, &end_token_id, 1));
         
         // Create generator
         OgaGenerator* generator = nullptr;
@@ -157,11 +162,6 @@ int main() {
                     std::cout << token_text;
                     std::cout.flush(); // Show tokens as they're generated
                     response += token_text;
-                    
-                    // Check for end token
-                    if (std::string(token_text).find("<|end|>") != std::string::npos) {
-                        break;
-                    }
                 }
             }
             
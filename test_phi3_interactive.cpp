@@ -5,6 +5,7 @@
 
 // Include the ONNX Runtime GenAI C API header
 #include "ort_genai_c.h"
+#include "oga_utils.h"
 
 int generateResponse(const std::string& user_input, 
                     OgaModel* model, 
@@ -42,6 +43,10 @@ int generateResponse(const std::string& user_input,
     // Set generation parameters
     OgaGeneratorParamsSetSearchNumber(params, "max_length", 500.0);
     OgaGeneratorParamsSetSearchNumber(params, "batch_size", 1.0);
+    // <|end|> ends the reply, IsDone turns true on the step that generates it
+    int32_t end_token_id = -1;
+    OgaThrowIfFailed(OgaTokenizerToTokenId(tokenizer, "<|end|>", &end_token_id));
+    OgaThrowIfFailed(OgaGeneratorParamsAddStopSequence(params, &end_token_id, 1));
     
     // Create generator
     OgaGenerator* generator = nullptr;
@@ -93,11 +98,6 @@ int generateResponse(const std::string& user_input,
                 std::cout << token_text;
                 std::cout.flush();
                 response += token_text;
-                
-                // Check for end token
-                if (std::string(token_text).find("<|end|>") != std::string::npos) {
-                    break;
-                }
             }
         }
         
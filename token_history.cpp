@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+
+#include "token_history.h"
+
+namespace Generators {
+
+namespace {
+
+void InsertSorted(std::vector<int32_t>& tokens, int32_t token) {
+  tokens.insert(std::lower_bound(tokens.begin(), tokens.end(), token), token);
+}
+
+}  // namespace
+
+TokenHistory::TokenHistory(int no_repeat_ngram_size)
+    : ngram_size_{static_cast<size_t>(std::max(no_repeat_ngram_size, 0))} {}
+
+void TokenHistory::Reset(std::span<const int32_t> prompt) {
+  length_ = prompt.size();
+  counts_.clear();
+  sequence_tokens_.clear();
+  output_tokens_.clear();
+  output_.clear();
+  ngrams_.clear();
+  banned_.clear();
+
+  for (int32_t token : prompt) {
+    if (counts_[token].sequence++ == 0)
+      sequence_tokens_.push_back(token);
+  }
+  std::sort(sequence_tokens_.begin(), sequence_tokens_.end());
+}
+
+void TokenHistory::Add(int32_t token) {
+  length_++;
+  Counts& counts = counts_[token];
+  if (counts.sequence++ == 0)
+    InsertSorted(sequence_tokens_, token);
+  if (counts.output++ == 0)
+    InsertSorted(output_tokens_, token);
+
+  if (ngram_size_ == 0)
+    return;
+  output_.push_back(token);
+  if (output_.size() >= ngram_size_) {
+    // Index the n-gram that token completes, unless the same one is indexed already
+    const size_t start = output_.size() - ngram_size_;
+    auto& starts = ngrams_[PrefixKey(start)];
+    const bool known = std::any_of(starts.begin(), starts.end(), [&](uint32_t other) {
+      return output_[other + ngram_size_ - 1] == token && SamePrefix(other, start);
+    });
+    if (!known)
+      starts.push_back(static_cast<uint32_t>(start));
+  }
+  UpdateBanned();
+}
+
+uint32_t TokenHistory::OutputCount(int32_t token) const {
+  auto counts = counts_.find(token);
+  return counts != counts_.end() ? counts->second.output : 0;
+}
+
+uint64_t TokenHistory::PrefixKey(size_t start) const {
+  uint64_t key = 14695981039346656037ull;  // FNV-1a over the token ids
+  for (size_t i = start; i < start + ngram_size_ - 1; i++) {
+    key ^= static_cast<uint32_t>(output_[i]);
+    key *= 1099511628211ull;
+  }
+  return key;
+}
+
+bool TokenHistory::SamePrefix(size_t a, size_t b) const {
+  return std::equal(output_.begin() + a, output_.begin() + a + ngram_size_ - 1, output_.begin() + b);
+}
+
+void TokenHistory::UpdateBanned() {
+  // The last n - 1 tokens followed by any token that came after them before would repeat an n-gram
+  banned_.clear();
+  if (output_.size() < ngram_size_ - 1)
+    return;
+  const size_t suffix = output_.size() - (ngram_size_ - 1);
+  auto starts = ngrams_.find(PrefixKey(suffix));
+  if (starts == ngrams_.end())
+    return;
+  for (uint32_t start : starts->second) {
+    if (SamePrefix(start, suffix))
+      banned_.push_back(output_[start + ngram_size_ - 1]);
+  }
+}
+
+}  // namespace Generators
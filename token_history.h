@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// What the repetition controls of the logits pipeline need to know about the sequence, kept up to date one token at a
+// time: a hash map of token counts, the distinct tokens in sorted order for the pipeline's tiles, and an index of the
+// generated n-grams. Adding a token is O(1) (a map update, plus an insert into a sorted list the first time the token
+// shows up) where the processors used to go over the whole sequence every step.
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace Generators {
+
+struct TokenHistory {
+  explicit TokenHistory(int no_repeat_ngram_size = 0);
+
+  // Start over with prompt. Prompt tokens count for repetition_penalty, the frequency, presence and n-gram controls
+  // only look at generated tokens.
+  void Reset(std::span<const int32_t> prompt);
+  // A generated token
+  void Add(int32_t token);
+
+  // Prompt and generated tokens
+  size_t Length() const { return length_; }
+  // Every token of the sequence once, sorted
+  std::span<const int32_t> SequenceTokens() const { return sequence_tokens_; }
+  // Every generated token once, sorted, and how many times it was generated
+  std::span<const int32_t> OutputTokens() const { return output_tokens_; }
+  uint32_t OutputCount(int32_t token) const;
+  // Tokens that would repeat a generated n-gram of no_repeat_ngram_size if they came next. May hold a token twice.
+  std::span<const int32_t> BannedTokens() const { return banned_; }
+
+ private:
+  struct Counts {
+    uint32_t sequence{};
+    uint32_t output{};
+  };
+
+  // Hash of the n - 1 generated tokens starting at start, the key of the n-gram index
+  uint64_t PrefixKey(size_t start) const;
+  bool SamePrefix(size_t a, size_t b) const;
+  void UpdateBanned();
+
+  size_t ngram_size_;
+  size_t length_{};
+  std::unordered_map<int32_t, Counts> counts_;
+  std::vector<int32_t> sequence_tokens_;
+  std::vector<int32_t> output_tokens_;
+
+  std::vector<int32_t> output_;  // Generated tokens, for the n-gram index
+  // Start of one generated n-gram for each distinct (first n - 1 tokens, last token), by PrefixKey
+  std::unordered_map<uint64_t, std::vector<uint32_t>> ngrams_;
+  std::vector<int32_t> banned_;
+};
+
+}  // namespace Generators
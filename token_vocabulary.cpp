@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <string_view>
+
+#include "token_vocabulary.h"
+#include "stop_sequences.h"
+#include "generators.h"
+#include "models/model.h"
+
+namespace Generators {
+
+namespace {
+
+bool IsSpecialTokenText(std::string_view text) {
+  if (text.size() >= 4 && text.starts_with("<|") && text.ends_with("|>"))
+    return true;
+  return text == "<s>" || text == "</s>" || text == "<unk>";
+}
+
+}  // namespace
+
+TokenVocabulary BuildTokenVocabulary(const Tokenizer& tokenizer, size_t vocab_size) {
+  // SentencePiece drops the leading space of the first token it decodes, so every token is decoded after an anchor
+  // token and the anchor's text is taken off again
+  const std::vector<int32_t> anchor{EncodeStopString(tokenizer, "a").back()};
+  const std::string anchor_text = tokenizer.Decode(anchor);
+
+  TokenVocabulary vocabulary;
+  vocabulary.texts.resize(vocab_size);
+  std::array<int32_t, 2> pair{anchor[0]};
+  for (size_t token = 0; token < vocab_size; token++) {
+    pair[1] = static_cast<int32_t>(token);
+    std::string text;
+    try {
+      text = tokenizer.Decode(pair);
+      if (text.starts_with(anchor_text))
+        text.erase(0, anchor_text.size());
+      else
+        text = tokenizer.Decode(std::span<const int32_t>(&pair[1], 1));
+    } catch (const std::exception&) {
+      continue;  // Past the tokenizer's vocabulary
+    }
+    // Partial UTF-8 characters decode to U+FFFD
+    if (IsSpecialTokenText(text) || text.find("\xEF\xBF\xBD") != std::string::npos)
+      continue;
+    vocabulary.texts[token] = std::move(text);
+  }
+  return vocabulary;
+}
+
+std::shared_ptr<const TokenVocabulary> GetTokenVocabulary(const Model& model) {
+  // Generators hold their model, so an entry can only outlive its model expired
+  static std::mutex mutex;
+  static std::map<const Model*, std::weak_ptr<const TokenVocabulary>> vocabularies;
+
+  std::lock_guard<std::mutex> lock{mutex};
+  auto& entry = vocabularies[&model];
+  if (auto vocabulary = entry.lock())
+    return vocabulary;
+  auto vocabulary = std::make_shared<const TokenVocabulary>(
+      BuildTokenVocabulary(*model.CreateTokenizer(), static_cast<size_t>(model.config_->model.vocab_size)));
+  entry = vocabulary;
+  return vocabulary;
+}
+
+}  // namespace Generators
@@ -0,0 +1,28 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// The text of every token in a model's vocabulary, for the parts of generation that work on text rather than token
+// ids (grammar_constraint.h). Decoding the whole vocabulary takes a while, so it is done once per model and shared.
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Generators {
+
+struct Model;
+struct Tokenizer;
+
+struct TokenVocabulary {
+  // By token id, what the token adds to decoded output. Empty for tokens without text of their own: special tokens,
+  // byte tokens that are only part of a UTF-8 character and ids past the tokenizer's vocabulary.
+  std::vector<std::string> texts;
+};
+
+TokenVocabulary BuildTokenVocabulary(const Tokenizer& tokenizer, size_t vocab_size);
+
+// BuildTokenVocabulary for model's tokenizer and vocab_size, kept while anything still uses it
+std::shared_ptr<const TokenVocabulary> GetTokenVocabulary(const Model& model);
+
+}  // namespace Generators
@@ -0,0 +1,326 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "vector_math_cpu.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define GENAI_VECTOR_MATH_NEON
+#elif defined(__AVX512F__)
+#include <immintrin.h>
+#define GENAI_VECTOR_MATH_AVX512
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define GENAI_VECTOR_MATH_AVX2
+#endif
+
+namespace Generators {
+
+namespace {
+
+// exp(x) = 2^n * exp(r) with n = round(x / ln 2) and |r| <= ln 2 / 2, exp(r) from the Cephes expf polynomial.
+// Inputs below kExpMin are clamped, their results (< 1e-37) only ever get added to a sum that is at least 1.
+constexpr float kExpMin = -87.0f;
+constexpr float kExpMax = 88.0f;
+constexpr float kLog2e = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+
+#if defined(GENAI_VECTOR_MATH_NEON)
+
+inline float32x4_t Exp(float32x4_t x) {
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(kExpMin)), vdupq_n_f32(kExpMax));
+  float32x4_t n = vrndnq_f32(vmulq_f32(x, vdupq_n_f32(kLog2e)));
+  float32x4_t r = vfmsq_f32(x, n, vdupq_n_f32(kLn2Hi));
+  r = vfmsq_f32(r, n, vdupq_n_f32(kLn2Lo));
+
+  float32x4_t p = vdupq_n_f32(kExpP0);
+  p = vfmaq_f32(vdupq_n_f32(kExpP1), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP2), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP3), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP4), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP5), p, r);
+  p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
+
+  int32x4_t exponent = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+  return vmulq_f32(p, vreinterpretq_f32_s32(exponent));
+}
+
+#elif defined(GENAI_VECTOR_MATH_AVX512)
+
+inline __m512 Exp(__m512 x) {
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(kExpMin)), _mm512_set1_ps(kExpMax));
+  __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(kLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Hi), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Lo), r);
+
+  __m512 p = _mm512_set1_ps(kExpP0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP5));
+  p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+  __m512i exponent = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+  return _mm512_mul_ps(p, _mm512_castsi512_ps(exponent));
+}
+
+#elif defined(GENAI_VECTOR_MATH_AVX2)
+
+inline __m256 Exp(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(kExpMin)), _mm256_set1_ps(kExpMax));
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Hi), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Lo), r);
+
+  __m256 p = _mm256_set1_ps(kExpP0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP5));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+  __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+inline float HorizontalSum(__m256 v) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+inline float HorizontalMax(__m256 v) {
+  __m128 max = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+  max = _mm_max_ss(max, _mm_movehdup_ps(max));
+  return _mm_cvtss_f32(max);
+}
+
+#endif
+
+}  // namespace
+
+float ReduceMax(std::span<const float> values) {
+  const float* data = values.data();
+  const size_t size = values.size();
+  size_t i = 0;
+  float max = -std::numeric_limits<float>::infinity();
+
+#if defined(GENAI_VECTOR_MATH_NEON)
+  float32x4_t max0 = vdupq_n_f32(max), max1 = max0;
+  for (; i + 8 <= size; i += 8) {
+    max0 = vmaxq_f32(max0, vld1q_f32(data + i));
+    max1 = vmaxq_f32(max1, vld1q_f32(data + i + 4));
+  }
+  max = vmaxvq_f32(vmaxq_f32(max0, max1));
+#elif defined(GENAI_VECTOR_MATH_AVX512)
+  __m512 max0 = _mm512_set1_ps(max);
+  for (; i + 16 <= size; i += 16)
+    max0 = _mm512_max_ps(max0, _mm512_loadu_ps(data + i));
+  max = _mm512_reduce_max_ps(max0);
+#elif defined(GENAI_VECTOR_MATH_AVX2)
+  __m256 max0 = _mm256_set1_ps(max), max1 = max0;
+  for (; i + 16 <= size; i += 16) {
+    max0 = _mm256_max_ps(max0, _mm256_loadu_ps(data + i));
+    max1 = _mm256_max_ps(max1, _mm256_loadu_ps(data + i + 8));
+  }
+  max = HorizontalMax(_mm256_max_ps(max0, max1));
+#endif
+
+  for (; i < size; i++)
+    max = std::max(max, data[i]);
+  return max;
+}
+
+size_t IndexOfMax(std::span<const float> values) {
+  // The maximum first, then the first position that holds it: two streaming passes over a row that stays in cache,
+  // instead of carrying an index per lane through one
+  const float max = ReduceMax(values);
+  const float* data = values.data();
+  const size_t size = values.size();
+  size_t i = 0;
+
+#if defined(GENAI_VECTOR_MATH_NEON)
+  const float32x4_t max_v = vdupq_n_f32(max);
+  for (; i + 4 <= size; i += 4) {
+    if (vmaxvq_u32(vceqq_f32(vld1q_f32(data + i), max_v)))
+      break;
+  }
+#elif defined(GENAI_VECTOR_MATH_AVX512)
+  const __m512 max_v = _mm512_set1_ps(max);
+  for (; i + 16 <= size; i += 16) {
+    if (__mmask16 equal = _mm512_cmp_ps_mask(_mm512_loadu_ps(data + i), max_v, _CMP_EQ_OQ))
+      return i + std::countr_zero(static_cast<unsigned>(equal));
+  }
+#elif defined(GENAI_VECTOR_MATH_AVX2)
+  const __m256 max_v = _mm256_set1_ps(max);
+  for (; i + 8 <= size; i += 8) {
+    if (int equal = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(data + i), max_v, _CMP_EQ_OQ)))
+      return i + std::countr_zero(static_cast<unsigned>(equal));
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (data[i] == max)
+      return i;
+  }
+  return 0;  // Empty, or NaNs only
+}
+
+float SumExpShifted(std::span<const float> values, float shift, float scale) {
+  const float* data = values.data();
+  const size_t size = values.size();
+  size_t i = 0;
+  float sum = 0.0f;
+
+#if defined(GENAI_VECTOR_MATH_NEON)
+  const float32x4_t shift_v = vdupq_n_f32(shift), scale_v = vdupq_n_f32(scale);
+  float32x4_t sum0 = vdupq_n_f32(0.0f), sum1 = sum0;
+  for (; i + 8 <= size; i += 8) {
+    sum0 = vaddq_f32(sum0, Exp(vmulq_f32(vsubq_f32(vld1q_f32(data + i), shift_v), scale_v)));
+    sum1 = vaddq_f32(sum1, Exp(vmulq_f32(vsubq_f32(vld1q_f32(data + i + 4), shift_v), scale_v)));
+  }
+  sum = vaddvq_f32(vaddq_f32(sum0, sum1));
+#elif defined(GENAI_VECTOR_MATH_AVX512)
+  const __m512 shift_v = _mm512_set1_ps(shift), scale_v = _mm512_set1_ps(scale);
+  __m512 sum0 = _mm512_setzero_ps();
+  for (; i + 16 <= size; i += 16)
+    sum0 = _mm512_add_ps(sum0, Exp(_mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(data + i), shift_v), scale_v)));
+  sum = _mm512_reduce_add_ps(sum0);
+#elif defined(GENAI_VECTOR_MATH_AVX2)
+  const __m256 shift_v = _mm256_set1_ps(shift), scale_v = _mm256_set1_ps(scale);
+  __m256 sum0 = _mm256_setzero_ps(), sum1 = sum0;
+  for (; i + 16 <= size; i += 16) {
+    sum0 = _mm256_add_ps(sum0, Exp(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(data + i), shift_v), scale_v)));
+    sum1 = _mm256_add_ps(sum1, Exp(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(data + i + 8), shift_v), scale_v)));
+  }
+  sum = HorizontalSum(_mm256_add_ps(sum0, sum1));
+#endif
+
+  for (; i < size; i++)
+    sum += std::exp((data[i] - shift) * scale);
+  return sum;
+}
+
+float ExpShifted(std::span<const float> values, float shift, float scale, std::span<float> out) {
+  assert(out.size() == values.size());
+  const float* data = values.data();
+  float* result = out.data();
+  const size_t size = values.size();
+  size_t i = 0;
+  float sum = 0.0f;
+
+#if defined(GENAI_VECTOR_MATH_NEON)
+  const float32x4_t shift_v = vdupq_n_f32(shift), scale_v = vdupq_n_f32(scale);
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  for (; i + 4 <= size; i += 4) {
+    float32x4_t e = Exp(vmulq_f32(vsubq_f32(vld1q_f32(data + i), shift_v), scale_v));
+    vst1q_f32(result + i, e);
+    sum0 = vaddq_f32(sum0, e);
+  }
+  sum = vaddvq_f32(sum0);
+#elif defined(GENAI_VECTOR_MATH_AVX512)
+  const __m512 shift_v = _mm512_set1_ps(shift), scale_v = _mm512_set1_ps(scale);
+  __m512 sum0 = _mm512_setzero_ps();
+  for (; i + 16 <= size; i += 16) {
+    __m512 e = Exp(_mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(data + i), shift_v), scale_v));
+    _mm512_storeu_ps(result + i, e);
+    sum0 = _mm512_add_ps(sum0, e);
+  }
+  sum = _mm512_reduce_add_ps(sum0);
+#elif defined(GENAI_VECTOR_MATH_AVX2)
+  const __m256 shift_v = _mm256_set1_ps(shift), scale_v = _mm256_set1_ps(scale);
+  __m256 sum0 = _mm256_setzero_ps();
+  for (; i + 8 <= size; i += 8) {
+    __m256 e = Exp(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(data + i), shift_v), scale_v));
+    _mm256_storeu_ps(result + i, e);
+    sum0 = _mm256_add_ps(sum0, e);
+  }
+  sum = HorizontalSum(sum0);
+#endif
+
+  for (; i < size; i++) {
+    result[i] = std::exp((data[i] - shift) * scale);
+    sum += result[i];
+  }
+  return sum;
+}
+
+void MaskFill(std::span<float> values, std::span<const uint32_t> allowed, float fill) {
+  assert(allowed.size() * 32 >= values.size());
+  float* data = values.data();
+  const size_t size = values.size();
+  size_t i = 0;
+
+  // Whole words of 32 values, skipping the all-allowed ones
+#if defined(GENAI_VECTOR_MATH_NEON)
+  const uint32x4_t lane_bits = {1, 2, 4, 8};
+  const float32x4_t fill_v = vdupq_n_f32(fill);
+  for (; i + 32 <= size; i += 32) {
+    const uint32_t bits = allowed[i / 32];
+    if (bits == ~0u)
+      continue;
+    for (size_t j = 0; j < 32; j += 4) {
+      uint32x4_t keep = vtstq_u32(vdupq_n_u32(bits >> j), lane_bits);
+      vst1q_f32(data + i + j, vbslq_f32(keep, vld1q_f32(data + i + j), fill_v));
+    }
+  }
+#elif defined(GENAI_VECTOR_MATH_AVX512)
+  const __m512 fill_v = _mm512_set1_ps(fill);
+  for (; i + 32 <= size; i += 32) {
+    const uint32_t bits = allowed[i / 32];
+    if (bits == ~0u)
+      continue;
+    _mm512_mask_storeu_ps(data + i, static_cast<__mmask16>(~bits), fill_v);
+    _mm512_mask_storeu_ps(data + i + 16, static_cast<__mmask16>(~bits >> 16), fill_v);
+  }
+#elif defined(GENAI_VECTOR_MATH_AVX2)
+  const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256 fill_v = _mm256_set1_ps(fill);
+  for (; i + 32 <= size; i += 32) {
+    const uint32_t bits = allowed[i / 32];
+    if (bits == ~0u)
+      continue;
+    if (bits == 0) {
+      for (size_t j = 0; j < 32; j += 8)
+        _mm256_storeu_ps(data + i + j, fill_v);
+      continue;
+    }
+    for (size_t j = 0; j < 32; j += 8) {
+      __m256i lanes = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits >> j)), lane_bits);
+      __m256 clear = _mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, _mm256_setzero_si256()));
+      _mm256_storeu_ps(data + i + j, _mm256_blendv_ps(_mm256_loadu_ps(data + i + j), fill_v, clear));
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (!(allowed[i / 32] & (1u << (i % 32))))
+      data[i] = fill;
+  }
+}
+
+float LogSumExp(std::span<const float> values) {
+  const float max = ReduceMax(values);
+  if (!std::isfinite(max))
+    return max;
+  return max + std::log(SumExpShifted(values, max, 1.0f));
+}
+
+}  // namespace Generators
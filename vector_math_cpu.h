@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Vectorized reductions over a row of logits (NEON on arm64, AVX-512 or AVX2 on x64, scalar otherwise), for the CPU
+// paths that go over a whole vocabulary per token: scoring and sampling, greedy search's argmax and grammar masks.
+// exp uses range reduction and the Cephes expf polynomial, about 1e-6 relative error against std::exp.
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+namespace Generators {
+
+// Largest value, -infinity when values is empty
+float ReduceMax(std::span<const float> values);
+
+// Index of the largest value, the first one on ties. 0 when values is empty.
+size_t IndexOfMax(std::span<const float> values);
+
+// sum(exp((values[i] - shift) * scale)), with shift usually the maximum so every term is at most 1
+float SumExpShifted(std::span<const float> values, float shift, float scale);
+
+// out[i] = exp((values[i] - shift) * scale), returns the sum of out. out may be values.
+float ExpShifted(std::span<const float> values, float shift, float scale, std::span<float> out);
+
+// values[i] = fill wherever bit i % 32 of allowed[i / 32] is clear. allowed covers at least values.size() bits.
+void MaskFill(std::span<float> values, std::span<const uint32_t> allowed, float fill);
+
+// log(sum(exp(values))), the log-softmax normalizer: log p(i) = values[i] - LogSumExp(values)
+float LogSumExp(std::span<const float> values);
+
+}  // namespace Generators
@@ -0,0 +1,619 @@
+// worker_pool.cpp - Multi-process Phi-3 serving with weights shared through the page cache (Linux)
+//
+// A dispatcher listens on a Unix socket and hands each request to an idle worker. In "processes" mode every
+// worker is a process of its own (this binary, executed again) with its own OgaModel; the sessions are created
+// with pre-packing disabled so ONNX Runtime keeps using the read-only, memory-mapped external weight file instead
+// of private copies, and the weight pages are shared between workers through the page cache. "threads" mode runs
+// the same workers as threads around a single OgaModel, as the baseline for the memory and throughput comparison.
+//
+// Protocol: one JSON object per line, {"prompt": "...", "max_tokens": 128} -> {"text": ..., "tokens": ...}
+//           {"cmd": "stats"} -> memory usage of every worker
+//
+// Usage: worker_pool <model_path> serve|bench [--mode processes|threads] [--workers 4] [--socket path]
+//                    [--requests 32] [--clients 8] [--max-tokens 64]
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "oga_utils.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+struct PoolOptions {
+    std::string model_path;
+    std::string command;
+    bool use_processes{true};
+    size_t workers{4};
+    std::string socket_path{"/tmp/phi3_worker_pool.sock"};
+    size_t bench_requests{32};
+    size_t bench_clients{8};
+    int max_tokens{64};
+    int worker_fd{-1};  // "worker" command: the socket to the dispatcher
+};
+
+// Newline framed JSON over a stream socket
+class LineChannel {
+public:
+    explicit LineChannel(int fd) : fd_{fd} {}
+
+    bool ReadLine(std::string& line) {
+        while (true) {
+            auto newline = pending_.find('\n');
+            if (newline != std::string::npos) {
+                line = pending_.substr(0, newline);
+                pending_.erase(0, newline + 1);
+                return true;
+            }
+            char buffer[4096];
+            ssize_t n = read(fd_, buffer, sizeof(buffer));
+            if (n <= 0) {
+                return false;
+            }
+            pending_.append(buffer, static_cast<size_t>(n));
+        }
+    }
+
+    bool WriteLine(const std::string& line) {
+        std::string data = line + "\n";
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = send(fd_, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+    std::string pending_;
+};
+
+// Resident and proportional set size. PSS divides shared pages between the processes mapping them, so the
+// sum of PSS across workers is the real cost of the pool.
+json ReadMemoryUsage() {
+    json usage = {{"pid", getpid()}};
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string key;
+    size_t value_kb;
+    std::string unit;
+    while (rollup >> key >> value_kb >> unit) {
+        if (key == "Rss:" || key == "Pss:" || key == "Shared_Clean:" || key == "Private_Clean:" ||
+            key == "Private_Dirty:") {
+            key.pop_back();
+            usage[key + "_mb"] = value_kb / 1024.0;
+        }
+    }
+    return usage;
+}
+
+OgaModelPtr LoadModel(const PoolOptions& options) {
+    OgaConfig* config = nullptr;
+    OgaThrowIfFailed(OgaCreateConfig(options.model_path.c_str(), &config));
+    std::unique_ptr<OgaConfig, void (*)(OgaConfig*)> config_owner{config, OgaDestroyConfig};
+
+    // Pre-packing rewrites the weights into private allocations, which defeats sharing the mapped file.
+    // It only matters in processes mode; threads already share one copy inside the single session.
+    if (options.use_processes) {
+        OgaThrowIfFailed(OgaConfigOverlay(config, R"({"model": {"decoder": {"session_options": {
+            "config_entries": {"session.disable_prepacking": "1"}}}}})"));
+    }
+
+    OgaModel* model = nullptr;
+    OgaThrowIfFailed(OgaCreateModelFromConfig(config, &model));
+    return OgaModelPtr{model};
+}
+
+json Generate(OgaModel* model, OgaTokenizer* tokenizer, int32_t end_token_id, const json& request, int default_max_tokens) {
+    auto start = OgaClock::now();
+    std::string prompt = "<|user|>\n" + request.at("prompt").get<std::string>() + " <|end|>\n<|assistant|>";
+    int max_tokens = default_max_tokens;
+    if (request.contains("max_tokens")) {
+        const json& value = request["max_tokens"];
+        if (!value.is_number_integer() || value.get<int64_t>() < 1) {
+            throw std::runtime_error("max_tokens must be a positive integer");
+        }
+        max_tokens = static_cast<int>(std::min<int64_t>(value.get<int64_t>(), std::numeric_limits<int>::max()));
+    }
+
+    OgaSequences* sequences = nullptr;
+    OgaThrowIfFailed(OgaCreateSequences(&sequences));
+    OgaSequencesPtr sequences_owner{sequences};
+    OgaThrowIfFailed(OgaTokenizerEncode(tokenizer, prompt.c_str(), sequences));
+    size_t prompt_tokens = OgaSequencesGetSequenceCount(sequences, 0);
+
+    OgaGeneratorParams* params = nullptr;
+    OgaThrowIfFailed(OgaCreateGeneratorParams(model, &params));
+    OgaGeneratorParamsPtr params_owner{params};
+    OgaThrowIfFailed(OgaGeneratorParamsSetSearchNumber(params, "max_length", static_cast<double>(prompt_tokens + max_tokens)));
+
+    OgaGenerator* generator = nullptr;
+    OgaThrowIfFailed(OgaCreateGenerator(model, params, &generator));
+    OgaGeneratorPtr generator_owner{generator};
+    OgaThrowIfFailed(OgaGenerator_AppendTokenSequences(generator, sequences));
+
+    std::vector<int32_t> output;
+    while (!OgaGenerator_IsDone(generator) && output.size() < static_cast<size_t>(max_tokens)) {
+        OgaThrowIfFailed(OgaGenerator_GenerateNextToken(generator));
+        const int32_t* next_tokens = nullptr;
+        size_t count = 0;
+        OgaThrowIfFailed(OgaGenerator_GetNextTokens(generator, &next_tokens, &count));
+        if (count == 0 || next_tokens[0] == end_token_id) {
+            break;
+        }
+        output.push_back(next_tokens[0]);
+    }
+
+    std::string text;
+    OgaDecodeInto(tokenizer, output.data(), output.size(), text);
+    return {{"text", text}, {"tokens", output.size()}, {"ms", OgaMillisecondsSince(start)}};
+}
+
+// One model, tokenizer and end token per worker process, or one set shared by every worker thread
+struct ModelContext {
+    OgaModelPtr model;
+    OgaTokenizerPtr tokenizer;
+    int32_t end_token_id{-1};
+
+    explicit ModelContext(const PoolOptions& options) : model{LoadModel(options)} {
+        OgaTokenizer* raw_tokenizer = nullptr;
+        OgaThrowIfFailed(OgaCreateTokenizer(model.get(), &raw_tokenizer));
+        tokenizer.reset(raw_tokenizer);
+        OgaThrowIfFailed(OgaTokenizerToTokenId(raw_tokenizer, "<|end|>", &end_token_id));
+    }
+};
+
+json HandleWorkerRequest(ModelContext& context, const json& request, const PoolOptions& options) {
+    if (request.value("cmd", std::string{}) == "stats") {
+        return ReadMemoryUsage();
+    }
+    return Generate(context.model.get(), context.tokenizer.get(), context.end_token_id, request, options.max_tokens);
+}
+
+[[noreturn]] void RunWorkerProcess(int fd, const PoolOptions& options) {
+    LineChannel channel(fd);
+    try {
+        ModelContext context(options);
+        channel.WriteLine(json{{"ready", true}}.dump());
+        std::string line;
+        while (channel.ReadLine(line)) {
+            json response;
+            try {
+                response = HandleWorkerRequest(context, json::parse(line), options);
+            } catch (const std::exception& e) {
+                response = {{"error", e.what()}};
+            }
+            if (!channel.WriteLine(response.dump())) {
+                break;
+            }
+        }
+    } catch (const std::exception& e) {
+        channel.WriteLine(json{{"error", e.what()}}.dump());
+    }
+    _exit(0);
+}
+
+// Hands requests to idle workers. Processes talk over socketpairs, threads call straight into the shared model.
+class Dispatcher {
+public:
+    explicit Dispatcher(const PoolOptions& options) : options_{options} {
+        for (size_t i = 0; i < options_.workers; i++) {
+            idle_.push_back(i);
+        }
+        if (options_.use_processes) {
+            workers_.resize(options_.workers);
+            for (size_t i = 0; i < options_.workers; i++) {
+                StartWorkerProcess(i);
+            }
+        } else {
+            shared_context_ = std::make_unique<ModelContext>(options_);
+        }
+    }
+
+    ~Dispatcher() {
+        for (auto& worker : workers_) {
+            StopWorkerProcess(worker);
+        }
+    }
+
+    json Call(const json& request) {
+        size_t index = AcquireWorker();  // Throws once every worker is out of rotation
+        json response;
+        try {
+            response = CallWorker(index, request);
+        } catch (const std::exception& e) {
+            response = {{"error", e.what()}};
+        }
+        ReleaseWorker(index);
+        return response;
+    }
+
+    json CollectStats() {
+        json stats = {{"mode", options_.use_processes ? "processes" : "threads"}, {"workers", json::array()}};
+        if (!options_.use_processes) {
+            stats["workers"].push_back(ReadMemoryUsage());
+            return stats;
+        }
+        for (size_t i = 0; i < options_.workers; i++) {
+            if (!AcquireSpecificWorker(i)) {
+                stats["workers"].push_back({{"error", "Out of rotation, it could not be restarted"}});
+                continue;
+            }
+            json worker_stats;
+            try {
+                worker_stats = CallWorker(i, {{"cmd", "stats"}});
+            } catch (const std::exception& e) {
+                worker_stats = {{"error", e.what()}};
+            }
+            stats["workers"].push_back(worker_stats);
+            ReleaseWorker(i);
+        }
+        return stats;
+    }
+
+private:
+    struct WorkerProcess {
+        pid_t pid{-1};
+        std::unique_ptr<LineChannel> channel;
+        bool retired{};  // Out of rotation, guarded by mutex_
+    };
+
+    // Attempts to replace a crashed worker before it is taken out of rotation
+    static constexpr int kRestartAttempts = 3;
+
+    // The worker executes this binary again instead of running in the forked copy: restarts fork while dispatcher
+    // threads run, and only async-signal-safe calls are allowed between fork and exec. Every descriptor of the
+    // dispatcher is close-on-exec, so a worker holds nothing but its own end of its socketpair, and a crashed
+    // worker's socket sees EOF.
+    void StartWorkerProcess(size_t index) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+            throw std::runtime_error(std::string("socketpair: ") + std::strerror(errno));
+        }
+        std::vector<std::string> args = {"worker_pool", options_.model_path, "worker", "--worker-fd",
+                                         std::to_string(fds[1]), "--max-tokens", std::to_string(options_.max_tokens)};
+        std::vector<char*> argv;
+        for (auto& arg : args) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+        }
+        if (pid == 0) {
+            fcntl(fds[1], F_SETFD, 0);  // The one descriptor the worker keeps
+            execv("/proc/self/exe", argv.data());
+            _exit(127);
+        }
+        close(fds[1]);
+        auto& worker = workers_[index];
+        worker.pid = pid;
+        worker.channel = std::make_unique<LineChannel>(fds[0]);
+
+        std::string ready;
+        if (!worker.channel->ReadLine(ready) || !json::accept(ready) || json::parse(ready).contains("error")) {
+            StopWorkerProcess(worker);
+            throw std::runtime_error("Worker " + std::to_string(index) + " failed to load the model: " + ready);
+        }
+    }
+
+    // Leaves the worker stopped (pid -1) if every attempt fails
+    bool RestartWorkerProcess(size_t index) {
+        for (int attempt = 1; attempt <= kRestartAttempts; attempt++) {
+            try {
+                StartWorkerProcess(index);
+                return true;
+            } catch (const std::exception& e) {
+                std::cerr << "⚠️  Restart " << attempt << "/" << kRestartAttempts << " of worker " << index
+                          << " failed: " << e.what() << "\n";
+            }
+        }
+        return false;
+    }
+
+    void StopWorkerProcess(WorkerProcess& worker) {
+        if (worker.pid <= 0) {
+            return;
+        }
+        close(worker.channel->fd());
+        worker.channel.reset();
+        kill(worker.pid, SIGTERM);
+        waitpid(worker.pid, nullptr, 0);
+        worker.pid = -1;
+    }
+
+    json CallWorker(size_t index, const json& request) {
+        if (!options_.use_processes) {
+            return HandleWorkerRequest(*shared_context_, request, options_);
+        }
+        auto& worker = workers_[index];
+        std::string line;
+        if (!worker.channel->WriteLine(request.dump()) || !worker.channel->ReadLine(line)) {
+            // The worker died; isolation means only this request fails. Replace the worker and report it.
+            StopWorkerProcess(worker);
+            if (!RestartWorkerProcess(index)) {
+                throw std::runtime_error("Worker " + std::to_string(index) + " crashed and could not be restarted");
+            }
+            throw std::runtime_error("Worker " + std::to_string(index) + " crashed and was restarted");
+        }
+        return json::parse(line);
+    }
+
+    size_t AcquireWorker() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        available_.wait(lock, [this] { return !idle_.empty() || retired_ == options_.workers; });
+        if (idle_.empty()) {
+            throw std::runtime_error("No workers left, every one of them failed to restart");
+        }
+        size_t index = idle_.front();
+        idle_.pop_front();
+        return index;
+    }
+
+    // False if the worker is out of rotation
+    bool AcquireSpecificWorker(size_t index) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::deque<size_t>::iterator it;
+        available_.wait(lock, [&] {
+            it = std::find(idle_.begin(), idle_.end(), index);
+            return it != idle_.end() || workers_[index].retired;
+        });
+        if (it == idle_.end()) {
+            return false;
+        }
+        idle_.erase(it);
+        return true;
+    }
+
+    // A worker process that couldn't be restarted goes out of rotation instead of back to the idle ones
+    void ReleaseWorker(size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (options_.use_processes && workers_[index].pid <= 0) {
+                workers_[index].retired = true;
+                retired_++;
+            } else {
+                idle_.push_back(index);
+            }
+        }
+        available_.notify_all();
+    }
+
+    PoolOptions options_;
+    std::vector<WorkerProcess> workers_;
+    std::unique_ptr<ModelContext> shared_context_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::deque<size_t> idle_;
+    size_t retired_{};  // Workers out of rotation
+};
+
+int ListenUnix(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 64) < 0) {
+        throw std::runtime_error("Cannot listen on " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+int ConnectUnix(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        throw std::runtime_error("Cannot connect to " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+void ServeClient(Dispatcher& dispatcher, int fd) {
+    LineChannel channel(fd);
+    std::string line;
+    while (channel.ReadLine(line)) {
+        json response;
+        try {
+            json request = json::parse(line);
+            response = request.value("cmd", std::string{}) == "stats" ? dispatcher.CollectStats() : dispatcher.Call(request);
+        } catch (const std::exception& e) {
+            response = {{"error", e.what()}};
+        }
+        if (!channel.WriteLine(response.dump())) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+void AcceptLoop(Dispatcher& dispatcher, int listen_fd) {
+    while (true) {
+        int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            return;  // Listening socket was shut down
+        }
+        std::thread(ServeClient, std::ref(dispatcher), client).detach();
+    }
+}
+
+int RunBench(const PoolOptions& options) {
+    const char* prompts[] = {
+        "What is the capital of France?",
+        "Explain photosynthesis in two sentences.",
+        "Write a haiku about the sea.",
+        "List three uses of a paperclip.",
+    };
+
+    std::atomic<size_t> next_request{0};
+    std::atomic<size_t> total_tokens{0};
+    std::atomic<size_t> errors{0};
+    auto start = OgaClock::now();
+
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < options.bench_clients; c++) {
+        clients.emplace_back([&] {
+            LineChannel channel(ConnectUnix(options.socket_path));
+            while (true) {
+                size_t i = next_request++;
+                if (i >= options.bench_requests) {
+                    break;
+                }
+                std::string line;
+                json request = {{"prompt", prompts[i % std::size(prompts)]}, {"max_tokens", options.max_tokens}};
+                if (!channel.WriteLine(request.dump()) || !channel.ReadLine(line)) {
+                    errors++;
+                    break;
+                }
+                json response = json::parse(line);
+                if (response.contains("error")) {
+                    errors++;
+                } else {
+                    total_tokens += response["tokens"].get<size_t>();
+                }
+            }
+            close(channel.fd());
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = OgaMillisecondsSince(start) / 1000.0;
+
+    LineChannel stats_channel(ConnectUnix(options.socket_path));
+    std::string line;
+    stats_channel.WriteLine(json{{"cmd", "stats"}}.dump());
+    stats_channel.ReadLine(line);
+    close(stats_channel.fd());
+    json stats = json::parse(line);
+
+    double total_rss = 0, total_pss = 0;
+    std::cout << "🏆 " << (options.use_processes ? "Processes" : "Threads") << " x " << options.workers << ":\n";
+    for (const auto& worker : stats["workers"]) {
+        double rss = worker.value("Rss_mb", 0.0);
+        double pss = worker.value("Pss_mb", 0.0);
+        total_rss += rss;
+        total_pss += pss;
+        std::cout << "  pid " << worker["pid"] << ": RSS " << rss << " MB, PSS " << pss << " MB, shared clean "
+                  << worker.value("Shared_Clean_mb", 0.0) << " MB, private " << worker.value("Private_Clean_mb", 0.0) +
+                                                                               worker.value("Private_Dirty_mb", 0.0)
+                  << " MB\n";
+    }
+    std::cout << "  total RSS " << total_rss << " MB, total PSS (actual memory cost) " << total_pss << " MB\n"
+              << "  " << options.bench_requests << " requests from " << options.bench_clients << " clients in "
+              << seconds << "s: " << (options.bench_requests / seconds) << " requests/s, "
+              << (total_tokens / seconds) << " tokens/s, " << errors << " errors\n";
+    return errors == 0 ? 0 : 1;
+}
+
+bool ParseArguments(int argc, char* argv[], PoolOptions& options) {
+    if (argc < 3) {
+        return false;
+    }
+    options.model_path = argv[1];
+    options.command = argv[2];
+    if (options.command != "serve" && options.command != "bench" && options.command != "worker") {
+        return false;
+    }
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--mode") {
+            options.use_processes = value != "threads";
+        } else if (flag == "--workers") {
+            options.workers = std::max(1, std::stoi(value));
+        } else if (flag == "--socket") {
+            options.socket_path = value;
+        } else if (flag == "--requests") {
+            options.bench_requests = std::stoul(value);
+        } else if (flag == "--clients") {
+            options.bench_clients = std::max(1, std::stoi(value));
+        } else if (flag == "--max-tokens") {
+            options.max_tokens = std::max(1, std::stoi(value));
+        } else if (flag == "--worker-fd") {
+            options.worker_fd = std::stoi(value);
+        } else {
+            return false;
+        }
+    }
+    return options.command != "worker" || options.worker_fd >= 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    PoolOptions options;
+    if (!ParseArguments(argc, argv, options)) {
+        std::cout << "Usage: " << argv[0] << " <model_path> serve|bench [--mode processes|threads] [--workers 4]\n"
+                  << "       [--socket /tmp/phi3_worker_pool.sock] [--requests 32] [--clients 8] [--max-tokens 64]\n";
+        return 1;
+    }
+
+    if (options.command == "worker") {
+        RunWorkerProcess(options.worker_fd, options);  // Started by the dispatcher, see StartWorkerProcess
+    }
+
+    try {
+        std::cout << "🔧 Starting " << options.workers << " " << (options.use_processes ? "worker processes" : "worker threads")
+                  << " for " << options.model_path << "\n";
+        Dispatcher dispatcher(options);
+        int listen_fd = ListenUnix(options.socket_path);
+        std::thread acceptor(AcceptLoop, std::ref(dispatcher), listen_fd);
+
+        int status = 0;
+        if (options.command == "bench") {
+            status = RunBench(options);
+        } else {
+            std::cout << "🚀 Dispatching on " << options.socket_path << "\n";
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigaddset(&signals, SIGINT);
+            sigaddset(&signals, SIGTERM);
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+            int signal_number = 0;
+            sigwait(&signals, &signal_number);
+        }
+
+        shutdown(listen_fd, SHUT_RDWR);
+        close(listen_fd);
+        acceptor.join();
+        unlink(options.socket_path.c_str());
+        return status;
+    } catch (const std::exception& e) {
+        std::cerr << "❌ Exception: " << e.what() << "\n";
+        return 1;
+    }
+}